@@ -0,0 +1,166 @@
+/**
+ * @file dda.h
+ * @author https://github.com/shaderko
+ * @brief Integer grid stepping for rays, compiles as both C and GLSL so the cpu traversal and the shader step the same way
+ * @version 0.1
+ * @date 2024-06-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Only GLSL defines the profile macros, the few differences between the languages are hidden behind the macros below.
+ * Shaders include it with #include "dda.h", which render_init expands before compiling.
+ * Cells are integers and only the ray parameters are floats, so rays never lose a cell at large coordinates.
+ */
+
+#ifndef DDA_H
+#define DDA_H
+
+#if defined(GL_core_profile) || defined(GL_compatibility_profile) || defined(GL_ES)
+
+#define DDA_FUNCTION
+#define DDA_IN in
+#define DDA_INOUT(type) inout type
+#define DDA_REF(value) value
+#define DDA_INT(value) int(value)
+#define DDA_FLOOR(value) floor(value)
+#define DDAVec3 vec3
+#define DDAIVec3 ivec3
+
+#else
+
+#include <math.h>
+
+#define DDA_FUNCTION static inline
+#define DDA_IN const
+#define DDA_INOUT(type) type *
+#define DDA_REF(value) (*value)
+#define DDA_INT(value) ((int)(value))
+#define DDA_FLOOR(value) floorf(value)
+typedef float DDAVec3[3];
+typedef int DDAIVec3[3];
+
+typedef struct DDAWalk DDAWalk;
+
+#endif
+
+#define DDA_INFINITY 1e30f // Ray parameter of axes the ray doesn't move along
+
+// Walk of a ray through a grid of cells
+struct DDAWalk
+{
+    DDAIVec3 cell; // Cell the ray is in
+    DDAIVec3 cell_step; // 1 or -1 on every axis, 0 on axes the ray doesn't move along
+    DDAVec3 inverse_direction;
+    DDAVec3 t_max;   // Ray parameter where the ray crosses the next cell border on each axis
+    DDAVec3 t_delta; // Ray parameter between two cell borders on each axis
+    float t;         // Ray parameter where the ray entered the cell
+    int axis;        // Axis the ray crossed to enter the cell, -1 if it started in it
+};
+
+// Starts the walk through cells of cell_size at ray parameter t
+DDA_FUNCTION DDAWalk dda_begin(DDA_IN DDAVec3 origin, DDA_IN DDAVec3 direction, float t, float cell_size)
+{
+    DDAWalk walk;
+    walk.t = t;
+    walk.axis = -1;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float position = origin[axis] + direction[axis] * t;
+        walk.cell[axis] = DDA_INT(DDA_FLOOR(position / cell_size));
+
+        if (direction[axis] == 0.0f)
+        {
+            walk.cell_step[axis] = 0;
+            walk.inverse_direction[axis] = DDA_INFINITY;
+            walk.t_max[axis] = DDA_INFINITY;
+            walk.t_delta[axis] = DDA_INFINITY;
+            continue;
+        }
+
+        walk.cell_step[axis] = direction[axis] > 0.0f ? 1 : -1;
+        walk.inverse_direction[axis] = 1.0f / direction[axis];
+        walk.t_delta[axis] = cell_size * walk.inverse_direction[axis] * walk.cell_step[axis];
+
+        float border = (walk.cell[axis] + (walk.cell_step[axis] > 0 ? 1 : 0)) * cell_size;
+        walk.t_max[axis] = (border - origin[axis]) * walk.inverse_direction[axis];
+    }
+
+    return walk;
+}
+
+// Moves to the next cell along the axis with the closest border
+DDA_FUNCTION void dda_step(DDA_INOUT(DDAWalk) walk)
+{
+    int axis = DDA_REF(walk).t_max[0] < DDA_REF(walk).t_max[1] ? (DDA_REF(walk).t_max[0] < DDA_REF(walk).t_max[2] ? 0 : 2) : (DDA_REF(walk).t_max[1] < DDA_REF(walk).t_max[2] ? 1 : 2);
+
+    DDA_REF(walk).t = DDA_REF(walk).t_max[axis];
+    DDA_REF(walk).cell[axis] += DDA_REF(walk).cell_step[axis];
+    DDA_REF(walk).t_max[axis] += DDA_REF(walk).t_delta[axis];
+    DDA_REF(walk).axis = axis;
+}
+
+/**
+ * Keeps the walk inside the box of cells from box_min to box_max, the ray has to be inside the box at the walk's t.
+ * Entry axis is the axis the ray entered the box through, -1 if it starts inside. Float errors can't put the first
+ * cell outside the box or skip the first cell behind the entry face
+ */
+DDA_FUNCTION void dda_enter_box(DDA_INOUT(DDAWalk) walk, DDA_IN DDAVec3 origin, float cell_size, DDA_IN DDAIVec3 box_min, DDA_IN DDAIVec3 box_max, int entry_axis)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int cell = DDA_REF(walk).cell[axis];
+        if (axis == entry_axis)
+            cell = DDA_REF(walk).cell_step[axis] > 0 ? box_min[axis] : box_max[axis];
+
+        DDA_REF(walk).cell[axis] = cell < box_min[axis] ? box_min[axis] : (cell > box_max[axis] ? box_max[axis] : cell);
+
+        if (DDA_REF(walk).cell_step[axis] != 0)
+        {
+            float border = (DDA_REF(walk).cell[axis] + (DDA_REF(walk).cell_step[axis] > 0 ? 1 : 0)) * cell_size;
+            DDA_REF(walk).t_max[axis] = (border - origin[axis]) * DDA_REF(walk).inverse_direction[axis];
+        }
+    }
+
+    DDA_REF(walk).axis = entry_axis;
+}
+
+/**
+ * Moves a walk of unit cells out of the box of cells from box_min to box_max, into the cell right behind the face the
+ * ray leaves through. Octree traversal calls it with the empty node the cell is in, so the whole node is one step.
+ * The other axes stay inside the box, so the walk can't skip a cell next to it
+ */
+DDA_FUNCTION void dda_leave_box(DDA_INOUT(DDAWalk) walk, DDA_IN DDAVec3 origin, DDA_IN DDAVec3 direction, DDA_IN DDAIVec3 box_min, DDA_IN DDAIVec3 box_max)
+{
+    float t_exit = DDA_INFINITY;
+    int exit_axis = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (DDA_REF(walk).cell_step[axis] == 0)
+            continue;
+
+        float border = DDA_REF(walk).cell_step[axis] > 0 ? box_max[axis] + 1 : box_min[axis];
+        float t_axis = (border - origin[axis]) * DDA_REF(walk).inverse_direction[axis];
+        if (t_axis < t_exit)
+        {
+            t_exit = t_axis;
+            exit_axis = axis;
+        }
+    }
+
+    DDA_REF(walk).t = t_exit > DDA_REF(walk).t ? t_exit : DDA_REF(walk).t;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (axis == exit_axis)
+            continue;
+
+        int cell = DDA_INT(DDA_FLOOR(origin[axis] + direction[axis] * DDA_REF(walk).t));
+        DDA_REF(walk).cell[axis] = cell < box_min[axis] ? box_min[axis] : (cell > box_max[axis] ? box_max[axis] : cell);
+    }
+
+    DDA_REF(walk).cell[exit_axis] = DDA_REF(walk).cell_step[exit_axis] > 0 ? box_max[exit_axis] + 1 : box_min[exit_axis] - 1;
+    DDA_REF(walk).axis = exit_axis;
+}
+
+#endif
@@ -0,0 +1,422 @@
+/**
+ * @file offset_allocator.c
+ * @author https://github.com/shaderko
+ * @brief Hands out ranges of a big buffer, doesn't own any memory itself so it can manage gpu buffers.
+ * @version 0.1
+ * @date 2024-06-08
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <string.h>
+
+#include "offset_allocator.h"
+#include "../../util/util.h"
+
+#define FIRST_NODES_CAPACITY 64
+
+// Bin the size belongs to, sizes in a bin are between its size and the size of the next bin
+static void bin_of(unsigned int size, unsigned int *first_level, unsigned int *second_level)
+{
+    if (size < OFFSET_ALLOCATOR_SECOND_LEVEL_COUNT)
+    {
+        *first_level = 0;
+        *second_level = size;
+        return;
+    }
+
+    unsigned int highest_bit = MSB(size);
+    *first_level = highest_bit - OFFSET_ALLOCATOR_SECOND_LEVEL_BITS + 1;
+    *second_level = (size >> (highest_bit - OFFSET_ALLOCATOR_SECOND_LEVEL_BITS)) & (OFFSET_ALLOCATOR_SECOND_LEVEL_COUNT - 1);
+}
+
+// First bin where every node is at least size big
+static void bin_round_up(unsigned int size, unsigned int *first_level, unsigned int *second_level)
+{
+    if (size >= OFFSET_ALLOCATOR_SECOND_LEVEL_COUNT)
+    {
+        unsigned int round = (1U << (MSB(size) - OFFSET_ALLOCATOR_SECOND_LEVEL_BITS)) - 1;
+        if (size + round > size)
+            size += round;
+    }
+
+    bin_of(size, first_level, second_level);
+}
+
+static unsigned int create_node(OffsetAllocator *allocator, unsigned int offset, unsigned int size)
+{
+    unsigned int node;
+    if (allocator->unused_nodes_count)
+    {
+        node = allocator->unused_nodes[--allocator->unused_nodes_count];
+    }
+    else
+    {
+        if (allocator->nodes_count == allocator->nodes_capacity)
+        {
+            allocator->nodes_capacity = allocator->nodes_capacity ? allocator->nodes_capacity * 2 : FIRST_NODES_CAPACITY;
+            allocator->nodes = realloc(allocator->nodes, allocator->nodes_capacity * sizeof(OffsetAllocatorNode));
+            allocator->unused_nodes = realloc(allocator->unused_nodes, allocator->nodes_capacity * sizeof(unsigned int));
+            if (!allocator->nodes || !allocator->unused_nodes)
+                ERROR_EXIT("[ERROR] Failed to allocate memory for offset allocator nodes.\n");
+        }
+
+        node = allocator->nodes_count++;
+    }
+
+    allocator->nodes[node] = (OffsetAllocatorNode){
+        .offset = offset,
+        .size = size,
+        .previous = OFFSET_ALLOCATOR_NONE,
+        .next = OFFSET_ALLOCATOR_NONE,
+        .previous_free = OFFSET_ALLOCATOR_NONE,
+        .next_free = OFFSET_ALLOCATOR_NONE,
+        .used = false,
+    };
+
+    return node;
+}
+
+static void release_node(OffsetAllocator *allocator, unsigned int node)
+{
+    allocator->unused_nodes[allocator->unused_nodes_count++] = node;
+}
+
+static void insert_free(OffsetAllocator *allocator, unsigned int node)
+{
+    unsigned int first_level, second_level;
+    bin_of(allocator->nodes[node].size, &first_level, &second_level);
+
+    unsigned int bin = first_level * OFFSET_ALLOCATOR_SECOND_LEVEL_COUNT + second_level;
+    unsigned int head = allocator->bins[bin];
+
+    allocator->nodes[node].previous_free = OFFSET_ALLOCATOR_NONE;
+    allocator->nodes[node].next_free = head;
+    if (head != OFFSET_ALLOCATOR_NONE)
+        allocator->nodes[head].previous_free = node;
+
+    allocator->bins[bin] = node;
+    allocator->first_level_mask |= 1U << first_level;
+    allocator->second_level_masks[first_level] |= 1U << second_level;
+}
+
+static void remove_free(OffsetAllocator *allocator, unsigned int node)
+{
+    OffsetAllocatorNode *current = &allocator->nodes[node];
+
+    if (current->previous_free != OFFSET_ALLOCATOR_NONE)
+        allocator->nodes[current->previous_free].next_free = current->next_free;
+    if (current->next_free != OFFSET_ALLOCATOR_NONE)
+        allocator->nodes[current->next_free].previous_free = current->previous_free;
+
+    // The node was the first of its bin
+    if (current->previous_free == OFFSET_ALLOCATOR_NONE)
+    {
+        unsigned int first_level, second_level;
+        bin_of(current->size, &first_level, &second_level);
+
+        unsigned int bin = first_level * OFFSET_ALLOCATOR_SECOND_LEVEL_COUNT + second_level;
+        allocator->bins[bin] = current->next_free;
+
+        if (current->next_free == OFFSET_ALLOCATOR_NONE)
+        {
+            allocator->second_level_masks[first_level] &= ~(1U << second_level);
+            if (!allocator->second_level_masks[first_level])
+                allocator->first_level_mask &= ~(1U << first_level);
+        }
+    }
+
+    current->previous_free = OFFSET_ALLOCATOR_NONE;
+    current->next_free = OFFSET_ALLOCATOR_NONE;
+}
+
+static OffsetAllocator *Init(unsigned int size)
+{
+    OffsetAllocator *allocator = malloc(sizeof(OffsetAllocator));
+    if (!allocator)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for offset allocator.\n");
+
+    memset(allocator, 0, sizeof(OffsetAllocator));
+    memset(allocator->bins, 0xFF, sizeof(allocator->bins));
+    allocator->last_node = OFFSET_ALLOCATOR_NONE;
+
+    if (size)
+    {
+        allocator->size = size;
+        allocator->last_node = create_node(allocator, 0, size);
+        insert_free(allocator, allocator->last_node);
+    }
+
+    return allocator;
+}
+
+static void Delete(OffsetAllocator *allocator)
+{
+    if (!allocator)
+        return;
+
+    free(allocator->nodes);
+    free(allocator->unused_nodes);
+    free(allocator);
+}
+
+static OffsetAllocation Allocate(OffsetAllocator *allocator, unsigned int size)
+{
+    OffsetAllocation allocation = {0, OFFSET_ALLOCATOR_NONE};
+    if (size == 0)
+        size = 1;
+
+    unsigned int first_level, second_level;
+    bin_round_up(size, &first_level, &second_level);
+    if (first_level >= OFFSET_ALLOCATOR_FIRST_LEVEL_COUNT)
+        return allocation;
+
+    // Smallest bin at least as big as the rounded size that has a free node
+    unsigned int second_level_mask = allocator->second_level_masks[first_level] & (~0U << second_level);
+    if (!second_level_mask)
+    {
+        unsigned int first_level_mask = first_level + 1 < OFFSET_ALLOCATOR_FIRST_LEVEL_COUNT ? allocator->first_level_mask & (~0U << (first_level + 1)) : 0;
+        if (!first_level_mask)
+            return allocation;
+
+        first_level = CTZ(first_level_mask);
+        second_level_mask = allocator->second_level_masks[first_level];
+    }
+    second_level = CTZ(second_level_mask);
+
+    unsigned int node = allocator->bins[first_level * OFFSET_ALLOCATOR_SECOND_LEVEL_COUNT + second_level];
+    remove_free(allocator, node);
+
+    // Give the rest of the node back as a new free node right after it
+    unsigned int remainder_size = allocator->nodes[node].size - size;
+    if (remainder_size)
+    {
+        unsigned int remainder = create_node(allocator, allocator->nodes[node].offset + size, remainder_size);
+        OffsetAllocatorNode *current = &allocator->nodes[node];
+
+        allocator->nodes[remainder].previous = node;
+        allocator->nodes[remainder].next = current->next;
+        if (current->next != OFFSET_ALLOCATOR_NONE)
+            allocator->nodes[current->next].previous = remainder;
+        current->next = remainder;
+        current->size = size;
+
+        if (allocator->last_node == node)
+            allocator->last_node = remainder;
+
+        insert_free(allocator, remainder);
+    }
+
+    allocator->nodes[node].used = true;
+    allocator->used_size += size;
+    allocator->allocations_count++;
+
+    allocation.offset = allocator->nodes[node].offset;
+    allocation.node = node;
+
+    return allocation;
+}
+
+static void Free(OffsetAllocator *allocator, unsigned int node)
+{
+    if (node == OFFSET_ALLOCATOR_NONE || node >= allocator->nodes_count || !allocator->nodes[node].used)
+        return;
+
+    OffsetAllocatorNode *current = &allocator->nodes[node];
+    current->used = false;
+    allocator->used_size -= current->size;
+    allocator->allocations_count--;
+
+    // Merge with the free node before it
+    unsigned int previous = current->previous;
+    if (previous != OFFSET_ALLOCATOR_NONE && !allocator->nodes[previous].used)
+    {
+        remove_free(allocator, previous);
+
+        allocator->nodes[previous].size += current->size;
+        allocator->nodes[previous].next = current->next;
+        if (current->next != OFFSET_ALLOCATOR_NONE)
+            allocator->nodes[current->next].previous = previous;
+        if (allocator->last_node == node)
+            allocator->last_node = previous;
+
+        release_node(allocator, node);
+        node = previous;
+        current = &allocator->nodes[node];
+    }
+
+    // And with the free node after it
+    unsigned int next = current->next;
+    if (next != OFFSET_ALLOCATOR_NONE && !allocator->nodes[next].used)
+    {
+        remove_free(allocator, next);
+
+        current->size += allocator->nodes[next].size;
+        current->next = allocator->nodes[next].next;
+        if (current->next != OFFSET_ALLOCATOR_NONE)
+            allocator->nodes[current->next].previous = node;
+        if (allocator->last_node == next)
+            allocator->last_node = node;
+
+        release_node(allocator, next);
+    }
+
+    insert_free(allocator, node);
+}
+
+static unsigned int AllocationSize(OffsetAllocator *allocator, unsigned int node)
+{
+    if (node == OFFSET_ALLOCATOR_NONE || node >= allocator->nodes_count)
+        return 0;
+
+    return allocator->nodes[node].size;
+}
+
+static void Grow(OffsetAllocator *allocator, unsigned int size)
+{
+    if (size <= allocator->size)
+        return;
+
+    unsigned int extra = size - allocator->size;
+    unsigned int last = allocator->last_node;
+
+    if (last != OFFSET_ALLOCATOR_NONE && !allocator->nodes[last].used)
+    {
+        // The buffer ends with free space, make it bigger
+        remove_free(allocator, last);
+        allocator->nodes[last].size += extra;
+        insert_free(allocator, last);
+    }
+    else
+    {
+        unsigned int node = create_node(allocator, allocator->size, extra);
+        allocator->nodes[node].previous = last;
+        if (last != OFFSET_ALLOCATOR_NONE)
+            allocator->nodes[last].next = node;
+
+        allocator->last_node = node;
+        insert_free(allocator, node);
+    }
+
+    allocator->size = size;
+}
+
+static OffsetAllocatorStats GetStats(OffsetAllocator *allocator)
+{
+    OffsetAllocatorStats stats = {0};
+    stats.size = allocator->size;
+    stats.used_size = allocator->used_size;
+    stats.free_size = allocator->size - allocator->used_size;
+    stats.allocations_count = allocator->allocations_count;
+
+    // The largest free node is in the highest bin that has any
+    if (allocator->first_level_mask)
+    {
+        unsigned int first_level = MSB(allocator->first_level_mask);
+        unsigned int second_level = MSB(allocator->second_level_masks[first_level]);
+        unsigned int node = allocator->bins[first_level * OFFSET_ALLOCATOR_SECOND_LEVEL_COUNT + second_level];
+        for (; node != OFFSET_ALLOCATOR_NONE; node = allocator->nodes[node].next_free)
+        {
+            if (allocator->nodes[node].size > stats.largest_free_size)
+                stats.largest_free_size = allocator->nodes[node].size;
+        }
+    }
+
+    unsigned int last = allocator->last_node;
+    if (last != OFFSET_ALLOCATOR_NONE)
+        stats.end = allocator->nodes[last].used ? allocator->size : allocator->nodes[last].offset;
+
+    stats.fragmentation = stats.free_size ? 1.0f - (float)stats.largest_free_size / stats.free_size : 0.0f;
+
+    return stats;
+}
+
+static bool Validate(OffsetAllocator *allocator)
+{
+    if (allocator->last_node == OFFSET_ALLOCATOR_NONE)
+        return allocator->size == 0 && allocator->used_size == 0;
+
+    // Walk the buffer from the end, nodes have to cover it without gaps
+    unsigned int end = allocator->size;
+    unsigned int used_size = 0;
+    unsigned int allocations_count = 0;
+    unsigned int free_count = 0;
+    bool next_free = false;
+
+    for (unsigned int node = allocator->last_node; node != OFFSET_ALLOCATOR_NONE; node = allocator->nodes[node].previous)
+    {
+        OffsetAllocatorNode *current = &allocator->nodes[node];
+        if (current->offset + current->size != end || current->size == 0)
+            ERROR_RETURN(false, "[ERROR] Offset allocator node %u at %u doesn't end where the next one starts.\n", node, current->offset);
+
+        if (current->previous != OFFSET_ALLOCATOR_NONE && allocator->nodes[current->previous].next != node)
+            ERROR_RETURN(false, "[ERROR] Offset allocator node %u has a wrong previous node.\n", node);
+
+        if (current->used)
+        {
+            used_size += current->size;
+            allocations_count++;
+            next_free = false;
+        }
+        else
+        {
+            if (next_free)
+                ERROR_RETURN(false, "[ERROR] Offset allocator node %u wasn't merged with the free node after it.\n", node);
+
+            free_count++;
+            next_free = true;
+        }
+
+        end = current->offset;
+    }
+
+    if (end != 0)
+        ERROR_RETURN(false, "[ERROR] Offset allocator doesn't start at 0.\n");
+
+    if (used_size != allocator->used_size || allocations_count != allocator->allocations_count)
+        ERROR_RETURN(false, "[ERROR] Offset allocator used size or allocation count is wrong.\n");
+
+    // Every free node has to be in the bin of its size, and bins with nodes have their bits set
+    unsigned int binned_count = 0;
+    for (unsigned int first_level = 0; first_level < OFFSET_ALLOCATOR_FIRST_LEVEL_COUNT; first_level++)
+    {
+        for (unsigned int second_level = 0; second_level < OFFSET_ALLOCATOR_SECOND_LEVEL_COUNT; second_level++)
+        {
+            unsigned int head = allocator->bins[first_level * OFFSET_ALLOCATOR_SECOND_LEVEL_COUNT + second_level];
+            bool has_bit = (allocator->second_level_masks[first_level] >> second_level) & 1;
+            if (has_bit != (head != OFFSET_ALLOCATOR_NONE))
+                ERROR_RETURN(false, "[ERROR] Offset allocator bin %u, %u doesn't match its bit.\n", first_level, second_level);
+
+            for (unsigned int node = head; node != OFFSET_ALLOCATOR_NONE; node = allocator->nodes[node].next_free)
+            {
+                unsigned int node_first_level, node_second_level;
+                bin_of(allocator->nodes[node].size, &node_first_level, &node_second_level);
+                if (allocator->nodes[node].used || node_first_level != first_level || node_second_level != second_level)
+                    ERROR_RETURN(false, "[ERROR] Offset allocator node %u is in the wrong bin.\n", node);
+
+                binned_count++;
+            }
+        }
+
+        if (((allocator->first_level_mask >> first_level) & 1) != (allocator->second_level_masks[first_level] != 0))
+            ERROR_RETURN(false, "[ERROR] Offset allocator first level %u doesn't match its bit.\n", first_level);
+    }
+
+    if (binned_count != free_count)
+        ERROR_RETURN(false, "[ERROR] Offset allocator has %u free nodes but %u in bins.\n", free_count, binned_count);
+
+    return true;
+}
+
+struct AOffsetAllocator AOffsetAllocator =
+    {
+        .Init = Init,
+        .Delete = Delete,
+        .Allocate = Allocate,
+        .Free = Free,
+        .AllocationSize = AllocationSize,
+        .Grow = Grow,
+        .GetStats = GetStats,
+        .Validate = Validate,
+};
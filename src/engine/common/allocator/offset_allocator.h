@@ -0,0 +1,125 @@
+/**
+ * @file offset_allocator.h
+ * @author https://github.com/shaderko
+ * @brief Hands out ranges of a big buffer, doesn't own any memory itself so it can manage gpu buffers.
+ * @version 0.1
+ * @date 2024-06-08
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef OFFSET_ALLOCATOR_H
+#define OFFSET_ALLOCATOR_H
+
+#include <stdbool.h>
+
+#define OFFSET_ALLOCATOR_NONE 0xFFFFFFFFU // No allocation or no node
+
+#define OFFSET_ALLOCATOR_SECOND_LEVEL_BITS 3
+#define OFFSET_ALLOCATOR_SECOND_LEVEL_COUNT (1 << OFFSET_ALLOCATOR_SECOND_LEVEL_BITS)
+#define OFFSET_ALLOCATOR_FIRST_LEVEL_COUNT 32
+
+// Range of the buffer, either allocated or free
+typedef struct OffsetAllocatorNode OffsetAllocatorNode;
+struct OffsetAllocatorNode
+{
+    unsigned int offset;
+    unsigned int size;
+
+    // Neighbours in the buffer
+    unsigned int previous;
+    unsigned int next;
+
+    // Neighbours in the free list of the bin, only for free nodes
+    unsigned int previous_free;
+    unsigned int next_free;
+
+    bool used;
+};
+
+/**
+ * Two level segregated fit allocator (TLSF). Free ranges are kept in bins by size, the first level is
+ * the highest bit of the size and the second level splits that into 8 more bins, so finding a range
+ * and freeing one is constant time. Freed ranges are merged with free neighbours right away.
+ * Sizes and offsets are in whatever unit the caller uses for the buffer.
+ */
+typedef struct OffsetAllocator OffsetAllocator;
+struct OffsetAllocator
+{
+    unsigned int size;
+
+    // Bit per bin that has free nodes
+    unsigned int first_level_mask;
+    unsigned char second_level_masks[OFFSET_ALLOCATOR_FIRST_LEVEL_COUNT];
+    unsigned int bins[OFFSET_ALLOCATOR_FIRST_LEVEL_COUNT * OFFSET_ALLOCATOR_SECOND_LEVEL_COUNT]; // First free node of each bin
+
+    OffsetAllocatorNode *nodes;
+    unsigned int nodes_count;
+    unsigned int nodes_capacity;
+
+    // Node slots that can be reused
+    unsigned int *unused_nodes;
+    unsigned int unused_nodes_count;
+
+    unsigned int last_node; // Node at the end of the buffer
+
+    unsigned int used_size;
+    unsigned int allocations_count;
+};
+
+typedef struct OffsetAllocation OffsetAllocation;
+struct OffsetAllocation
+{
+    unsigned int offset;
+    unsigned int node; // OFFSET_ALLOCATOR_NONE if there was no space
+};
+
+typedef struct OffsetAllocatorStats OffsetAllocatorStats;
+struct OffsetAllocatorStats
+{
+    unsigned int size;
+    unsigned int used_size;
+    unsigned int free_size;
+    unsigned int largest_free_size;
+    unsigned int allocations_count;
+    unsigned int end; // End of the last allocation, nothing after it is used
+
+    // Part of the free space that isn't in the largest free range, 0 means all free space is in one range
+    float fragmentation;
+};
+
+struct AOffsetAllocator
+{
+    /**
+     * Creates an allocator for a buffer of size units
+     */
+    OffsetAllocator *(*Init)(unsigned int size);
+    void (*Delete)(OffsetAllocator *allocator);
+
+    /**
+     * Returns a range of at least size units, node is OFFSET_ALLOCATOR_NONE if no free range is big enough
+     */
+    OffsetAllocation (*Allocate)(OffsetAllocator *allocator, unsigned int size);
+    void (*Free)(OffsetAllocator *allocator, unsigned int node);
+
+    // Size of the allocation, can be a bit more than what was asked for
+    unsigned int (*AllocationSize)(OffsetAllocator *allocator, unsigned int node);
+
+    /**
+     * Makes the buffer bigger, the new space is added after the current end
+     */
+    void (*Grow)(OffsetAllocator *allocator, unsigned int size);
+
+    OffsetAllocatorStats (*GetStats)(OffsetAllocator *allocator);
+
+    /**
+     * Checks that the nodes, free lists and bins agree with each other, returns false and prints the
+     * first problem if they don't
+     */
+    bool (*Validate)(OffsetAllocator *allocator);
+};
+
+extern struct AOffsetAllocator AOffsetAllocator;
+
+#endif
@@ -13,6 +13,15 @@
 #include <stdlib.h>
 #include <errno.h>
 
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "../common/types/types.h"
 #include "../util/util.h"
 #include "../io/io.h"
@@ -111,3 +120,81 @@ int io_file_write(void *buffer, size_t size, const char *path)
 
     return 0;
 }
+
+File io_file_map(const char *path)
+{
+    File file = {.is_valid = false};
+
+#if defined(_WIN32)
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        ERROR_RETURN(file, "error mapping file: %s. error: %lu\n", path, GetLastError());
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(handle);
+        ERROR_RETURN(file, "error mapping empty or unreadable file: %s\n", path);
+    }
+
+    // The view keeps the file open, so both handles can be closed right away
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(handle);
+    if (!mapping)
+    {
+        ERROR_RETURN(file, "error mapping file: %s. error: %lu\n", path, GetLastError());
+    }
+
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!data)
+    {
+        ERROR_RETURN(file, "error mapping file: %s. error: %lu\n", path, GetLastError());
+    }
+
+    file.len = (size_t)size.QuadPart;
+#else
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0)
+    {
+        ERROR_RETURN(file, "error mapping file: %s. errno: %d\n", path, errno);
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+    {
+        close(descriptor);
+        ERROR_RETURN(file, "error mapping empty or unreadable file: %s\n", path);
+    }
+
+    // The mapping keeps the file open, so the descriptor can be closed right away
+    void *data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (data == MAP_FAILED)
+    {
+        ERROR_RETURN(file, "error mapping file: %s. errno: %d\n", path, errno);
+    }
+
+    madvise(data, (size_t)status.st_size, MADV_SEQUENTIAL);
+    file.len = (size_t)status.st_size;
+#endif
+
+    file.data = data;
+    file.is_valid = true;
+
+    return file;
+}
+
+void io_file_unmap(File file)
+{
+    if (!file.is_valid)
+        return;
+
+#if defined(_WIN32)
+    UnmapViewOfFile(file.data);
+#else
+    munmap(file.data, file.len);
+#endif
+}
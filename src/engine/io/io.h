@@ -25,4 +25,8 @@ typedef struct file
 File io_file_read(const char *path);
 int io_file_write(void *buffer, size_t size, const char *path);
 
+// Maps the file read only instead of copying it, pages are read when touched. Data isn't null terminated
+File io_file_map(const char *path);
+void io_file_unmap(File file);
+
 #endif
\ No newline at end of file
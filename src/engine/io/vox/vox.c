@@ -0,0 +1,863 @@
+/**
+ * @file vox.c
+ * @author https://github.com/shaderko
+ * @brief Imports MagicaVoxel .vox files into the chunks of a scene
+ * @version 0.1
+ * @date 2024-06-28
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <string.h>
+#include <SDL.h>
+
+#include "vox.h"
+#include "../io.h"
+#include "../../util/util.h"
+#include "../../object/map/chunk_map.h"
+#include "../../threading/threads_manager.h"
+
+#define VOX_HEADER_SIZE 8        // "VOX " and the version
+#define VOX_CHUNK_HEADER_SIZE 12 // Id, content size and children size
+#define VOX_MAX_DEPTH 64         // Deepest scene graph that is walked, stops files with cycles
+#define VOX_MAX_INSTANCES (1 << 20)
+#define VOX_MAX_VISITS (1 << 22) // Nodes visited while walking the scene graph, groups listed many times can't take forever
+#define VOX_SPLIT_VOXELS (1 << 20) // Voxels of a model given to one split job
+
+#define VOX_ID(a, b, c, d) ((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+
+typedef enum VoxNodeType VoxNodeType;
+enum VoxNodeType
+{
+    VOX_NODE_TRANSFORM,
+    VOX_NODE_GROUP,
+    VOX_NODE_SHAPE,
+};
+
+// Node of the scene graph, lists of children point into the mapped file
+typedef struct VoxNode VoxNode;
+struct VoxNode
+{
+    int id;
+    VoxNodeType type;
+
+    int child; // Transform's node, shape's model
+    int rotation;
+    int translation[3];
+
+    const unsigned char *children; // Group's node ids
+    int children_count;
+};
+
+typedef struct VoxModel VoxModel;
+struct VoxModel
+{
+    int size[3];
+    const unsigned char *voxels; // x, y, z and color index of every voxel, in the mapped file
+    unsigned int count;
+};
+
+/**
+ * Model placed in the scene, scene coordinate i of a voxel is sign[i] * voxel[axis[i]] + add[i].
+ * Its voxels land in the box of chunk_size chunks from chunk_min, chunk_indices has the import's index of each
+ */
+typedef struct VoxInstance VoxInstance;
+struct VoxInstance
+{
+    VoxModel *model;
+    int axis[3];
+    int sign[3];
+    int add[3];
+
+    int chunk_min[3];
+    int chunk_size[3];
+    size_t *chunk_indices;
+};
+
+typedef struct VoxImport VoxImport;
+struct VoxImport
+{
+    File file;
+
+    VoxModel *models;
+    size_t models_count;
+    size_t models_capacity;
+    int pending_size[3]; // SIZE comes before the XYZI of its model
+    bool has_size;
+
+    VoxNode *nodes;
+    size_t nodes_count;
+    size_t nodes_capacity;
+
+    uint32_t palette[VOX_PALETTE_SIZE];
+
+    VoxInstance *instances;
+    size_t instances_count;
+    size_t instances_capacity;
+    size_t visits;
+
+    // Chunks the models touch
+    ChunkMap *chunk_map;
+    ChunkKey *chunk_keys;
+    size_t chunks_count;
+    size_t chunks_capacity;
+};
+
+typedef struct VoxReader VoxReader;
+struct VoxReader
+{
+    const unsigned char *data;
+    size_t size;
+    size_t position;
+    bool failed;
+};
+
+// The file is little endian, read byte by byte so the host order doesn't matter
+static uint32_t read_uint32(const unsigned char *data)
+{
+    return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static int read_int(VoxReader *reader)
+{
+    if (reader->failed || reader->size - reader->position < 4)
+    {
+        reader->failed = true;
+        return 0;
+    }
+
+    int value = (int)read_uint32(reader->data + reader->position);
+    reader->position += 4;
+    return value;
+}
+
+static const unsigned char *read_string(VoxReader *reader, int *length)
+{
+    *length = read_int(reader);
+    if (reader->failed || *length < 0 || reader->size - reader->position < (size_t)*length)
+    {
+        reader->failed = true;
+        *length = 0;
+        return NULL;
+    }
+
+    const unsigned char *string = reader->data + reader->position;
+    reader->position += *length;
+    return string;
+}
+
+static bool string_equals(const unsigned char *string, int length, const char *other)
+{
+    return (size_t)length == strlen(other) && memcmp(string, other, length) == 0;
+}
+
+// Reads a dictionary, the _t translation and _r rotation of transform frames are kept if they aren't NULL
+static void read_dict(VoxReader *reader, int translation[3], int *rotation)
+{
+    int count = read_int(reader);
+    if (count < 0)
+        reader->failed = true;
+
+    for (int i = 0; i < count && !reader->failed; i++)
+    {
+        int key_length;
+        int value_length;
+        const unsigned char *key = read_string(reader, &key_length);
+        const unsigned char *value = read_string(reader, &value_length);
+        if (reader->failed)
+            return;
+
+        // Values are text, copied so they can be parsed
+        char text[64];
+        int text_length = value_length < (int)sizeof(text) - 1 ? value_length : (int)sizeof(text) - 1;
+        memcpy(text, value, text_length);
+        text[text_length] = '\0';
+
+        if (translation && string_equals(key, key_length, "_t"))
+        {
+            if (sscanf(text, "%d %d %d", &translation[0], &translation[1], &translation[2]) != 3)
+                translation[0] = translation[1] = translation[2] = 0;
+        }
+        else if (rotation && string_equals(key, key_length, "_r"))
+        {
+            *rotation = atoi(text);
+        }
+    }
+}
+
+static void *grow(void *array, size_t *capacity, size_t count, size_t element_size)
+{
+    if (count < *capacity)
+        return array;
+
+    *capacity = *capacity ? *capacity * 2 : 16;
+    array = realloc(array, *capacity * element_size);
+    if (!array)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for vox import.\n");
+
+    return array;
+}
+
+static bool parse_node(VoxImport *import, uint32_t id, VoxReader *reader)
+{
+    VoxNode node = {.id = read_int(reader), .rotation = 0};
+    read_dict(reader, NULL, NULL);
+
+    if (id == VOX_ID('n', 'T', 'R', 'N'))
+    {
+        node.type = VOX_NODE_TRANSFORM;
+        node.child = read_int(reader);
+        read_int(reader); // Reserved
+        read_int(reader); // Layer
+        int frames = read_int(reader);
+
+        // Only the first frame, animations aren't imported
+        if (frames > 0)
+            read_dict(reader, node.translation, &node.rotation);
+    }
+    else if (id == VOX_ID('n', 'G', 'R', 'P'))
+    {
+        node.type = VOX_NODE_GROUP;
+        node.children_count = read_int(reader);
+        if (node.children_count < 0 || (reader->size - reader->position) / 4 < (size_t)node.children_count)
+            return false;
+
+        node.children = reader->data + reader->position;
+    }
+    else
+    {
+        node.type = VOX_NODE_SHAPE;
+        int models = read_int(reader);
+        node.child = models > 0 ? read_int(reader) : -1;
+    }
+
+    if (reader->failed)
+        return false;
+
+    import->nodes = grow(import->nodes, &import->nodes_capacity, import->nodes_count, sizeof(VoxNode));
+    import->nodes[import->nodes_count++] = node;
+    return true;
+}
+
+// Reads one chunk of MAIN's children, returns false if the file is broken
+static bool parse_chunk(VoxImport *import, uint32_t id, const unsigned char *content, size_t size)
+{
+    VoxReader reader = {.data = content, .size = size};
+
+    switch (id)
+    {
+    case VOX_ID('S', 'I', 'Z', 'E'):
+        for (int axis = 0; axis < 3; axis++)
+        {
+            import->pending_size[axis] = read_int(&reader);
+            if (import->pending_size[axis] <= 0 || import->pending_size[axis] > 256)
+                return false;
+        }
+
+        import->has_size = !reader.failed;
+        return !reader.failed;
+
+    case VOX_ID('X', 'Y', 'Z', 'I'):
+    {
+        int count = read_int(&reader);
+        if (!import->has_size || reader.failed || count < 0 || (size - 4) / 4 < (size_t)count)
+            return false;
+
+        import->models = grow(import->models, &import->models_capacity, import->models_count, sizeof(VoxModel));
+        VoxModel *model = &import->models[import->models_count++];
+        memcpy(model->size, import->pending_size, sizeof(model->size));
+        model->voxels = content + 4;
+        model->count = (unsigned int)count;
+        import->has_size = false;
+        return true;
+    }
+
+    case VOX_ID('R', 'G', 'B', 'A'):
+        // Color i of the chunk is palette index i + 1, the last one isn't used
+        if (size < 4 * VOX_PALETTE_SIZE)
+            return false;
+
+        for (int i = 0; i < VOX_PALETTE_SIZE - 1; i++)
+        {
+            import->palette[i + 1] = read_uint32(content + 4 * i);
+        }
+        return true;
+
+    case VOX_ID('n', 'T', 'R', 'N'):
+    case VOX_ID('n', 'G', 'R', 'P'):
+    case VOX_ID('n', 'S', 'H', 'P'):
+        return parse_node(import, id, &reader);
+
+    default:
+        // PACK, materials, layers, cameras and everything newer isn't needed
+        return true;
+    }
+}
+
+static bool parse(VoxImport *import)
+{
+    const unsigned char *data = (const unsigned char *)import->file.data;
+    size_t size = import->file.len;
+
+    if (size < VOX_HEADER_SIZE + VOX_CHUNK_HEADER_SIZE || read_uint32(data) != VOX_ID('V', 'O', 'X', ' ') ||
+        read_uint32(data + VOX_HEADER_SIZE) != VOX_ID('M', 'A', 'I', 'N'))
+        return false;
+
+    // MAIN has no content of its own, every other chunk is one of its children
+    size_t main_content = read_uint32(data + VOX_HEADER_SIZE + 4);
+    size_t main_children = read_uint32(data + VOX_HEADER_SIZE + 8);
+    size_t position = VOX_HEADER_SIZE + VOX_CHUNK_HEADER_SIZE;
+    if (size - position < main_content || size - position - main_content < main_children)
+        return false;
+
+    position += main_content;
+    size_t end = position + main_children;
+
+    while (end - position >= VOX_CHUNK_HEADER_SIZE)
+    {
+        uint32_t id = read_uint32(data + position);
+        size_t content = read_uint32(data + position + 4);
+        size_t children = read_uint32(data + position + 8);
+        position += VOX_CHUNK_HEADER_SIZE;
+        if (end - position < content || end - position - content < children)
+            return false;
+
+        if (!parse_chunk(import, id, data + position, content))
+            return false;
+
+        position += content + children;
+    }
+
+    return true;
+}
+
+static int compare_nodes(const void *a, const void *b)
+{
+    int first = ((const VoxNode *)a)->id;
+    int second = ((const VoxNode *)b)->id;
+    return (first > second) - (first < second);
+}
+
+static VoxNode *find_node(VoxImport *import, int id)
+{
+    // Files without a scene graph have no node array at all
+    if (!import->nodes_count)
+        return NULL;
+
+    VoxNode key = {.id = id};
+    return bsearch(&key, import->nodes, import->nodes_count, sizeof(VoxNode), compare_nodes);
+}
+
+/**
+ * Rotation byte of a transform, bits 0 and 1 are the column of row 0's non zero entry, bits 2 and 3 the column of
+ * row 1's, row 2 takes the column left. Bits 4 to 6 make the entries of rows 0 to 2 negative
+ */
+static void rotation_matrix(int rotation, int matrix[3][3])
+{
+    int columns[3] = {rotation & 3, (rotation >> 2) & 3, 0};
+    columns[2] = 3 - columns[0] - columns[1];
+
+    memset(matrix, 0, 9 * sizeof(int));
+    for (int row = 0; row < 3; row++)
+    {
+        // Broken bytes that repeat a column fall back to no rotation
+        if (columns[0] > 2 || columns[1] > 2 || columns[0] == columns[1])
+        {
+            matrix[row][row] = 1;
+            continue;
+        }
+
+        matrix[row][columns[row]] = rotation >> (4 + row) & 1 ? -1 : 1;
+    }
+}
+
+/**
+ * Places model with the rotation and translation of the scene graph. MagicaVoxel turns a model around its center, a
+ * voxel's doubled center 2 * v + 1 - size is rotated, halved and rounded down and then moved by the translation.
+ * Without a scene graph centered is false and the model's corner is at the origin
+ */
+static void add_instance(VoxImport *import, VoxModel *model, int matrix[3][3], const int translation[3], bool centered, const int offset[3])
+{
+    if (import->instances_count >= VOX_MAX_INSTANCES)
+    {
+        fprintf(stderr, "[WARNING] Vox file places more than %d models, skipping the rest.\n", VOX_MAX_INSTANCES);
+        return;
+    }
+
+    // MagicaVoxel coordinate of every axis of the scene, its z up is the scene's y and its y is the scene's -z
+    int file_axis[3] = {0, 2, 1};
+    int file_sign[3] = {1, 1, -1};
+    int file_add[3] = {0, 0, -1};
+
+    VoxInstance instance = {.model = model};
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int row = file_axis[axis];
+        for (int column = 0; column < 3; column++)
+        {
+            int sign = matrix[row][column];
+            if (!sign)
+                continue;
+
+            int center = !centered ? 0 : (sign > 0 ? -(model->size[column] / 2) : (model->size[column] - 1) / 2);
+            instance.axis[axis] = column;
+            instance.sign[axis] = sign * file_sign[axis];
+            instance.add[axis] = file_sign[axis] * (center + translation[row]) + file_add[axis] + offset[axis];
+        }
+    }
+
+    // Transforms are monotonic on every axis, so the corners of the model are the corners of the box
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int first = instance.add[axis];
+        int last = instance.sign[axis] * (model->size[instance.axis[axis]] - 1) + instance.add[axis];
+        int low = first < last ? first : last;
+        int high = first < last ? last : first;
+
+        instance.chunk_min[axis] = low >> CHUNK_DEPTH;
+        instance.chunk_size[axis] = (high >> CHUNK_DEPTH) - instance.chunk_min[axis] + 1;
+        if (instance.chunk_min[axis] < CHUNK_COORDINATE_MIN || (high >> CHUNK_DEPTH) > CHUNK_COORDINATE_MAX)
+        {
+            fprintf(stderr, "[WARNING] Vox model is outside of the chunk coordinates, skipping.\n");
+            return;
+        }
+    }
+
+    // Index of every chunk the model can touch, chunks shared with other models get the same index
+    size_t box_count = (size_t)instance.chunk_size[0] * instance.chunk_size[1] * instance.chunk_size[2];
+    instance.chunk_indices = malloc(box_count * sizeof(size_t));
+    if (!instance.chunk_indices)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for vox model chunks.\n");
+
+    size_t index = 0;
+    for (int z = 0; z < instance.chunk_size[2]; z++)
+    {
+        for (int y = 0; y < instance.chunk_size[1]; y++)
+        {
+            for (int x = 0; x < instance.chunk_size[0]; x++)
+            {
+                ChunkKey key = CHUNK_KEY(instance.chunk_min[0] + x, instance.chunk_min[1] + y, instance.chunk_min[2] + z);
+                size_t chunk = AChunkMap.Get(import->chunk_map, key);
+                if (chunk == CHUNK_MAP_NONE)
+                {
+                    import->chunk_keys = grow(import->chunk_keys, &import->chunks_capacity, import->chunks_count, sizeof(ChunkKey));
+                    chunk = import->chunks_count++;
+                    import->chunk_keys[chunk] = key;
+                    AChunkMap.Set(import->chunk_map, key, chunk);
+                }
+
+                instance.chunk_indices[index++] = chunk;
+            }
+        }
+    }
+
+    import->instances = grow(import->instances, &import->instances_capacity, import->instances_count, sizeof(VoxInstance));
+    import->instances[import->instances_count++] = instance;
+}
+
+static void place_node(VoxImport *import, int id, int matrix[3][3], const int translation[3], const int offset[3], int depth)
+{
+    VoxNode *node = find_node(import, id);
+    if (!node || depth >= VOX_MAX_DEPTH || ++import->visits > VOX_MAX_VISITS)
+        return;
+
+    switch (node->type)
+    {
+    case VOX_NODE_TRANSFORM:
+    {
+        // The node's transform is in its parent's space
+        int rotation[3][3];
+        rotation_matrix(node->rotation, rotation);
+
+        int child_matrix[3][3];
+        int child_translation[3];
+        for (int row = 0; row < 3; row++)
+        {
+            child_translation[row] = translation[row];
+            for (int column = 0; column < 3; column++)
+            {
+                child_matrix[row][column] = 0;
+                for (int i = 0; i < 3; i++)
+                {
+                    child_matrix[row][column] += matrix[row][i] * rotation[i][column];
+                }
+
+                child_translation[row] += matrix[row][column] * node->translation[column];
+            }
+        }
+
+        place_node(import, node->child, child_matrix, child_translation, offset, depth + 1);
+        break;
+    }
+
+    case VOX_NODE_GROUP:
+        for (int i = 0; i < node->children_count; i++)
+        {
+            place_node(import, (int)read_uint32(node->children + 4 * i), matrix, translation, offset, depth + 1);
+        }
+        break;
+
+    case VOX_NODE_SHAPE:
+        if (node->child >= 0 && (size_t)node->child < import->models_count)
+            add_instance(import, &import->models[node->child], matrix, translation, true, offset);
+        break;
+    }
+}
+
+// Places every model, through the scene graph if the file has one
+static void place_models(VoxImport *import, const int offset[3])
+{
+    int identity[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    int origin[3] = {0, 0, 0};
+
+    if (import->nodes_count)
+        qsort(import->nodes, import->nodes_count, sizeof(VoxNode), compare_nodes);
+
+    if (find_node(import, 0))
+    {
+        place_node(import, 0, identity, origin, offset, 0);
+        return;
+    }
+
+    // Files older than the scene graph have one model, or models that all start at the origin
+    for (size_t i = 0; i < import->models_count; i++)
+    {
+        add_instance(import, &import->models[i], identity, origin, false, offset);
+    }
+}
+
+/**
+ * MagicaVoxel's palette for files without an RGBA chunk, a 6 x 6 x 6 color cube without black and then ramps of 10
+ * reds, greens, blues and grays. Red is the lowest byte
+ */
+static void default_palette(uint32_t palette[VOX_PALETTE_SIZE])
+{
+    static const unsigned char cube[6] = {0xFF, 0xCC, 0x99, 0x66, 0x33, 0x00};
+    static const unsigned char ramp[10] = {0xEE, 0xDD, 0xBB, 0xAA, 0x88, 0x77, 0x55, 0x44, 0x22, 0x11};
+
+    int index = 0;
+    palette[index++] = 0;
+    for (int r = 0; r < 6; r++)
+    {
+        for (int g = 0; g < 6; g++)
+        {
+            for (int b = 0; b < 6 && index < 216; b++)
+            {
+                palette[index++] = 0xFF000000U | (uint32_t)cube[b] << 16 | (uint32_t)cube[g] << 8 | cube[r];
+            }
+        }
+    }
+
+    for (int channel = 0; channel < 3; channel++)
+    {
+        for (int i = 0; i < 10; i++)
+        {
+            palette[index++] = 0xFF000000U | (uint32_t)ramp[i] << (8 * channel);
+        }
+    }
+
+    for (int i = 0; i < 10; i++)
+    {
+        palette[index++] = 0xFF000000U | (uint32_t)ramp[i] * 0x010101U;
+    }
+}
+
+/**
+ * Voxels first to before last of a placed model. Counting adds the voxels of every chunk of the model's box to cursors,
+ * scattering writes them to voxels at cursors, which hold the first free place of every chunk by then
+ */
+typedef struct VoxSplitJob VoxSplitJob;
+struct VoxSplitJob
+{
+    VoxInstance *instance;
+    unsigned int first;
+    unsigned int last;
+
+    size_t *cursors;
+    OctreeVoxel *voxels;
+};
+
+// Scene voxel of a model's voxel and the index of its chunk in the model's box, false if the voxel is broken
+static bool split_voxel(VoxInstance *instance, const unsigned char *voxel, int position[3], size_t *box_index)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (voxel[axis] >= instance->model->size[axis])
+            return false;
+    }
+
+    if (!voxel[3])
+        return false;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        position[axis] = instance->sign[axis] * voxel[instance->axis[axis]] + instance->add[axis];
+    }
+
+    *box_index = ((size_t)((position[2] >> CHUNK_DEPTH) - instance->chunk_min[2]) * instance->chunk_size[1] +
+                  (size_t)((position[1] >> CHUNK_DEPTH) - instance->chunk_min[1])) *
+                     instance->chunk_size[0] +
+                 (size_t)((position[0] >> CHUNK_DEPTH) - instance->chunk_min[0]);
+    return true;
+}
+
+static void *count_job(void *data)
+{
+    VoxSplitJob *job = data;
+    const unsigned char *voxels = job->instance->model->voxels;
+
+    for (unsigned int i = job->first; i < job->last; i++)
+    {
+        int position[3];
+        size_t box_index;
+        if (split_voxel(job->instance, voxels + 4 * (size_t)i, position, &box_index))
+            job->cursors[box_index]++;
+    }
+
+    return NULL;
+}
+
+static void *scatter_job(void *data)
+{
+    VoxSplitJob *job = data;
+    const unsigned char *voxels = job->instance->model->voxels;
+
+    for (unsigned int i = job->first; i < job->last; i++)
+    {
+        const unsigned char *voxel = voxels + 4 * (size_t)i;
+        int position[3];
+        size_t box_index;
+        if (!split_voxel(job->instance, voxel, position, &box_index))
+            continue;
+
+        job->voxels[job->cursors[box_index]++] = (OctreeVoxel){position[0] & (CHUNK_SIZE - 1), position[1] & (CHUNK_SIZE - 1),
+                                                               position[2] & (CHUNK_SIZE - 1), voxel[3]};
+    }
+
+    return NULL;
+}
+
+typedef struct VoxBuildJob VoxBuildJob;
+struct VoxBuildJob
+{
+    ChunkKey key;
+    Chunk *chunk; // Chunk of the scene, NULL until the job creates one
+    bool created;
+
+    const OctreeVoxel *voxels;
+    size_t count;
+};
+
+static void *build_job(void *data)
+{
+    VoxBuildJob *job = data;
+
+    if (!job->chunk)
+    {
+        job->chunk = AChunk.Init((vec3){(float)CHUNK_KEY_X(job->key), (float)CHUNK_KEY_Y(job->key), (float)CHUNK_KEY_Z(job->key)});
+        job->created = true;
+    }
+
+    AChunk.AddBatch(job->chunk, job->voxels, (unsigned int)job->count);
+    return NULL;
+}
+
+static void free_import(VoxImport *import)
+{
+    for (size_t i = 0; i < import->instances_count; i++)
+    {
+        free(import->instances[i].chunk_indices);
+    }
+
+    free(import->instances);
+    free(import->models);
+    free(import->nodes);
+    free(import->chunk_keys);
+    if (import->chunk_map)
+        AChunkMap.Delete(import->chunk_map);
+    io_file_unmap(import->file);
+}
+
+static bool Import(const char *path, Scene *scene, const int offset[3], uint32_t palette[VOX_PALETTE_SIZE], VoxImportStats *stats)
+{
+    if (!path || !scene)
+        return false;
+
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    VoxImport import = {0};
+    import.file = io_file_map(path);
+    if (!import.file.is_valid)
+        return false;
+
+    default_palette(import.palette);
+    if (!parse(&import))
+    {
+        fprintf(stderr, "[WARNING] %s isn't a vox file or is broken, nothing was imported.\n", path);
+        free_import(&import);
+        return false;
+    }
+
+    import.chunk_map = AChunkMap.Init();
+    place_models(&import, offset ? offset : (int[3]){0, 0, 0});
+
+    Uint64 parsed = SDL_GetPerformanceCounter();
+
+    // Large models are split between several jobs, each with its own counts for the chunks of its model
+    size_t jobs_count = 0;
+    for (size_t i = 0; i < import.instances_count; i++)
+    {
+        jobs_count += (import.instances[i].model->count + VOX_SPLIT_VOXELS - 1) / VOX_SPLIT_VOXELS;
+    }
+
+    VoxSplitJob *jobs = malloc((jobs_count ? jobs_count : 1) * sizeof(VoxSplitJob));
+    size_t *chunk_counts = calloc(import.chunks_count ? import.chunks_count : 1, sizeof(size_t));
+    if (!jobs || !chunk_counts)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for vox split jobs.\n");
+
+    ThreadsManager *manager = AThreadsManager.Default();
+    size_t job_index = 0;
+    for (size_t i = 0; i < import.instances_count; i++)
+    {
+        VoxInstance *instance = &import.instances[i];
+        size_t box_count = (size_t)instance->chunk_size[0] * instance->chunk_size[1] * instance->chunk_size[2];
+
+        for (unsigned int first = 0; first < instance->model->count; first += VOX_SPLIT_VOXELS)
+        {
+            VoxSplitJob *job = &jobs[job_index++];
+            job->instance = instance;
+            job->first = first;
+            job->last = instance->model->count - first > VOX_SPLIT_VOXELS ? first + VOX_SPLIT_VOXELS : instance->model->count;
+            job->cursors = calloc(box_count, sizeof(size_t));
+            if (!job->cursors)
+                ERROR_EXIT("[ERROR] Failed to allocate memory for vox split counts.\n");
+
+            AThreadsManager.Add(manager, count_job, job);
+        }
+    }
+    AThreadsManager.Wait(manager);
+
+    // Every chunk's voxels are together, in the order of the jobs so later models overwrite earlier ones
+    for (size_t i = 0; i < jobs_count; i++)
+    {
+        VoxInstance *instance = jobs[i].instance;
+        size_t box_count = (size_t)instance->chunk_size[0] * instance->chunk_size[1] * instance->chunk_size[2];
+        for (size_t box_index = 0; box_index < box_count; box_index++)
+        {
+            chunk_counts[instance->chunk_indices[box_index]] += jobs[i].cursors[box_index];
+        }
+    }
+
+    size_t *chunk_starts = malloc((import.chunks_count + 1) * sizeof(size_t));
+    if (!chunk_starts)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for vox chunk lists.\n");
+
+    chunk_starts[0] = 0;
+    for (size_t i = 0; i < import.chunks_count; i++)
+    {
+        chunk_starts[i + 1] = chunk_starts[i] + chunk_counts[i];
+    }
+
+    size_t voxels_count = chunk_starts[import.chunks_count];
+    OctreeVoxel *voxels = malloc((voxels_count ? voxels_count : 1) * sizeof(OctreeVoxel));
+    if (!voxels)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for %zu vox voxels.\n", voxels_count);
+
+    // Counts become the first place of each job in every chunk
+    memcpy(chunk_counts, chunk_starts, import.chunks_count * sizeof(size_t));
+    for (size_t i = 0; i < jobs_count; i++)
+    {
+        VoxInstance *instance = jobs[i].instance;
+        size_t box_count = (size_t)instance->chunk_size[0] * instance->chunk_size[1] * instance->chunk_size[2];
+        for (size_t box_index = 0; box_index < box_count; box_index++)
+        {
+            size_t chunk = instance->chunk_indices[box_index];
+            size_t count = jobs[i].cursors[box_index];
+            jobs[i].cursors[box_index] = chunk_counts[chunk];
+            chunk_counts[chunk] += count;
+        }
+
+        jobs[i].voxels = voxels;
+        AThreadsManager.Add(manager, scatter_job, &jobs[i]);
+    }
+    AThreadsManager.Wait(manager);
+
+    for (size_t i = 0; i < jobs_count; i++)
+    {
+        free(jobs[i].cursors);
+    }
+    free(jobs);
+    free(chunk_counts);
+
+    Uint64 split = SDL_GetPerformanceCounter();
+
+    // One job per chunk with voxels, only this thread touches the scene
+    VoxBuildJob *builds = malloc((import.chunks_count ? import.chunks_count : 1) * sizeof(VoxBuildJob));
+    if (!builds)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for vox build jobs.\n");
+
+    size_t builds_count = 0;
+    for (size_t i = 0; i < import.chunks_count; i++)
+    {
+        if (chunk_starts[i + 1] == chunk_starts[i])
+            continue;
+
+        ChunkKey key = import.chunk_keys[i];
+        VoxBuildJob *build = &builds[builds_count++];
+        build->key = key;
+        build->chunk = AScene.GetChunk(scene, CHUNK_KEY_X(key), CHUNK_KEY_Y(key), CHUNK_KEY_Z(key));
+        build->created = false;
+        build->voxels = voxels + chunk_starts[i];
+        build->count = chunk_starts[i + 1] - chunk_starts[i];
+
+        AThreadsManager.Add(manager, build_job, build);
+    }
+    AThreadsManager.Wait(manager);
+
+    for (size_t i = 0; i < builds_count; i++)
+    {
+        if (builds[i].created)
+            AScene.AddChunk(scene, builds[i].chunk);
+    }
+
+    Uint64 end = SDL_GetPerformanceCounter();
+
+    if (palette)
+        memcpy(palette, import.palette, sizeof(import.palette));
+
+    if (stats)
+    {
+        double frequency = (double)SDL_GetPerformanceFrequency();
+        stats->bytes = import.file.len;
+        stats->models = (unsigned int)import.models_count;
+        stats->instances = (unsigned int)import.instances_count;
+        stats->chunks = (unsigned int)builds_count;
+        stats->voxels = voxels_count;
+        stats->threads = manager->workers_count;
+        stats->parse_seconds = (double)(parsed - start) / frequency;
+        stats->split_seconds = (double)(split - parsed) / frequency;
+        stats->build_seconds = (double)(end - split) / frequency;
+        stats->seconds = (double)(end - start) / frequency;
+        stats->megabytes_per_second = stats->seconds > 0.0 ? stats->bytes / (1024.0 * 1024.0) / stats->seconds : 0.0;
+        stats->voxels_per_second = stats->seconds > 0.0 ? stats->voxels / stats->seconds : 0.0;
+
+        printf("[INFO] Vox import of %s took %f ms (parse %f, split %f, build %f) on %d threads, %.1f MB/s and %.0f voxels/s, "
+               "%u models placed %u times, %llu voxels in %u chunks\n",
+               path, stats->seconds * 1000.0, stats->parse_seconds * 1000.0, stats->split_seconds * 1000.0, stats->build_seconds * 1000.0,
+               stats->threads, stats->megabytes_per_second, stats->voxels_per_second, stats->models, stats->instances, stats->voxels, stats->chunks);
+    }
+
+    free(builds);
+    free(chunk_starts);
+    free(voxels);
+    free_import(&import);
+
+    return true;
+}
+
+extern struct AVox AVox;
+struct AVox AVox =
+    {
+        .Import = Import,
+};
@@ -0,0 +1,55 @@
+/**
+ * @file vox.h
+ * @author https://github.com/shaderko
+ * @brief Imports MagicaVoxel .vox files into the chunks of a scene
+ * @version 0.1
+ * @date 2024-06-28
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef VOX_H
+#define VOX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../../object/map/scene.h"
+
+#define VOX_PALETTE_SIZE 256
+
+typedef struct VoxImportStats VoxImportStats;
+struct VoxImportStats
+{
+    size_t bytes;              // Size of the file
+    unsigned int models;       // Models stored in the file
+    unsigned int instances;    // Models placed by the scene graph, a model can be placed more than once
+    unsigned int chunks;       // Chunks that got voxels
+    unsigned long long voxels; // Voxels of every placed model
+
+    int threads;
+    double parse_seconds; // Mapping the file and walking its chunks and scene graph
+    double split_seconds; // Moving every voxel into the list of its chunk
+    double build_seconds; // Building the octrees of the chunks
+    double seconds;
+    double megabytes_per_second;
+    double voxels_per_second;
+};
+
+struct AVox
+{
+    /**
+     * Adds the voxels of every model of the file to the scene, voxel 0, 0, 0 of the file's world is at the world voxel
+     * offset. MagicaVoxel's z up is the scene's y up. Voxels are split into chunks and every chunk's octree is built
+     * on the default threads manager, existing chunks keep their voxels outside of the models.
+     * A voxel's color is its palette index, palette gets the RGBA color of every index if it isn't NULL, index 0 is
+     * empty. Stats can be NULL, otherwise they are filled and printed.
+     * Returns false if the file can't be read or isn't a .vox file
+     */
+    bool (*Import)(const char *path, Scene *scene, const int offset[3], uint32_t palette[VOX_PALETTE_SIZE], VoxImportStats *stats);
+};
+
+extern struct AVox AVox;
+
+#endif
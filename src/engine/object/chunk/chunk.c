@@ -9,58 +9,399 @@
  *
  */
 
+#include <string.h>
+#include <math.h>
+
 #include "chunk.h"
 #include "../../util/util.h"
 #include "../model/model.h"
 #include "../../render/render.h"
 #include "octree/octree.h"
 
-#define X_MASK (0xA << 20)
-#define Y_MASK (0xA << 10)
-#define Z_MASK (0xA)
-
 static Chunk *Init(vec3 position)
 {
     Chunk *chunk = malloc(sizeof(Chunk));
     if (!chunk)
         ERROR_EXIT("[Error] Failed to allocate chunk.\n");
 
-    // Transfer vec3 position to single unsigned int with bit manipulation
-    chunk->position = (unsigned int)position[0] << 20 | (unsigned int)position[1] << 10 | (unsigned int)position[2];
+    // Pack the coordinates into the chunk key
+    int coordinates[3];
+    for (int i = 0; i < 3; i++)
+    {
+        float coordinate = floorf(position[i]);
+        coordinates[i] = coordinate < CHUNK_COORDINATE_MIN ? CHUNK_COORDINATE_MIN : (coordinate > CHUNK_COORDINATE_MAX ? CHUNK_COORDINATE_MAX : (int)coordinate);
+    }
+    chunk->position = CHUNK_KEY(coordinates[0], coordinates[1], coordinates[2]);
 
     // Initialize an octree for this chunk
     chunk->voxel_tree = AOctree.Init();
+    // Bricks store the last two levels in far fewer elements, and rays read one brick instead of two nodes
+    chunk->packed_tree = (PackedOctree){.format = OCTREE_FORMAT_BRICKS};
+    chunk->occupancy = NULL;
+    chunk->generation = 0;
+    chunk->distance_field_size = 0;
 
     return chunk;
 }
 
+static void Delete(Chunk *chunk)
+{
+    if (!chunk)
+        return;
+
+    // Frees the whole node pool of the octree at once
+    AOctree.Delete(chunk->voxel_tree);
+    free(chunk->packed_tree.nodes);
+    free(chunk->occupancy);
+    free(chunk);
+}
+
 static void Add(Chunk *chunk, unsigned int x, unsigned int y, unsigned int z, unsigned char color, unsigned int uvs)
 {
+    if (x >= CHUNK_SIZE || y >= CHUNK_SIZE || z >= CHUNK_SIZE)
+    {
+        fprintf(stderr, "[WARNING] Voxel %u, %u, %u is outside of the chunk, skipping.\n", x, y, z);
+        return;
+    }
+
     // Add data to octree
     AOctree.Add(chunk->voxel_tree, x, y, z, color, uvs);
+    chunk->packed_tree.is_valid = false;
+    chunk->generation++;
+
+    if (chunk->occupancy)
+        chunk->occupancy[z * CHUNK_SIZE + y] |= (uint64_t)1 << x;
 }
 
-static void Serialize(void *data)
+static void AddBatch(Chunk *chunk, const OctreeVoxel *voxels, unsigned int count)
+{
+    AOctree.AddBatch(chunk->voxel_tree, voxels, count);
+    chunk->packed_tree.is_valid = false;
+    chunk->generation++;
+
+    if (!chunk->occupancy)
+        return;
+
+    // The octree skips voxels outside of it, so do the same here
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (voxels[i].x < CHUNK_SIZE && voxels[i].y < CHUNK_SIZE && voxels[i].z < CHUNK_SIZE)
+            chunk->occupancy[voxels[i].z * CHUNK_SIZE + voxels[i].y] |= (uint64_t)1 << voxels[i].x;
+    }
+}
+
+static bool Remove(Chunk *chunk, unsigned int x, unsigned int y, unsigned int z)
+{
+    if (!AOctree.Remove(chunk->voxel_tree, x, y, z))
+        return false;
+
+    chunk->packed_tree.is_valid = false;
+    chunk->generation++;
+
+    if (chunk->occupancy)
+        chunk->occupancy[z * CHUNK_SIZE + y] &= ~((uint64_t)1 << x);
+
+    return true;
+}
+
+// Voxels of the row at y, z inside the region go from first to last, returns false if there are none
+static bool region_row(const OctreeRegion *region, int y, int z, int *first, int *last)
+{
+    if (region->shape == OCTREE_REGION_BOX)
+    {
+        if (y < region->min[1] || y > region->max[1] || z < region->min[2] || z > region->max[2])
+            return false;
+
+        *first = region->min[0] > 0 ? region->min[0] : 0;
+        *last = region->max[0] < CHUNK_SIZE - 1 ? region->max[0] : CHUNK_SIZE - 1;
+        return *first <= *last;
+    }
+
+    // Estimate the span from the circle of the row, then move its ends with the same test the octree uses
+    float dy = y + 0.5f - region->center[1];
+    float dz = z + 0.5f - region->center[2];
+    float remaining = region->radius * region->radius - dy * dy - dz * dz;
+    float half = remaining > 0.0f ? sqrtf(remaining) : 0.0f;
+
+    *first = (int)floorf(region->center[0] - 0.5f - half) - 1;
+    *last = (int)ceilf(region->center[0] - 0.5f + half) + 1;
+    *first = *first > 0 ? *first : 0;
+    *last = *last < CHUNK_SIZE - 1 ? *last : CHUNK_SIZE - 1;
+
+    while (*first <= *last && AOctree.RegionOverlap(region, *first, y, z, 1) != OCTREE_REGION_INSIDE)
+        (*first)++;
+    while (*last >= *first && AOctree.RegionOverlap(region, *last, y, z, 1) != OCTREE_REGION_INSIDE)
+        (*last)--;
+
+    return *first <= *last;
+}
+
+// Sets or clears the occupancy bits of the region one row at a time
+static void occupancy_edit_region(uint64_t *occupancy, const OctreeRegion *region, bool fill)
 {
-    struct ThreadData
+    int low[2];
+    int high[2];
+    for (int axis = 1; axis < 3; axis++)
+    {
+        int min = region->min[axis];
+        int max = region->max[axis];
+        if (region->shape == OCTREE_REGION_SPHERE)
+        {
+            // Sphere rows are found by region_row, one row of margin keeps rounding from losing the outermost ones
+            min = (int)fmaxf(floorf(region->center[axis] - region->radius) - 1.0f, -1.0f);
+            max = (int)fminf(ceilf(region->center[axis] + region->radius) + 1.0f, CHUNK_SIZE);
+        }
+
+        low[axis - 1] = min > 0 ? min : 0;
+        high[axis - 1] = max < CHUNK_SIZE - 1 ? max : CHUNK_SIZE - 1;
+    }
+
+    for (int z = low[1]; z <= high[1]; z++)
     {
-        Chunk *chunk;
-        SerializedChunk *result;
-    } *thread_data = data;
+        for (int y = low[0]; y <= high[0]; y++)
+        {
+            int first, last;
+            if (!region_row(region, y, z, &first, &last))
+                continue;
+
+            uint64_t span = (last - first == 63 ? ~(uint64_t)0 : (((uint64_t)1 << (last - first + 1)) - 1)) << first;
+            if (fill)
+                occupancy[z * CHUNK_SIZE + y] |= span;
+            else
+                occupancy[z * CHUNK_SIZE + y] &= ~span;
+        }
+    }
+}
+
+static bool edit_region(Chunk *chunk, const OctreeRegion *region, unsigned char color, bool fill)
+{
+    if (!chunk)
+        return false;
+
+    bool changed = fill ? AOctree.FillRegion(chunk->voxel_tree, region, color) : AOctree.ClearRegion(chunk->voxel_tree, region);
+    if (!changed)
+        return false;
+
+    chunk->packed_tree.is_valid = false;
+    chunk->generation++;
+
+    if (chunk->occupancy)
+        occupancy_edit_region(chunk->occupancy, region, fill);
+
+    return true;
+}
+
+static OctreeRegion box_region(const int min[3], const int max[3])
+{
+    OctreeRegion region = {.shape = OCTREE_REGION_BOX};
+    memcpy(region.min, min, sizeof(region.min));
+    memcpy(region.max, max, sizeof(region.max));
+
+    return region;
+}
+
+static OctreeRegion sphere_region(vec3 center, float radius)
+{
+    return (OctreeRegion){.shape = OCTREE_REGION_SPHERE, .center = {center[0], center[1], center[2]}, .radius = radius};
+}
+
+static bool FillBox(Chunk *chunk, const int min[3], const int max[3], unsigned char color)
+{
+    OctreeRegion region = box_region(min, max);
+    return edit_region(chunk, &region, color, true);
+}
+
+static bool ClearBox(Chunk *chunk, const int min[3], const int max[3])
+{
+    OctreeRegion region = box_region(min, max);
+    return edit_region(chunk, &region, 0, false);
+}
+
+static bool FillSphere(Chunk *chunk, vec3 center, float radius, unsigned char color)
+{
+    OctreeRegion region = sphere_region(center, radius);
+    return edit_region(chunk, &region, color, true);
+}
+
+static bool ClearSphere(Chunk *chunk, vec3 center, float radius)
+{
+    OctreeRegion region = sphere_region(center, radius);
+    return edit_region(chunk, &region, 0, false);
+}
+
+static void Pack(Chunk *chunk, ThreadsManager *manager)
+{
+    if (!chunk || chunk->packed_tree.is_valid)
+        return;
+
+    // Only repack the octree if it changed, the packed array is already in the gpu layout
+    if (manager)
+        AOctree.PackParallel(chunk->voxel_tree, &chunk->packed_tree, manager);
+    else
+        AOctree.Pack(chunk->voxel_tree, &chunk->packed_tree);
+
+    chunk->distance_field_size = 0;
+}
+
+static void Serialize(void *data)
+{
+    ChunkSerializeData *thread_data = data;
 
     thread_data->result->data = NULL;
     thread_data->result->size = 0;
+    thread_data->result->attributes_size = 0;
+    thread_data->result->distance_field_size = 0;
+    thread_data->result->format = OCTREE_FORMAT_NONE;
 
     if (!thread_data->chunk || !thread_data->chunk->voxel_tree)
         ERROR_RETURN(NULL, "[INFO] Chunk has no data to serialize.");
 
-    // Linearize octree of the chunk
-    AOctree.LinearizeOctree(thread_data->chunk->voxel_tree->root, &thread_data->result->data, &thread_data->result->size);
+    Chunk *chunk = thread_data->chunk;
+    PackedOctree *packed = &chunk->packed_tree;
+    Pack(chunk, NULL);
+
+    if (thread_data->distance_field && !chunk->distance_field_size)
+    {
+        // The field goes right after the attributes, so the chunk is still one range of the array
+        unsigned int field_size = OCTREE_FIELD_SIZE(CHUNK_FIELD_DEPTH);
+        unsigned int size = packed->size + packed->attributes_size + field_size;
+        if (size > packed->capacity)
+        {
+            unsigned int *nodes = realloc(packed->nodes, size * sizeof(unsigned int));
+            if (!nodes)
+                ERROR_EXIT("[ERROR] Failed to allocate memory for chunk distance field.\n");
+
+            packed->nodes = nodes;
+            packed->capacity = size;
+        }
+
+        AOctree.BuildDistanceField(chunk->voxel_tree, CHUNK_FIELD_DEPTH, &packed->nodes[packed->size + packed->attributes_size]);
+        chunk->distance_field_size = field_size;
+    }
+
+    // The result points to the chunk's packed array, it's owned by the chunk
+    thread_data->result->data = chunk->packed_tree.nodes;
+    thread_data->result->size = chunk->packed_tree.size;
+    thread_data->result->attributes_size = chunk->packed_tree.attributes_size;
+    thread_data->result->distance_field_size = thread_data->distance_field ? chunk->distance_field_size : 0;
+    thread_data->result->format = chunk->packed_tree.format;
+}
+
+// Sets the bits of a whole leaf, leaves can be bigger than one voxel
+static void occupancy_add_leaf(void *user_data, unsigned int x, unsigned int y, unsigned int z, unsigned int side, unsigned int data)
+{
+    uint64_t *occupancy = user_data;
+    uint64_t row = (side >= 64 ? ~(uint64_t)0 : (((uint64_t)1 << side) - 1)) << x;
+
+    for (unsigned int current_z = z; current_z < z + side; current_z++)
+    {
+        for (unsigned int current_y = y; current_y < y + side; current_y++)
+        {
+            occupancy[current_z * CHUNK_SIZE + current_y] |= row;
+        }
+    }
+}
+
+static void EnableOccupancy(Chunk *chunk)
+{
+    if (!chunk || chunk->occupancy)
+        return;
+
+    chunk->occupancy = calloc(CHUNK_OCCUPANCY_WORDS, sizeof(uint64_t));
+    if (!chunk->occupancy)
+        ERROR_EXIT("[Error] Failed to allocate chunk occupancy.\n");
+
+    AOctree.ForEachLeaf(chunk->voxel_tree, occupancy_add_leaf, chunk->occupancy);
+}
+
+static void DisableOccupancy(Chunk *chunk)
+{
+    if (!chunk)
+        return;
+
+    free(chunk->occupancy);
+    chunk->occupancy = NULL;
+}
+
+static bool Get(Chunk *chunk, unsigned int x, unsigned int y, unsigned int z)
+{
+    if (x >= CHUNK_SIZE || y >= CHUNK_SIZE || z >= CHUNK_SIZE)
+        return false;
+
+    if (chunk->occupancy)
+        return (chunk->occupancy[z * CHUNK_SIZE + y] >> x) & 1;
+
+    return AOctree.Get(chunk->voxel_tree, x, y, z) != 0;
+}
+
+static uint64_t GetRow(Chunk *chunk, unsigned int y, unsigned int z)
+{
+    if (y >= CHUNK_SIZE || z >= CHUNK_SIZE)
+        return 0;
+
+    if (chunk->occupancy)
+        return chunk->occupancy[z * CHUNK_SIZE + y];
+
+    uint64_t row = 0;
+    for (unsigned int x = 0; x < CHUNK_SIZE; x++)
+    {
+        if (AOctree.Get(chunk->voxel_tree, x, y, z))
+            row |= (uint64_t)1 << x;
+    }
+
+    return row;
+}
+
+static void GetPlane(Chunk *chunk, unsigned int z, uint64_t rows[CHUNK_SIZE])
+{
+    if (z >= CHUNK_SIZE)
+    {
+        memset(rows, 0, CHUNK_SIZE * sizeof(uint64_t));
+        return;
+    }
+
+    if (chunk->occupancy)
+    {
+        memcpy(rows, &chunk->occupancy[z * CHUNK_SIZE], CHUNK_SIZE * sizeof(uint64_t));
+        return;
+    }
+
+    for (unsigned int y = 0; y < CHUNK_SIZE; y++)
+    {
+        rows[y] = GetRow(chunk, y, z);
+    }
+}
+
+static size_t GetMemorySize(Chunk *chunk)
+{
+    if (!chunk)
+        return 0;
+
+    size_t size = sizeof(Chunk) + AOctree.GetPoolStats(chunk->voxel_tree).bytes_reserved;
+    size += chunk->packed_tree.capacity * sizeof(unsigned int);
+    if (chunk->occupancy)
+        size += CHUNK_OCCUPANCY_WORDS * sizeof(uint64_t);
+
+    return size;
 }
 
 extern struct AChunk AChunk;
 struct AChunk AChunk =
     {
         .Init = Init,
+        .Delete = Delete,
         .Add = Add,
-        .Serialize = Serialize};
\ No newline at end of file
+        .AddBatch = AddBatch,
+        .Remove = Remove,
+        .FillBox = FillBox,
+        .ClearBox = ClearBox,
+        .FillSphere = FillSphere,
+        .ClearSphere = ClearSphere,
+        .Pack = Pack,
+        .Serialize = Serialize,
+        .EnableOccupancy = EnableOccupancy,
+        .DisableOccupancy = DisableOccupancy,
+        .Get = Get,
+        .GetRow = GetRow,
+        .GetPlane = GetPlane,
+        .GetMemorySize = GetMemorySize};
\ No newline at end of file
@@ -14,38 +14,154 @@
 
 #include <linmath.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "octree/octree.h"
 
+#define CHUNK_DEPTH 6
+#define CHUNK_SIZE (1 << CHUNK_DEPTH) // Voxels on each side of a chunk
+#define CHUNK_OCCUPANCY_WORDS (CHUNK_SIZE * CHUNK_SIZE) // One 64 bit word for every row along x
+#define CHUNK_FIELD_DEPTH 4                              // Distance field cells are 4 voxels on each side
+
+/**
+ * Chunk coordinates are packed into one signed 64 bit key, 21 bits for each axis with x at the top.
+ * That's about a million chunks in both directions on every axis
+ */
+typedef int64_t ChunkKey;
+
+#define CHUNK_KEY_BITS 21
+#define CHUNK_KEY_MASK ((1LL << CHUNK_KEY_BITS) - 1)
+#define CHUNK_COORDINATE_MIN (-(1 << (CHUNK_KEY_BITS - 1)))
+#define CHUNK_COORDINATE_MAX ((1 << (CHUNK_KEY_BITS - 1)) - 1)
+
+#define CHUNK_KEY(x, y, z) ((ChunkKey)((((int64_t)(x) & CHUNK_KEY_MASK) << (2 * CHUNK_KEY_BITS)) | \
+                                       (((int64_t)(y) & CHUNK_KEY_MASK) << CHUNK_KEY_BITS) |       \
+                                       ((int64_t)(z) & CHUNK_KEY_MASK)))
+
+// Coordinates back from the key, shifted to the top and back down so the sign is kept
+#define CHUNK_KEY_X(key) ((int)((int64_t)((uint64_t)(key) << 1) >> (64 - CHUNK_KEY_BITS)))
+#define CHUNK_KEY_Y(key) ((int)((int64_t)((uint64_t)(key) << (1 + CHUNK_KEY_BITS)) >> (64 - CHUNK_KEY_BITS)))
+#define CHUNK_KEY_Z(key) ((int)((int64_t)((uint64_t)(key) << (1 + 2 * CHUNK_KEY_BITS)) >> (64 - CHUNK_KEY_BITS)))
+
+/**
+ * Hash of chunk coordinates used by the gpu chunk table, voxel.comp computes the same one.
+ * Spatial hash with a finalizer so the low bits are mixed well enough for a power of two table
+ */
+static inline unsigned int chunk_hash(int x, int y, int z)
+{
+    unsigned int hash = (unsigned int)x * 73856093U ^ (unsigned int)y * 19349663U ^ (unsigned int)z * 83492791U;
+    hash ^= hash >> 16;
+    hash *= 0x7FEB352DU;
+    hash ^= hash >> 15;
+    hash *= 0x846CA68BU;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
 typedef struct Chunk Chunk;
 struct Chunk
 {
-    unsigned int position; // Max value of 1024, later can be upgraded to long unsigned int which is 8 bytes (2097151)
-    Octree *voxel_tree;
+    ChunkKey position;         // Chunk coordinates, see CHUNK_KEY
+    Octree *voxel_tree;        // Pointer octree used for building and editing the chunk
+    PackedOctree packed_tree; // Same octree in the layout the gpu reads, rebuilt when the octree changes
+    unsigned int generation;  // Incremented by every edit, the scene compares it to find chunks to serialize again
+
+    // Elements of the distance field stored after the packed octree attributes, 0 until a serialization asks for it
+    unsigned int distance_field_size;
+
+    // Optional bit per voxel, word z * CHUNK_SIZE + y holds the row along x with bit x. NULL if not enabled
+    uint64_t *occupancy;
 };
 
 typedef struct GPUChunk GPUChunk;
 struct GPUChunk
 {
-    unsigned int position;
+    // Chunk coordinates, in chunks
+    int x;
+    int y;
+    int z;
+
     unsigned int offset;
     unsigned int size;
-    unsigned int valid;
+    unsigned int format; // OctreeFormat of the chunk data, OCTREE_FORMAT_NONE if the table entry is empty
+
+    unsigned int max_depth;      // Levels the traversal goes into before drawing nodes from their attributes, see AScene.UpdateLOD
+    unsigned int distance_field; // Offset of the chunk's distance field from offset, 0 if it has none. Entries are 32 bytes, so two of them share a cache line
 };
 
 typedef struct
 {
-    unsigned int *data;
+    unsigned int *data; // Borrowed from the chunk's packed octree, don't free
     unsigned int size;
+    unsigned int attributes_size; // Node attributes stored after size in data, see PackedOctree
+    unsigned int distance_field_size; // Distance field stored after the attributes, 0 if it wasn't asked for
+    OctreeFormat format;
 } SerializedChunk;
 
+// Data passed to AChunk.Serialize, so it can be queued on a worker
+typedef struct ChunkSerializeData ChunkSerializeData;
+struct ChunkSerializeData
+{
+    Chunk *chunk;
+    SerializedChunk *result;
+    bool distance_field; // Also build the empty space distance field of the chunk, see OCTREE_FIELD_SIZE
+};
+
 struct AChunk
 {
+    /**
+     * Creates an empty chunk at position, in chunks. Coordinates can be negative and are clamped to
+     * CHUNK_COORDINATE_MIN and CHUNK_COORDINATE_MAX
+     */
     Chunk *(*Init)(vec3 position);
+    void (*Delete)(Chunk *chunk);
 
     void (*Add)(Chunk *chunk, unsigned int x, unsigned int y, unsigned int z, unsigned char color, unsigned int uvs);
 
+    // Adds count voxels in one pass, much faster than calling Add for each of them
+    void (*AddBatch)(Chunk *chunk, const OctreeVoxel *voxels, unsigned int count);
+
+    // Removes a voxel, returns false if it was already empty
+    bool (*Remove)(Chunk *chunk, unsigned int x, unsigned int y, unsigned int z);
+
+    /**
+     * Region edits in voxels of the chunk, the region can reach outside of it. Whole octree nodes inside the region
+     * are written at once, so they cost about the surface of the region, see AOctree.FillRegion.
+     * Box min and max are the first and last voxel on each axis, voxels are in a sphere if their center is.
+     * Return false if no voxel changed
+     */
+    bool (*FillBox)(Chunk *chunk, const int min[3], const int max[3], unsigned char color);
+    bool (*ClearBox)(Chunk *chunk, const int min[3], const int max[3]);
+    bool (*FillSphere)(Chunk *chunk, vec3 center, float radius, unsigned char color);
+    bool (*ClearSphere)(Chunk *chunk, vec3 center, float radius);
+
+    /**
+     * Repacks the octree if it changed since the last pack, Serialize does it on its own thread otherwise.
+     * With a manager the subtrees are packed on its workers, for chunks too big for one thread. Not from inside a job
+     */
+    void (*Pack)(Chunk *chunk, ThreadsManager *manager);
+
     void (*Serialize)(void *data);
+
+    /**
+     * Builds the occupancy bitmask of the chunk from its octree, after this it is kept in sync by every edit.
+     * Costs 32 KiB per chunk
+     */
+    void (*EnableOccupancy)(Chunk *chunk);
+    void (*DisableOccupancy)(Chunk *chunk);
+
+    // Returns if the voxel is solid, constant time with occupancy enabled, otherwise walks the octree
+    bool (*Get)(Chunk *chunk, unsigned int x, unsigned int y, unsigned int z);
+
+    // Returns the row of voxels along x at y, z, bit x is set if the voxel is solid
+    uint64_t (*GetRow)(Chunk *chunk, unsigned int y, unsigned int z);
+
+    // Writes CHUNK_SIZE rows of the plane at z into rows, rows[y] is the same as GetRow(chunk, y, z)
+    void (*GetPlane)(Chunk *chunk, unsigned int z, uint64_t rows[CHUNK_SIZE]);
+
+    // Bytes of memory the chunk holds, its octree, packed octree and occupancy
+    size_t (*GetMemorySize)(Chunk *chunk);
 };
 
 extern struct AChunk AChunk;
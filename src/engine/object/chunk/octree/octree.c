@@ -11,8 +11,12 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
 
 #include "octree.h"
+#include "dda.h"
 #include "../../../util/util.h"
 
 #define OCTREE_SIZE 64
@@ -24,24 +28,145 @@
 #define COLOR_BIT_SHIFT 22          // Shift needed to position color at bits 22 to 29
 #define CHILDREN_SIZE_BIT_MASK (0xFFFF << 8)
 
+#define CHILD_MASK 0xFF
+#define FIRST_CHILD_BIT_SHIFT 8
+#define FIRST_CHILD_MAX 0x3FFFFF // 22 bits between the child mask and the far bit
+#define FAR_BIT_MASK (1U << 30)  // First child offset is in the far table at the end of the array
+#define DAG_CHILD_MAX 0x7FFFFF   // 23 bits between the child mask and the leaf bit
+#define DAG_FIRST_SLOTS 1024
+
+#define POOL_FIRST_SLAB_GROUPS 8 // Small first slab so sparse chunks stay small
+#define POOL_MAX_SLAB_GROUPS 1024
+
 static void visualize_octree(OctreeNode *node, int depth);
-static int add_data(Octree *octree, OctreeNode *node, unsigned char current_depth, unsigned int x, unsigned int y, unsigned int z, unsigned char color);
+static void add_data(Octree *octree, unsigned int x, unsigned int y, unsigned int z, unsigned char color);
+static void set_size(OctreeNode *node, unsigned int size);
+static bool merge_children(Octree *octree, OctreeNode *node);
 static OctreeNode *create_node();
+static unsigned int update_children_size(OctreeNode *node);
 
-static Octree *Init()
+static OctreeNode *pool_alloc_group(OctreePool *pool)
+{
+    OctreeNode *group = NULL;
+
+    if (pool->free_groups)
+    {
+        // Reuse a group that was freed before
+        group = pool->free_groups;
+        pool->free_groups = group->children;
+        pool->groups_free--;
+    }
+    else
+    {
+        OctreePoolSlab *slab = pool->slabs;
+        if (!slab || pool->groups_used == pool->groups_reserved)
+        {
+            // Every slab is full, each new slab is twice the size of the last one
+            unsigned int groups_count = slab ? slab->groups_count * 2 : POOL_FIRST_SLAB_GROUPS;
+            if (groups_count > POOL_MAX_SLAB_GROUPS)
+                groups_count = POOL_MAX_SLAB_GROUPS;
+
+            slab = malloc(sizeof(OctreePoolSlab) + sizeof(OctreeNode) * 8 * groups_count);
+            if (!slab)
+                ERROR_EXIT("Failed to allocate memory for octree pool slab.\n");
+
+            slab->groups_count = groups_count;
+            slab->nodes = (OctreeNode *)(slab + 1);
+            slab->next = pool->slabs;
+            pool->slabs = slab;
+
+            pool->groups_reserved += groups_count;
+        }
+
+        // Only the newest slab can have groups that were never handed out
+        size_t slab_used = slab->groups_count - (pool->groups_reserved - pool->groups_used);
+        group = &slab->nodes[slab_used * 8];
+        pool->groups_used++;
+    }
+
+    memset(group, 0, sizeof(OctreeNode) * 8);
+
+    return group;
+}
+
+static void pool_free_group(OctreePool *pool, OctreeNode *group)
+{
+    group->children = pool->free_groups;
+    pool->free_groups = group;
+    pool->groups_free++;
+}
+
+static void pool_release(OctreePool *pool)
+{
+    OctreePoolSlab *slab = pool->slabs;
+    while (slab)
+    {
+        OctreePoolSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+
+    memset(pool, 0, sizeof(OctreePool));
+}
+
+static Octree *InitDepth(unsigned char depth)
 {
+    if (depth == 0 || depth > OCTREE_MAX_DEPTH)
+        ERROR_EXIT("[ERROR] Octree depth %u is not supported.\n", depth);
+
     Octree *octree = malloc(sizeof(Octree));
     if (!octree)
         ERROR_EXIT("Failed to allocate memory for octree.\n");
 
-    octree->depth = OCTREE_DEPTH;
+    memset(&octree->pool, 0, sizeof(OctreePool));
+
+    octree->depth = depth;
     octree->root = create_node();
+    octree->pool.nodes_live = 1;
 
     puts("[INFO] Octree initialized");
 
     return octree;
 }
 
+static Octree *Init()
+{
+    return InitDepth(OCTREE_DEPTH);
+}
+
+static void Delete(Octree *octree)
+{
+    if (!octree)
+        return;
+
+    // All nodes except the root live in the pool, so they are freed together
+    pool_release(&octree->pool);
+    free(octree->root);
+    free(octree);
+}
+
+static OctreePoolStats GetPoolStats(Octree *octree)
+{
+    OctreePoolStats stats = {0};
+    if (!octree)
+        return stats;
+
+    OctreePool *pool = &octree->pool;
+
+    stats.nodes_live = pool->nodes_live;
+    stats.nodes_reserved = pool->groups_reserved * 8 + 1;
+    stats.bytes_reserved = sizeof(Octree) + sizeof(OctreeNode);
+
+    for (OctreePoolSlab *slab = pool->slabs; slab; slab = slab->next)
+    {
+        stats.bytes_reserved += sizeof(OctreePoolSlab) + sizeof(OctreeNode) * 8 * slab->groups_count;
+    }
+
+    stats.fragmentation = 1.0f - (float)stats.nodes_live / (float)stats.nodes_reserved;
+
+    return stats;
+}
+
 static void VisualizeOctree(Octree *octree)
 {
     puts("[INFO] Visualizing octree");
@@ -90,9 +215,9 @@ static void visualize_octree(OctreeNode *node, int depth)
     { // If not a leaf and children exist
         for (int i = 0; i < 8; i++)
         {
-            if (node->children[i])
+            if (node->data & (1 << i))
             { // Recursively visualize each child
-                visualize_octree(node->children[i], depth + 1);
+                visualize_octree(&node->children[i], depth + 1);
             }
         }
     }
@@ -106,6 +231,7 @@ static OctreeNode *create_node()
 
     // Set the first bit to 0 because this is not a leaf node, and the second to 0 because this node doesn't have any vertexes
     node->data = 0;
+    node->size = 1;
     // unsigned int current_children_count = (node->data & CHILDREN_SIZE_BIT_MASK) >> 8;
     // current_children_count++;
     // node->data = (node->data & ~CHILDREN_SIZE_BIT_MASK) | ((current_children_count % 0x1FFFF) << 8);
@@ -114,158 +240,2136 @@ static OctreeNode *create_node()
     return node;
 }
 
-static int add_data(Octree *octree, OctreeNode *node, unsigned char current_depth, unsigned int x, unsigned int y, unsigned int z, unsigned char color)
+// Turns a leaf covering more than one voxel into 8 leaves of the same color
+static void split_leaf(Octree *octree, OctreeNode *node)
 {
-    puts("[INFO] Adding data to octree");
+    unsigned int leaf = node->data & (LEAF_BIT_MASK | COLOR_BIT_MASK);
 
-    if (octree->depth == current_depth)
+    node->children = pool_alloc_group(&octree->pool);
+    for (int i = 0; i < 8; i++)
     {
-        puts("[INFO] Max depth reached");
+        node->children[i].data = leaf;
+        node->children[i].size = 1;
+    }
+
+    node->data = CHILD_MASK;
+    node->size = 9;
+    octree->pool.nodes_live += 8;
+}
+
+// Collapses the node into a single leaf if all 8 of its children are leaves with the same color
+static bool merge_children(Octree *octree, OctreeNode *node)
+{
+    if ((node->data & CHILD_MASK) != CHILD_MASK)
+        return false;
+
+    unsigned int leaf = node->children[0].data;
+    if (!(leaf & LEAF_BIT_MASK))
+        return false;
 
-        // todo
-        // if (node->data != 0)
-        // {
-        //     puts("[INFO] Leaf already exists");
-        //     return NULL;
-        // }
+    for (int i = 1; i < 8; i++)
+    {
+        if (node->children[i].data != leaf)
+            return false;
+    }
 
-        // This is a leaf node, so we can add the data to the node
-        // Set the first bit to 1 because this is a leaf node
-        node->data = 0;
-        node->data |= LEAF_BIT_MASK;
+    pool_free_group(&octree->pool, node->children);
+    node->children = NULL;
+    node->data = leaf;
+    node->size = 1;
+    octree->pool.nodes_live -= 8;
 
-        // Store the color
-        node->data |= (node->data & ~COLOR_BIT_MASK) | ((color << COLOR_BIT_SHIFT) & COLOR_BIT_MASK);
+    return true;
+}
 
-        // Store the uvs
+static void add_data(Octree *octree, unsigned int x, unsigned int y, unsigned int z, unsigned char color)
+{
+    unsigned int leaf_data = LEAF_BIT_MASK | ((color << COLOR_BIT_SHIFT) & COLOR_BIT_MASK);
 
-        return 1;
+    // Nodes from the root to the leaf and their sizes before the edit
+    OctreeNode *path[OCTREE_MAX_DEPTH + 1] = {octree->root};
+    unsigned int old_sizes[OCTREE_MAX_DEPTH + 1] = {octree->root->size};
+
+    for (unsigned char current_depth = 0; current_depth < octree->depth; current_depth++)
+    {
+        OctreeNode *node = path[current_depth];
+
+        if (node->data & LEAF_BIT_MASK)
+        {
+            // The voxel is inside a bigger leaf, nothing changes if it has the same color
+            if (node->data == leaf_data)
+                return;
+
+            split_leaf(octree, node);
+        }
+
+        // Translate the coordinates to select a child node to add
+        unsigned int bit = octree->depth - 1 - current_depth;
+        unsigned int index = ((x >> bit) & 1) | (((y >> bit) & 1) << 1) | (((z >> bit) & 1) << 2);
+
+        if (node->children == NULL)
+        {
+            // All 8 siblings are allocated together from the pool
+            node->children = pool_alloc_group(&octree->pool);
+        }
+
+        OctreeNode *child = &node->children[index];
+        if (!(node->data & (1 << index)))
+        {
+            // Set the corresponding bit to 1 to indicate that this child exists
+            node->data |= (1 << index);
+            octree->pool.nodes_live++;
+
+            child->data = 0;
+            child->size = 1;
+            old_sizes[current_depth + 1] = 0;
+        }
+        else
+        {
+            old_sizes[current_depth + 1] = child->size;
+        }
+
+        path[current_depth + 1] = child;
     }
 
-    // Translate the coordinates to select a child node to add
-    unsigned int mid_point = OCTREE_SIZE >> (current_depth + 1); // Divide size by 2^(current_depth+1)
-    unsigned int index = (x >= mid_point) + ((y >= mid_point) << 1) + ((z >= mid_point) << 2);
+    // This is a leaf node, replace whatever color it had
+    OctreeNode *leaf = path[octree->depth];
+    leaf->data = leaf_data;
+    leaf->size = 1;
 
-    if (node->children == NULL)
+    // Only the nodes on the path changed, parents whose children are now all the same leaf collapse into it
+    int difference = 1 - (int)old_sizes[octree->depth];
+    bool merging = true;
+    for (int current_depth = octree->depth - 1; current_depth >= 0; current_depth--)
     {
-        node->children = malloc(sizeof(OctreeNode *) * 8);
-        if (!node->children)
-            ERROR_EXIT("Failed to allocate memory for octree children.\n");
+        OctreeNode *node = path[current_depth];
+
+        // The root always stays a node with children
+        if (!merging || current_depth == 0 || !merge_children(octree, node))
+        {
+            if (!merging && difference == 0)
+                break;
+
+            merging = false;
+            set_size(node, node->size + difference);
+        }
+
+        difference = (int)node->size - (int)old_sizes[current_depth];
+    }
+}
+
+static bool remove_data(Octree *octree, unsigned int x, unsigned int y, unsigned int z)
+{
+    OctreeNode *path[OCTREE_MAX_DEPTH + 1] = {octree->root};
+    unsigned int old_sizes[OCTREE_MAX_DEPTH + 1];
+    unsigned int indices[OCTREE_MAX_DEPTH];
+
+    for (unsigned char current_depth = 0; current_depth < octree->depth; current_depth++)
+    {
+        OctreeNode *node = path[current_depth];
+        old_sizes[current_depth] = node->size;
+
+        // Removing a voxel from a bigger leaf leaves the other 7 children behind
+        if (node->data & LEAF_BIT_MASK)
+            split_leaf(octree, node);
+
+        unsigned int bit = octree->depth - 1 - current_depth;
+        unsigned int index = ((x >> bit) & 1) | (((y >> bit) & 1) << 1) | (((z >> bit) & 1) << 2);
+        if (!(node->data & (1 << index)))
+            return false;
 
-        memset(node->children, 0, sizeof(OctreeNode *) * 8);
+        indices[current_depth] = index;
+        path[current_depth + 1] = &node->children[index];
     }
 
-    if (node->children[index] == NULL)
+    OctreeNode *leaf = path[octree->depth];
+    leaf->data = 0;
+    leaf->size = 0;
+    octree->pool.nodes_live--;
+
+    // Walk back up, parents that lost their last child are removed too, the root always stays
+    int difference = -1;
+    bool remove_child = true;
+    for (int current_depth = octree->depth - 1; current_depth >= 0; current_depth--)
     {
-        // Set the corresponding bit to 1 to indicate that this child exists
-        node->data |= (1 << index);
+        OctreeNode *node = path[current_depth];
+
+        if (remove_child)
+        {
+            node->data &= ~(1U << indices[current_depth]);
+
+            if (!(node->data & CHILD_MASK))
+            {
+                // The whole group of siblings is empty, give it back to the pool
+                pool_free_group(&octree->pool, node->children);
+                node->children = NULL;
+
+                if (current_depth > 0)
+                {
+                    node->data = 0;
+                    node->size = 0;
+                    octree->pool.nodes_live--;
+                    difference = -(int)old_sizes[current_depth];
+                    continue;
+                }
+            }
+
+            remove_child = false;
+        }
 
-        node->children[index] = create_node(); // Lazy initialization of child nodes
+        set_size(node, node->size + difference);
+        difference = (int)node->size - (int)old_sizes[current_depth];
     }
 
-    add_data(octree, node->children[index], current_depth + 1, x % mid_point, y % mid_point, z % mid_point, color);
+    return true;
+}
+
+// Writes the amount of nodes in the subtree of node
+static void set_size(OctreeNode *node, unsigned int size)
+{
+    node->size = size;
+
+    // The size in data is only used by OCTREE_FORMAT_CHILDREN_SIZE, bigger subtrees can't be written in that format
+    node->data = (node->data & ~CHILDREN_SIZE_BIT_MASK) | ((size > 0xFFFF ? 0xFFFF : size) << 8);
+}
 
-    int result = 1;
+// Recalculates the amount of nodes in the subtree of node from its direct children
+static unsigned int update_children_size(OctreeNode *node)
+{
+    unsigned int result = 1;
     for (int i = 0; i < 8; i++)
     {
-        if (!node->children[i])
+        if (!(node->data & (1 << i)))
         {
             continue;
         }
 
-        if (node->children[i]->data & LEAF_BIT_MASK)
+        result += node->children[i].size;
+    }
+
+    set_size(node, result);
+
+    return result;
+}
+
+// Interleaves the coordinate bits so that every 3 bits select a child, from the root down
+static unsigned int morton_encode(unsigned int x, unsigned int y, unsigned int z, unsigned char depth)
+{
+    unsigned int code = 0;
+    for (unsigned char bit = 0; bit < depth; bit++)
+    {
+        unsigned int index = ((x >> bit) & 1) | (((y >> bit) & 1) << 1) | (((z >> bit) & 1) << 2);
+        code |= index << (bit * 3);
+    }
+
+    return code;
+}
+
+// Stable LSD radix sort on the morton part of the keys, so duplicates keep their input order
+static void radix_sort_keys(unsigned int *keys, unsigned int *temp, unsigned int count, unsigned int key_bits)
+{
+    for (unsigned int shift = 8; shift < key_bits + 8; shift += 8)
+    {
+        unsigned int histogram[256] = {0};
+        for (unsigned int i = 0; i < count; i++)
         {
-            result++;
+            histogram[(keys[i] >> shift) & 0xFF]++;
         }
 
-        result += (node->children[i]->data & CHILDREN_SIZE_BIT_MASK) >> 8;
-    }
+        unsigned int offset = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            unsigned int bucket = histogram[i];
+            histogram[i] = offset;
+            offset += bucket;
+        }
 
-    unsigned int current_children_count = (node->data & CHILDREN_SIZE_BIT_MASK) >> 8;
-    current_children_count = result;
-    node->data = (node->data & ~CHILDREN_SIZE_BIT_MASK) | ((current_children_count % 0x1FFFF) << 8);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            temp[histogram[(keys[i] >> shift) & 0xFF]++] = keys[i];
+        }
 
-    return current_children_count;
+        memcpy(keys, temp, count * sizeof(unsigned int));
+    }
 }
 
 static void Add(Octree *octree, unsigned int x, unsigned int y, unsigned int z, unsigned char color, unsigned int uvs)
 {
-    add_data(octree, octree->root, 0, x, y, z, color);
+    unsigned int octree_size = 1U << octree->depth;
+    if (x >= octree_size || y >= octree_size || z >= octree_size)
+    {
+        fprintf(stderr, "[WARNING] Voxel %u, %u, %u is outside of the octree, skipping.\n", x, y, z);
+        return;
+    }
+
+    add_data(octree, x, y, z, color);
 }
 
-static void LinearizeOctree(OctreeNode *root, unsigned int **array, unsigned int *size)
+static unsigned int compact_node(Octree *octree, OctreeNode *node, bool is_root)
 {
-    // puts("[INFO] Serializing octree.");
+    if (node->data & LEAF_BIT_MASK)
+        return 1;
 
-    if (root == NULL)
+    for (int i = 0; i < 8; i++)
     {
-        puts("[INFO] No root provided.");
+        if (node->data & (1 << i))
+            compact_node(octree, &node->children[i], false);
+    }
+
+    if (!is_root && merge_children(octree, node))
+        return 1;
+
+    return update_children_size(node);
+}
+
+static unsigned int Compact(Octree *octree)
+{
+    if (!octree || !octree->root)
+        return 0;
+
+    size_t nodes_before = octree->pool.nodes_live;
+    compact_node(octree, octree->root, true);
+
+    return (unsigned int)(nodes_before - octree->pool.nodes_live);
+}
+
+static bool Remove(Octree *octree, unsigned int x, unsigned int y, unsigned int z)
+{
+    unsigned int octree_size = 1U << octree->depth;
+    if (x >= octree_size || y >= octree_size || z >= octree_size)
+        return false;
+
+    return remove_data(octree, x, y, z);
+}
+
+static OctreeRegionOverlap RegionOverlap(const OctreeRegion *region, int x, int y, int z, int side)
+{
+    int position[3] = {x, y, z};
+
+    if (region->shape == OCTREE_REGION_BOX)
+    {
+        OctreeRegionOverlap overlap = OCTREE_REGION_INSIDE;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            int last = position[axis] + side - 1;
+            if (last < region->min[axis] || position[axis] > region->max[axis])
+                return OCTREE_REGION_OUTSIDE;
+
+            if (position[axis] < region->min[axis] || last > region->max[axis])
+                overlap = OCTREE_REGION_PARTIAL;
+        }
+
+        return overlap;
+    }
+
+    // Voxel centers of the cube go from position + 0.5 to position + side - 0.5, the sphere is convex so the
+    // closest and furthest of them decide
+    float nearest = 0.0f;
+    float furthest = 0.0f;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float low = position[axis] + 0.5f - region->center[axis];
+        float high = position[axis] + side - 0.5f - region->center[axis];
+
+        float near = low > 0.0f ? low : (high < 0.0f ? high : 0.0f);
+        float far = fabsf(low) > fabsf(high) ? low : high;
+        nearest += near * near;
+        furthest += far * far;
+    }
+
+    float radius = region->radius * region->radius;
+    if (nearest > radius)
+        return OCTREE_REGION_OUTSIDE;
+
+    return furthest <= radius ? OCTREE_REGION_INSIDE : OCTREE_REGION_PARTIAL;
+}
+
+// Frees every node under node back to the pool
+static void free_children(Octree *octree, OctreeNode *node)
+{
+    if ((node->data & LEAF_BIT_MASK) || !node->children)
         return;
+
+    for (int i = 0; i < 8; i++)
+    {
+        if (node->data & (1 << i))
+            free_children(octree, &node->children[i]);
     }
 
-    unsigned int capacity = 300; // Initial capacity of the array
-    *array = malloc(capacity * sizeof(unsigned int));
-    *size = 0;
+    octree->pool.nodes_live -= POPCOUNT(node->data & CHILD_MASK);
+    pool_free_group(&octree->pool, node->children);
+    node->children = NULL;
+}
 
-    // Queue for breadth-first traversal
-    OctreeNode **stack = malloc(capacity * sizeof(OctreeNode *));
-    int top = 0;
+typedef struct RegionEdit RegionEdit;
+struct RegionEdit
+{
+    Octree *octree;
+    const OctreeRegion *region;
+    unsigned int leaf; // Leaf written into the region, 0 clears it
+    bool changed;
+};
 
-    // Enqueue root
-    stack[top++] = root;
+/**
+ * Edits the children of node, which isn't a leaf and covers side voxels from x, y, z. Children fully inside the
+ * region are replaced whole, children on its border are edited the same way and merged or removed afterwards
+ */
+static void edit_region_children(RegionEdit *edit, OctreeNode *node, int x, int y, int z, int side)
+{
+    Octree *octree = edit->octree;
+    int half = side / 2;
 
-    while (top > 0)
+    for (int i = 0; i < 8; i++)
     {
-        OctreeNode *current = stack[--top];
-        // puts("[INFO] Serializing...");
+        int child_x = x + (i & 1) * half;
+        int child_y = y + ((i >> 1) & 1) * half;
+        int child_z = z + ((i >> 2) & 1) * half;
+
+        OctreeRegionOverlap overlap = RegionOverlap(edit->region, child_x, child_y, child_z, half);
+        bool exists = node->data & (1 << i);
+        if (overlap == OCTREE_REGION_OUTSIDE || (!exists && !edit->leaf))
+            continue;
+
+        if (!node->children)
+            node->children = pool_alloc_group(&octree->pool);
 
-        // Resize queue and array if needed
-        if (*size >= capacity - 1)
+        OctreeNode *child = &node->children[i];
+        if (overlap == OCTREE_REGION_INSIDE)
         {
-            // puts("[INFO] Realloc");
-            capacity *= 2;
-            stack = realloc(stack, capacity * sizeof(OctreeNode *));
-            *array = realloc(*array, capacity * sizeof(unsigned int));
+            if (exists && child->data == edit->leaf)
+                continue;
+
+            free_children(octree, child);
+            edit->changed = true;
 
-            if (!(*array) || !stack)
+            if (edit->leaf)
             {
-                puts("[ERROR] Memory reallocation failed.");
-                return;
+                child->data = edit->leaf;
+                child->size = 1;
+                if (!exists)
+                {
+                    node->data |= 1 << i;
+                    octree->pool.nodes_live++;
+                }
+            }
+            else
+            {
+                child->data = 0;
+                child->size = 0;
+                node->data &= ~(1U << i);
+                octree->pool.nodes_live--;
             }
+
+            continue;
         }
 
-        // Process current node
-        (*array)[(*size)++] = current->data;
+        if (!exists)
+        {
+            node->data |= 1 << i;
+            octree->pool.nodes_live++;
+            child->data = 0;
+            child->size = 1;
+        }
+        else if (child->data & LEAF_BIT_MASK)
+        {
+            // A leaf of the filled color doesn't change, any other leaf is split along the border
+            if (child->data == edit->leaf)
+                continue;
 
-        // Enqueue children this can be further enhanced because we know which children we have
-        if (!(current->data & LEAF_BIT_MASK) && current->children)
+            split_leaf(octree, child);
+        }
+
+        edit_region_children(edit, child, child_x, child_y, child_z, half);
+
+        // The border can still miss every voxel of a child that was created for it
+        if (!(child->data & CHILD_MASK))
         {
-            for (int i = 7; i >= 0; i--)
+            child->data = 0;
+            child->size = 0;
+            node->data &= ~(1U << i);
+            octree->pool.nodes_live--;
+        }
+        else if (!merge_children(octree, child))
+        {
+            update_children_size(child);
+        }
+    }
+
+    if (!(node->data & CHILD_MASK) && node->children)
+    {
+        pool_free_group(&octree->pool, node->children);
+        node->children = NULL;
+    }
+}
+
+static bool edit_region(Octree *octree, const OctreeRegion *region, unsigned int leaf)
+{
+    if (!octree || !region || RegionOverlap(region, 0, 0, 0, 1 << octree->depth) == OCTREE_REGION_OUTSIDE)
+        return false;
+
+    // The root always stays a node with children, even if the region covers all of it
+    if (octree->root->data & LEAF_BIT_MASK)
+        split_leaf(octree, octree->root);
+
+    RegionEdit edit = {.octree = octree, .region = region, .leaf = leaf};
+    edit_region_children(&edit, octree->root, 0, 0, 0, 1 << octree->depth);
+    update_children_size(octree->root);
+
+    return edit.changed;
+}
+
+static bool FillRegion(Octree *octree, const OctreeRegion *region, unsigned char color)
+{
+    return edit_region(octree, region, LEAF_BIT_MASK | ((color << COLOR_BIT_SHIFT) & COLOR_BIT_MASK));
+}
+
+static bool ClearRegion(Octree *octree, const OctreeRegion *region)
+{
+    return edit_region(octree, region, 0);
+}
+
+static void AddBatch(Octree *octree, const OctreeVoxel *voxels, unsigned int count)
+{
+    if (!octree || !voxels || count == 0)
+        return;
+
+    // Sort keys are the morton code in the upper bits and the color in the lowest byte
+    unsigned int *keys = malloc(count * sizeof(unsigned int));
+    unsigned int *temp = malloc(count * sizeof(unsigned int));
+    if (!keys || !temp)
+        ERROR_EXIT("Failed to allocate memory for octree batch keys.\n");
+
+    unsigned int octree_size = 1U << octree->depth;
+    unsigned int keys_count = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (voxels[i].x >= octree_size || voxels[i].y >= octree_size || voxels[i].z >= octree_size)
+        {
+            fprintf(stderr, "[WARNING] Voxel %u, %u, %u is outside of the octree, skipping.\n", voxels[i].x, voxels[i].y, voxels[i].z);
+            continue;
+        }
+
+        keys[keys_count++] = morton_encode(voxels[i].x, voxels[i].y, voxels[i].z, octree->depth) << 8 | voxels[i].color;
+    }
+
+    radix_sort_keys(keys, temp, keys_count, octree->depth * 3);
+    free(temp);
+
+    // Nodes along the path of the previous key, every node below a diverging level is finished
+    OctreeNode *path[32] = {octree->root};
+    unsigned int previous = 0;
+    bool has_previous = false;
+
+    for (unsigned int i = 0; i < keys_count; i++)
+    {
+        unsigned int morton = keys[i] >> 8;
+
+        // Duplicates are next to each other, the last one wins like with Add
+        if (i + 1 < keys_count && (keys[i + 1] >> 8) == morton)
+            continue;
+
+        // Find the first level where this key leaves the path of the previous one
+        unsigned char level = 0;
+        if (has_previous)
+        {
+            while (level < octree->depth && ((morton ^ previous) >> ((octree->depth - 1 - level) * 3)) == 0)
             {
-                if (current->data & (1 << i))
-                {
-                    // Check if the child exists
-                    if (current->children[i] != NULL)
-                    {
-                        stack[top++] = current->children[i];
-                    }
-                    else
-                    {
-                        puts("[ERROR] Something unintended happened\n");
-                    }
-                }
+                level++;
+            }
+
+            // Subtrees we left will not be touched again, collapse them or calculate their sizes once
+            for (unsigned char closing = octree->depth - 1; closing > level; closing--)
+            {
+                if (!merge_children(octree, path[closing]))
+                    update_children_size(path[closing]);
             }
         }
-    }
 
-    free(stack);
+        for (; level < octree->depth; level++)
+        {
+            OctreeNode *node = path[level];
+            unsigned int index = (morton >> ((octree->depth - 1 - level) * 3)) & 7;
+
+            // Voxels inside a bigger leaf, it is merged back when it's closed if nothing changed
+            if (node->data & LEAF_BIT_MASK)
+                split_leaf(octree, node);
+
+            if (node->children == NULL)
+                node->children = pool_alloc_group(&octree->pool);
+
+            if (!(node->data & (1 << index)))
+            {
+                node->data |= (1 << index);
+                octree->pool.nodes_live++;
+            }
+
+            path[level + 1] = &node->children[index];
+        }
+
+        OctreeNode *leaf = path[octree->depth];
+        leaf->data = LEAF_BIT_MASK | (((keys[i] & 0xFF) << COLOR_BIT_SHIFT) & COLOR_BIT_MASK);
+        leaf->size = 1;
+
+        previous = morton;
+        has_previous = true;
+    }
+
+    // Close the last path up to the root
+    if (has_previous)
+    {
+        for (int closing = octree->depth - 1; closing >= 0; closing--)
+        {
+            if (closing == 0 || !merge_children(octree, path[closing]))
+                update_children_size(path[closing]);
+        }
+    }
+
+    free(keys);
+}
+
+static void linearize_children_size(OctreeNode *root, unsigned int **array, unsigned int *size)
+{
+    // Every node is one element, the stack holds at most the unvisited siblings along one path
+    *array = malloc(root->size * sizeof(unsigned int));
+    OctreeNode **stack = malloc((OCTREE_MAX_DEPTH * 7 + 1) * sizeof(OctreeNode *));
+    if (!*array || !stack)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for linearized octree.\n");
+
+    *size = 0;
+    int top = 0;
+    stack[top++] = root;
+
+    while (top > 0)
+    {
+        OctreeNode *current = stack[--top];
+        (*array)[(*size)++] = current->data;
+
+        // Push the children in reverse so the first one is written next
+        if (!(current->data & LEAF_BIT_MASK) && current->children)
+        {
+            for (int i = 7; i >= 0; i--)
+            {
+                if (current->data & (1 << i))
+                {
+                    stack[top++] = &current->children[i];
+                }
+            }
+        }
+    }
+
+    free(stack);
+}
+
+#define PACK_SPLIT_LEVEL 2              // Up to 64 subtrees packed in parallel
+#define PACK_PARALLEL_MIN_NODES 32768  // Smaller trees pack faster on one thread than it takes to queue the jobs
+
+#define LOD_FULL (1U << 24) // Filled part of a full node, exact for every voxel down to OCTREE_MAX_DEPTH levels
+
+typedef struct PackContext PackContext;
+typedef struct PackJob PackJob;
+struct PackContext
+{
+    unsigned int *nodes;
+    unsigned int cursor;
+
+    // First child offsets too big for the node, written at the end of the array
+    unsigned int *far;
+    unsigned int far_count;
+    unsigned int far_capacity;
+
+    unsigned short *attributes; // One for every node, written after the far table
+
+    // Bricks format, brick nodes hold the start of their brick in bricks until every node is placed
+    int brick_level; // Level of the brick nodes, -1 without bricks
+    unsigned int *bricks;
+    unsigned int bricks_count;
+    unsigned int bricks_capacity;
+    unsigned int *brick_nodes; // Index of every brick node
+    unsigned int brick_nodes_count;
+    unsigned int brick_nodes_capacity;
+
+    // Parallel packing, nodes at split_level were packed by the jobs and are copied in order. -1 packs everything here
+    int split_level;
+    PackJob *jobs;
+    unsigned int jobs_next;
+};
+
+// Subtree of a node at the split level, packed on a worker as if the node was the root
+struct PackJob
+{
+    OctreeNode *node;
+    int level;
+    PackContext context;
+    unsigned int filled;
+    unsigned int color;
+};
+
+static unsigned short lod_attributes(unsigned int filled, unsigned int color)
+{
+    unsigned int coverage = (unsigned int)(((unsigned long long)filled * 255 + LOD_FULL / 2) / LOD_FULL);
+    return (unsigned short)(color | coverage << OCTREE_LOD_COVERAGE_SHIFT);
+}
+
+// Offset bits of a node pointing at its first child or brick, offsets that don't fit go into the far table
+static unsigned int pack_offset(PackContext *context, unsigned int offset)
+{
+    if (offset <= FIRST_CHILD_MAX)
+        return offset << FIRST_CHILD_BIT_SHIFT;
+
+    // Store the offset in the far table, the node keeps its slot in the table
+    if (context->far_count == context->far_capacity)
+    {
+        context->far_capacity = context->far_capacity ? context->far_capacity * 2 : 64;
+        context->far = realloc(context->far, context->far_capacity * sizeof(unsigned int));
+        if (!context->far)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for packed octree far table.\n");
+    }
+
+    if (context->far_count > FIRST_CHILD_MAX)
+        ERROR_EXIT("[ERROR] Packed octree far table is full.\n");
+
+    context->far[context->far_count] = offset;
+    return FAR_BIT_MASK | context->far_count++ << FIRST_CHILD_BIT_SHIFT;
+}
+
+/**
+ * Sets the bits of the voxels under node in the brick occupancy and their colors in colors, indexed by bit.
+ * Node covers bits voxels starting at first_bit. Returns the filled part like pack_node
+ */
+static unsigned int brick_voxels(OctreeNode *node, unsigned int first_bit, unsigned int bits, uint64_t *occupancy, unsigned char *colors, unsigned int *color)
+{
+    if (node->data & LEAF_BIT_MASK)
+    {
+        *color = (node->data & COLOR_BIT_MASK) >> COLOR_BIT_SHIFT;
+        memset(&colors[first_bit], (int)*color, bits);
+        *occupancy |= (bits == 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1) << first_bit;
+        return LOD_FULL;
+    }
+
+    // Same majority color as pack_node, so the brick node's attributes don't depend on the format
+    unsigned int filled = 0;
+    unsigned int most_filled = 0;
+    *color = 0;
+
+    for (unsigned int i = 0; i < 8 && bits > 1; i++)
+    {
+        if (!(node->data & (1 << i)))
+            continue;
+
+        unsigned int child_color;
+        unsigned int child_filled = brick_voxels(&node->children[i], first_bit + i * (bits / 8), bits / 8, occupancy, colors, &child_color);
+        if (child_filled > most_filled)
+        {
+            most_filled = child_filled;
+            *color = child_color;
+        }
+
+        filled += child_filled;
+    }
+
+    return filled / 8;
+}
+
+// Writes the brick of the node at index, the node points at it once every node is placed
+static unsigned int pack_brick(OctreeNode *node, PackContext *context, unsigned int index, unsigned int *color)
+{
+    uint64_t occupancy = 0;
+    unsigned char colors[64];
+    unsigned int filled = brick_voxels(node, 0, 64, &occupancy, colors, color);
+
+    unsigned int voxels = POPCOUNT64(occupancy);
+    unsigned int brick_size = 2 + (voxels + 3) / 4;
+    if (context->bricks_count + brick_size > context->bricks_capacity)
+    {
+        context->bricks_capacity = context->bricks_capacity ? context->bricks_capacity * 2 : 1024;
+        context->bricks = realloc(context->bricks, context->bricks_capacity * sizeof(unsigned int));
+        if (!context->bricks)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for packed octree bricks.\n");
+    }
+
+    if (context->brick_nodes_count == context->brick_nodes_capacity)
+    {
+        context->brick_nodes_capacity = context->brick_nodes_capacity ? context->brick_nodes_capacity * 2 : 256;
+        context->brick_nodes = realloc(context->brick_nodes, context->brick_nodes_capacity * sizeof(unsigned int));
+        if (!context->brick_nodes)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for packed octree bricks.\n");
+    }
+
+    unsigned int *brick = &context->bricks[context->bricks_count];
+    brick[0] = (unsigned int)occupancy;
+    brick[1] = (unsigned int)(occupancy >> 32);
+    memset(&brick[2], 0, (brick_size - 2) * sizeof(unsigned int));
+
+    // Colors of the set bits only, a voxel finds its color by counting the bits before it
+    unsigned int color_index = 0;
+    for (unsigned int bit = 0; bit < 64; bit++)
+    {
+        if (!((occupancy >> bit) & 1))
+            continue;
+
+        brick[2 + color_index / 4] |= (unsigned int)colors[bit] << (color_index % 4 * 8);
+        color_index++;
+    }
+
+    context->nodes[index] = context->bricks_count;
+    context->brick_nodes[context->brick_nodes_count++] = index;
+    context->bricks_count += brick_size;
+
+    context->attributes[index] = lod_attributes(filled, *color);
+    return filled;
+}
+
+/**
+ * Places the next packed job subtree with its root at index and its other nodes at the cursor. Offsets inside the
+ * subtree are relative, so only the root offset, the brick starts and the far table slots change and the result is
+ * the same as packing it here
+ */
+static unsigned int pack_subtree(PackContext *context, unsigned int index, int level, unsigned int *color)
+{
+    PackJob *job = &context->jobs[context->jobs_next++];
+    PackContext *subtree = &job->context;
+
+    // Node p > 0 of the subtree goes to base + p - 1, its root to index
+    unsigned int base = context->cursor;
+    unsigned int descendants = subtree->cursor - 1;
+
+    if (level == context->brick_level)
+        context->nodes[index] = subtree->nodes[0];
+    else
+    {
+        unsigned int child_mask = subtree->nodes[0] & CHILD_MASK;
+        context->nodes[index] = child_mask | (child_mask ? pack_offset(context, base - index) : 0);
+    }
+
+    memcpy(&context->nodes[base], &subtree->nodes[1], descendants * sizeof(unsigned int));
+
+    // Far slots are taken in the order nodes are packed, the subtree's come after every slot taken before it
+    if (subtree->far_count)
+    {
+        for (unsigned int i = base; i < base + descendants; i++)
+        {
+            if ((context->nodes[i] & (LEAF_BIT_MASK | FAR_BIT_MASK)) == FAR_BIT_MASK)
+                context->nodes[i] += context->far_count << FIRST_CHILD_BIT_SHIFT;
+        }
+
+        for (unsigned int i = 0; i < subtree->far_count; i++)
+        {
+            pack_offset(context, subtree->far[i]);
+        }
+    }
+
+    context->attributes[index] = subtree->attributes[0];
+    memcpy(&context->attributes[base], &subtree->attributes[1], descendants * sizeof(unsigned short));
+    context->cursor += descendants;
+
+    if (subtree->bricks_count)
+    {
+        if (context->bricks_count + subtree->bricks_count > context->bricks_capacity)
+        {
+            context->bricks_capacity = context->bricks_count + subtree->bricks_count + context->bricks_capacity;
+            context->bricks = realloc(context->bricks, context->bricks_capacity * sizeof(unsigned int));
+            if (!context->bricks)
+                ERROR_EXIT("[ERROR] Failed to allocate memory for packed octree bricks.\n");
+        }
+
+        if (context->brick_nodes_count + subtree->brick_nodes_count > context->brick_nodes_capacity)
+        {
+            context->brick_nodes_capacity = context->brick_nodes_count + subtree->brick_nodes_count + context->brick_nodes_capacity;
+            context->brick_nodes = realloc(context->brick_nodes, context->brick_nodes_capacity * sizeof(unsigned int));
+            if (!context->brick_nodes)
+                ERROR_EXIT("[ERROR] Failed to allocate memory for packed octree bricks.\n");
+        }
+
+        // Brick nodes hold the start of their brick until pack_tree fixes them, which moves with the bricks before them
+        for (unsigned int i = 0; i < subtree->brick_nodes_count; i++)
+        {
+            unsigned int node = subtree->brick_nodes[i];
+            node = node ? base + node - 1 : index;
+            context->nodes[node] += context->bricks_count;
+            context->brick_nodes[context->brick_nodes_count++] = node;
+        }
+
+        memcpy(&context->bricks[context->bricks_count], subtree->bricks, subtree->bricks_count * sizeof(unsigned int));
+        context->bricks_count += subtree->bricks_count;
+    }
+
+    free(subtree->nodes);
+    free(subtree->far);
+    free(subtree->attributes);
+    free(subtree->bricks);
+    free(subtree->brick_nodes);
+
+    *color = job->color;
+    return job->filled;
+}
+
+/**
+ * Writes node at index and reserves space for its children at the cursor, then packs every child subtree.
+ * Returns the filled part of the node in LOD_FULL units and its majority color
+ */
+static unsigned int pack_node(OctreeNode *node, PackContext *context, unsigned int index, int level, unsigned int *color)
+{
+    if (node->data & LEAF_BIT_MASK)
+    {
+        context->nodes[index] = node->data & (LEAF_BIT_MASK | COLOR_BIT_MASK);
+        *color = (node->data & COLOR_BIT_MASK) >> COLOR_BIT_SHIFT;
+        context->attributes[index] = lod_attributes(LOD_FULL, *color);
+        return LOD_FULL;
+    }
+
+    if (level == context->split_level)
+        return pack_subtree(context, index, level, color);
+
+    if (level == context->brick_level)
+        return pack_brick(node, context, index, color);
+
+    unsigned int child_mask = node->data & CHILD_MASK;
+    unsigned int first_child = context->cursor;
+    unsigned int offset = child_mask ? first_child - index : 0;
+    context->nodes[index] = child_mask | pack_offset(context, offset);
+
+    context->cursor += POPCOUNT(child_mask);
+
+    // The node shows the color of the child with the most voxels, the first one on ties
+    unsigned int filled = 0;
+    unsigned int most_filled = 0;
+    *color = 0;
+
+    unsigned int child = first_child;
+    for (int i = 0; i < 8; i++)
+    {
+        if (child_mask & (1 << i))
+        {
+            unsigned int child_color;
+            unsigned int child_filled = pack_node(&node->children[i], context, child++, level + 1, &child_color);
+            if (child_filled > most_filled)
+            {
+                most_filled = child_filled;
+                *color = child_color;
+            }
+
+            filled += child_filled;
+        }
+    }
+
+    filled /= 8;
+    context->attributes[index] = lod_attributes(filled, *color);
+    return filled;
+}
+
+// Packs the subtree of a job into its own arrays, sized from the node count of the subtree
+static void *pack_job(void *data)
+{
+    PackJob *job = data;
+    PackContext *context = &job->context;
+
+    context->nodes = malloc(job->node->size * sizeof(unsigned int));
+    context->attributes = malloc(job->node->size * sizeof(unsigned short));
+    if (!context->nodes || !context->attributes)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for packed octree subtree.\n");
+
+    job->filled = pack_node(job->node, context, 0, job->level, &job->color);
+    return NULL;
+}
+
+// Adds a job for every internal node at the split level under node, in the order pack_node reaches them
+static void collect_pack_jobs(OctreeNode *node, int level, PackContext *context, PackJob *jobs, unsigned int *count)
+{
+    if (node->data & LEAF_BIT_MASK)
+        return;
+
+    if (level == context->split_level)
+    {
+        jobs[(*count)++] = (PackJob){.node = node, .level = level, .context = {.cursor = 1, .brick_level = context->brick_level, .split_level = -1}};
+        return;
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        if (node->data & (1 << i))
+            collect_pack_jobs(&node->children[i], level + 1, context, jobs, count);
+    }
+}
+
+// Level the subtrees are packed in parallel at, above the bricks. -1 to pack on one thread
+static int pack_split_level(OctreeNode *root, unsigned char depth, int brick_level, ThreadsManager *manager)
+{
+    if (!manager || root->size < PACK_PARALLEL_MIN_NODES)
+        return -1;
+
+    int level = PACK_SPLIT_LEVEL;
+    if (brick_level >= 0 && level > brick_level)
+        level = brick_level;
+    if (level >= depth)
+        level = depth - 1;
+
+    return level > 0 ? level : -1;
+}
+
+/**
+ * Packs the tree of root into nodes, which has to fit at least size of root nodes, followed by the node attributes.
+ * Nodes at brick_level are written as bricks, -1 packs the plain child offset layout.
+ * Subtrees at split_level are packed on the workers of manager, -1 packs everything on this thread.
+ * Returns the size of the packed nodes, bricks and far table
+ */
+static unsigned int pack_tree(OctreeNode *root, int brick_level, int split_level, ThreadsManager *manager, unsigned int **nodes, unsigned int *capacity, unsigned int *attributes_size)
+{
+    PackContext context = {.nodes = *nodes, .cursor = 1, .brick_level = brick_level, .split_level = split_level};
+    context.attributes = malloc(root->size * sizeof(unsigned short));
+    if (!context.attributes)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for packed octree attributes.\n");
+
+    if (split_level >= 0)
+    {
+        unsigned int jobs_count = 0;
+        context.jobs = malloc((1U << (3 * split_level)) * sizeof(PackJob));
+        if (!context.jobs)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for packed octree jobs.\n");
+
+        collect_pack_jobs(root, 0, &context, context.jobs, &jobs_count);
+        for (unsigned int i = 0; i < jobs_count; i++)
+        {
+            AThreadsManager.Add(manager, pack_job, &context.jobs[i]);
+        }
+
+        AThreadsManager.Wait(manager);
+    }
+
+    // Packs the levels above the split and copies the packed subtrees in
+    unsigned int color;
+    pack_node(root, &context, 0, 0, &color);
+
+    // Bricks go right after the nodes, now that their count is known the brick nodes can point at them
+    unsigned int nodes_count = context.cursor;
+    for (unsigned int i = 0; i < context.brick_nodes_count; i++)
+    {
+        unsigned int index = context.brick_nodes[i];
+        context.nodes[index] = pack_offset(&context, nodes_count + context.nodes[index] - index);
+    }
+
+    unsigned int size = nodes_count + context.bricks_count + context.far_count;
+    *attributes_size = (nodes_count + 1) / 2;
+    if (size + *attributes_size > *capacity)
+    {
+        context.nodes = realloc(context.nodes, (size + *attributes_size) * sizeof(unsigned int));
+        if (!context.nodes)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for packed octree.\n");
+
+        *nodes = context.nodes;
+        *capacity = size + *attributes_size;
+    }
+
+    if (context.bricks_count)
+        memcpy(&context.nodes[nodes_count], context.bricks, context.bricks_count * sizeof(unsigned int));
+
+    // The far table is read from the end of the array, slot 0 is the last element
+    for (unsigned int i = 0; i < context.far_count; i++)
+    {
+        context.nodes[size - 1 - i] = context.far[i];
+    }
+
+    unsigned int *attributes = &context.nodes[size];
+    for (unsigned int i = 0; i < *attributes_size; i++)
+    {
+        unsigned int high = 2 * i + 1 < nodes_count ? context.attributes[2 * i + 1] : 0;
+        attributes[i] = context.attributes[2 * i] | high << 16;
+    }
+
+    free(context.far);
+    free(context.attributes);
+    free(context.bricks);
+    free(context.brick_nodes);
+    free(context.jobs);
+    return size;
+}
+
+// Level of the brick nodes in an octree of depth, -1 if it's too shallow for bricks
+static int brick_level(unsigned char depth)
+{
+    return depth >= OCTREE_BRICK_DEPTH ? depth - OCTREE_BRICK_DEPTH : -1;
+}
+
+static void pack(Octree *octree, PackedOctree *packed, ThreadsManager *manager)
+{
+
+    // Every live node becomes at most one element of the array, two nodes share an attribute element.
+    // Bricks can need more for very sparse ones, pack_tree grows the array then
+    unsigned int size = octree->root->size + (octree->root->size + 1) / 2;
+    if (size > packed->capacity)
+    {
+        unsigned int *nodes = realloc(packed->nodes, size * sizeof(unsigned int));
+        if (!nodes)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for packed octree.\n");
+
+        packed->nodes = nodes;
+        packed->capacity = size;
+    }
+
+    int bricks = packed->format == OCTREE_FORMAT_BRICKS ? brick_level(octree->depth) : -1;
+    packed->format = bricks >= 0 ? OCTREE_FORMAT_BRICKS : OCTREE_FORMAT_CHILD_OFFSET;
+    int split = pack_split_level(octree->root, octree->depth, bricks, manager);
+    packed->size = pack_tree(octree->root, bricks, split, manager, &packed->nodes, &packed->capacity, &packed->attributes_size);
+    packed->is_valid = true;
+}
+
+static void Pack(Octree *octree, PackedOctree *packed)
+{
+    if (!octree || !packed)
+        return;
+
+    pack(octree, packed, NULL);
+}
+
+static void PackParallel(Octree *octree, PackedOctree *packed, ThreadsManager *manager)
+{
+    if (!octree || !packed)
+        return;
+
+    pack(octree, packed, manager);
+}
+
+static unsigned int dag_hash(const unsigned int *words, unsigned int count)
+{
+    unsigned int hash = 2166136261u;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        hash = (hash ^ words[i]) * 16777619u;
+    }
+
+    return hash ^ (hash >> 15);
+}
+
+static void dag_grow_slots(OctreeDAG *dag)
+{
+    unsigned int capacity = dag->slots_capacity ? dag->slots_capacity * 2 : DAG_FIRST_SLOTS;
+    OctreeDAGSlot *slots = calloc(capacity, sizeof(OctreeDAGSlot));
+    if (!slots)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for octree dag table.\n");
+
+    for (unsigned int i = 0; i < dag->slots_capacity; i++)
+    {
+        if (!dag->slots[i].count)
+            continue;
+
+        unsigned int slot = dag->slots[i].hash & (capacity - 1);
+        while (slots[slot].count)
+        {
+            slot = (slot + 1) & (capacity - 1);
+        }
+
+        slots[slot] = dag->slots[i];
+    }
+
+    free(dag->slots);
+    dag->slots = slots;
+    dag->slots_capacity = capacity;
+}
+
+// Returns the index of a group of nodes with the same words, the group is written if there isn't one yet
+static bool dag_find_or_add(OctreeDAG *dag, const unsigned int *words, unsigned int count, unsigned int *index)
+{
+    if ((dag->slots_count + 1) * 2 > dag->slots_capacity)
+        dag_grow_slots(dag);
+
+    // Children are written before the group, so same words means the same subtrees
+    unsigned int hash = dag_hash(words, count);
+    unsigned int slot = hash & (dag->slots_capacity - 1);
+    while (dag->slots[slot].count)
+    {
+        OctreeDAGSlot *current = &dag->slots[slot];
+        if (current->hash == hash && current->count == count && !memcmp(&dag->nodes[current->index], words, count * sizeof(unsigned int)))
+        {
+            *index = current->index;
+            return true;
+        }
+
+        slot = (slot + 1) & (dag->slots_capacity - 1);
+    }
+
+    if (dag->size + count > DAG_CHILD_MAX + 1)
+        return false;
+
+    if (dag->size + count > dag->capacity)
+    {
+        dag->capacity = dag->capacity ? dag->capacity * 2 : 1024;
+        dag->nodes = realloc(dag->nodes, dag->capacity * sizeof(unsigned int));
+        if (!dag->nodes)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for octree dag.\n");
+    }
+
+    memcpy(&dag->nodes[dag->size], words, count * sizeof(unsigned int));
+    dag->slots[slot] = (OctreeDAGSlot){hash, dag->size, count};
+    dag->slots_count++;
+
+    *index = dag->size;
+    dag->size += count;
+
+    return true;
+}
+
+// Writes the children of the node and returns the word of the node itself
+static bool dag_node(OctreeDAG *dag, OctreeNode *node, unsigned int *word)
+{
+    if (node->data & LEAF_BIT_MASK)
+    {
+        *word = node->data & (LEAF_BIT_MASK | COLOR_BIT_MASK);
+        return true;
+    }
+
+    unsigned int child_mask = node->data & CHILD_MASK;
+    if (!child_mask)
+    {
+        *word = 0;
+        return true;
+    }
+
+    unsigned int words[8];
+    unsigned int count = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        if (child_mask & (1 << i))
+        {
+            if (!dag_node(dag, &node->children[i], &words[count++]))
+                return false;
+        }
+    }
+
+    unsigned int first_child;
+    if (!dag_find_or_add(dag, words, count, &first_child))
+        return false;
+
+    *word = child_mask | first_child << FIRST_CHILD_BIT_SHIFT;
+
+    return true;
+}
+
+static bool add_to_dag(OctreeDAG *dag, OctreeNode *root, unsigned int *root_index)
+{
+    unsigned int word;
+    if (!dag_node(dag, root, &word) || !dag_find_or_add(dag, &word, 1, root_index))
+        return false;
+
+    dag->tree_nodes += root->size;
+
+    return true;
+}
+
+static bool AddToDAG(OctreeDAG *dag, Octree *octree, unsigned int *root)
+{
+    if (!dag || !octree || !octree->root)
+        return false;
+
+    return add_to_dag(dag, octree->root, root);
+}
+
+static void DeleteDAG(OctreeDAG *dag)
+{
+    if (!dag)
+        return;
+
+    free(dag->nodes);
+    free(dag->slots);
+    memset(dag, 0, sizeof(OctreeDAG));
+}
+
+static void LinearizeOctree(OctreeNode *root, OctreeFormat format, unsigned int **array, unsigned int *size)
+{
+    *array = NULL;
+    *size = 0;
+
+    if (root == NULL)
+    {
+        puts("[INFO] No root provided.");
+        return;
+    }
+
+    switch (format)
+    {
+    case OCTREE_FORMAT_CHILDREN_SIZE:
+        // Subtree sizes are stored in 16 bits
+        if (root->size > 0xFFFF)
+        {
+            fprintf(stderr, "[ERROR] Octree with %u nodes is too big for the children size format.\n", root->size);
+            return;
+        }
+
+        linearize_children_size(root, array, size);
+        break;
+    case OCTREE_FORMAT_CHILD_OFFSET:
+    case OCTREE_FORMAT_BRICKS:
+    {
+        unsigned int capacity = root->size + (root->size + 1) / 2;
+        *array = malloc(capacity * sizeof(unsigned int));
+        if (!*array)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for linearized octree.\n");
+
+        // The root doesn't know the depth of its tree, bricks go where they are in a tree from Init
+        int bricks = format == OCTREE_FORMAT_BRICKS ? brick_level(OCTREE_DEPTH) : -1;
+        unsigned int attributes_size;
+        *size = pack_tree(root, bricks, -1, NULL, array, &capacity, &attributes_size);
+        break;
+    }
+    case OCTREE_FORMAT_DAG:
+    {
+        OctreeDAG dag = {0};
+        unsigned int root_index;
+        if (!add_to_dag(&dag, root, &root_index))
+        {
+            fprintf(stderr, "[ERROR] Octree is too big for the dag format.\n");
+            DeleteDAG(&dag);
+            return;
+        }
+
+        // A new dag ends with the root
+        *array = dag.nodes;
+        *size = root_index + 1;
+        free(dag.slots);
+        break;
+    }
+    default:
+        fprintf(stderr, "[ERROR] Unknown octree format %d.\n", format);
+        break;
+    }
+}
+
+static unsigned int Get(Octree *octree, unsigned int x, unsigned int y, unsigned int z)
+{
+    unsigned int octree_size = 1U << octree->depth;
+    if (x >= octree_size || y >= octree_size || z >= octree_size)
+        return 0;
+
+    OctreeNode *node = octree->root;
+    for (unsigned char current_depth = 0; current_depth < octree->depth; current_depth++)
+    {
+        if (node->data & LEAF_BIT_MASK)
+            return node->data;
+
+        unsigned int bit = octree->depth - 1 - current_depth;
+        unsigned int child_index = ((x >> bit) & 1) | (((y >> bit) & 1) << 1) | (((z >> bit) & 1) << 2);
+        if (!(node->data & (1 << child_index)))
+            return 0;
+
+        node = &node->children[child_index];
+    }
+
+    return node->data & LEAF_BIT_MASK ? node->data : 0;
+}
+
+static void for_each_leaf(OctreeNode *node, unsigned int x, unsigned int y, unsigned int z, unsigned int side, OctreeLeafCallback callback, void *user_data)
+{
+    if (node->data & LEAF_BIT_MASK)
+    {
+        callback(user_data, x, y, z, side, node->data);
+        return;
+    }
+
+    unsigned int half = side >> 1;
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        if (!(node->data & (1 << i)))
+            continue;
+
+        for_each_leaf(&node->children[i], x + (i & 1) * half, y + ((i >> 1) & 1) * half, z + ((i >> 2) & 1) * half, half, callback, user_data);
+    }
+}
+
+static void ForEachLeaf(Octree *octree, OctreeLeafCallback callback, void *user_data)
+{
+    if (!octree || !octree->root || !callback)
+        return;
+
+    for_each_leaf(octree->root, 0, 0, 0, 1U << octree->depth, callback, user_data);
+}
+
+static unsigned int ChildIndex(const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned int index, unsigned int child_index)
+{
+    unsigned int node = nodes[index];
+
+    if (format == OCTREE_FORMAT_CHILDREN_SIZE)
+    {
+        // Skip the subtrees of all existing children before this one
+        unsigned int offset = 1;
+        for (unsigned int i = 0; i < child_index; i++)
+        {
+            if (node & (1 << i))
+            {
+                unsigned int sibling = nodes[index + offset];
+                offset += sibling & LEAF_BIT_MASK ? 1 : (sibling & CHILDREN_SIZE_BIT_MASK) >> 8;
+            }
+        }
+
+        return index + offset;
+    }
+
+    // Children are shared with other nodes, the node stores where they are
+    if (format == OCTREE_FORMAT_DAG)
+        return ((node >> FIRST_CHILD_BIT_SHIFT) & DAG_CHILD_MAX) + POPCOUNT(node & CHILD_MASK & ((1 << child_index) - 1));
+
+    // Children are next to each other, skip the ones before this child
+    unsigned int offset = (node >> FIRST_CHILD_BIT_SHIFT) & FIRST_CHILD_MAX;
+    if (node & FAR_BIT_MASK)
+        offset = nodes[size - 1 - offset];
+
+    unsigned int first_child = index + offset;
+    return first_child + POPCOUNT(node & CHILD_MASK & ((1 << child_index) - 1));
+}
+
+// Trees start with their root, dags end with it
+static unsigned int root_index(unsigned int size, OctreeFormat format)
+{
+    return format == OCTREE_FORMAT_DAG ? size - 1 : 0;
+}
+
+// Only packed layouts store node attributes, see PackedOctree
+static bool has_attributes(OctreeFormat format)
+{
+    return format == OCTREE_FORMAT_CHILD_OFFSET || format == OCTREE_FORMAT_BRICKS;
+}
+
+// Level of the internal nodes that are bricks in the array, -1 if it has none
+static int array_brick_level(OctreeFormat format, unsigned char depth)
+{
+    return format == OCTREE_FORMAT_BRICKS ? brick_level(depth) : -1;
+}
+
+// Brick of the brick node at index, see PackedOctree
+static const unsigned int *node_brick(const unsigned int *nodes, unsigned int size, unsigned int index)
+{
+    unsigned int node = nodes[index];
+    unsigned int offset = (node >> FIRST_CHILD_BIT_SHIFT) & FIRST_CHILD_MAX;
+    if (node & FAR_BIT_MASK)
+        offset = nodes[size - 1 - offset];
+
+    return &nodes[index + offset];
+}
+
+/**
+ * Leaf word of the voxel x, y, z of the brick, only the lowest two bits of the coordinates are used. Returns 0
+ * if the voxel is empty and sets cell_size to the side of the empty cell around it. With lod the 2x2x2 cells
+ * of the brick are drawn like nodes where the lod stops, solid if at least half full with their first voxel's color
+ */
+static unsigned int brick_lookup(const unsigned int *brick, unsigned int x, unsigned int y, unsigned int z, bool lod, int *cell_size)
+{
+    uint64_t occupancy = brick[0] | (uint64_t)brick[1] << 32;
+    unsigned int octant = ((x >> 1) & 1) | ((y >> 1) & 1) << 1 | ((z >> 1) & 1) << 2;
+    unsigned int octant_bits = (unsigned int)(occupancy >> (octant * 8)) & CHILD_MASK;
+
+    unsigned int bit;
+    if (lod)
+    {
+        if (POPCOUNT(octant_bits) < 4)
+        {
+            *cell_size = 2;
+            return 0;
+        }
+
+        bit = octant * 8 + CTZ(octant_bits);
+    }
+    else
+    {
+        bit = octant * 8 + ((x & 1) | (y & 1) << 1 | (z & 1) << 2);
+        if (!((occupancy >> bit) & 1))
+        {
+            *cell_size = octant_bits ? 1 : 2;
+            return 0;
+        }
+    }
+
+    unsigned int color_index = POPCOUNT64(occupancy & (((uint64_t)1 << bit) - 1));
+    unsigned int color = (brick[2 + color_index / 4] >> (color_index % 4 * 8)) & OCTREE_LOD_COLOR_MASK;
+    return LEAF_BIT_MASK | color << COLOR_BIT_SHIFT;
+}
+
+static unsigned int Lookup(const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned char depth, unsigned int x, unsigned int y, unsigned int z)
+{
+    if (!nodes || format == OCTREE_FORMAT_NONE)
+        return 0;
+
+    int bricks = array_brick_level(format, depth);
+    unsigned int index = root_index(size, format);
+    for (unsigned char current_depth = 0; current_depth < depth; current_depth++)
+    {
+        unsigned int node = nodes[index];
+        if (node & LEAF_BIT_MASK)
+            return node;
+
+        if (current_depth == bricks)
+        {
+            int cell_size;
+            return brick_lookup(node_brick(nodes, size, index), x, y, z, false, &cell_size);
+        }
+
+        unsigned int bit = depth - 1 - current_depth;
+        unsigned int child_index = ((x >> bit) & 1) | (((y >> bit) & 1) << 1) | (((z >> bit) & 1) << 2);
+        if (!(node & (1 << child_index)))
+            return 0;
+
+        index = ChildIndex(nodes, size, format, index, child_index);
+    }
+
+    return nodes[index] & LEAF_BIT_MASK ? nodes[index] : 0;
+}
+
+static unsigned int NodeAttributes(const unsigned int *nodes, unsigned int size, unsigned int index)
+{
+    return (nodes[size + index / 2] >> (index % 2 * 16)) & 0xFFFF;
+}
+
+// Distance in cells from the cell to the closest cell with voxels
+static unsigned int field_distance(const unsigned int *field, unsigned char field_depth, unsigned int x, unsigned int y, unsigned int z)
+{
+    unsigned int index = (z << field_depth | y) << field_depth | x;
+    return (field[index / 4] >> (index % 4 * 8)) & 0xFF;
+}
+
+// Octree a ray is cast through, see RaycastField
+typedef struct OctreeTraversal OctreeTraversal;
+struct OctreeTraversal
+{
+    const unsigned int *nodes;
+    unsigned int size;
+    OctreeFormat format;
+    unsigned char depth;
+    unsigned char lod_depth;
+    int bricks; // Level of the brick nodes, -1 if there are none
+    const unsigned int *field;
+    unsigned char field_depth;
+};
+
+// Ray walking the voxels of the octree
+typedef struct OctreeRay OctreeRay;
+struct OctreeRay
+{
+    DDAWalk walk;
+    float t_max;
+    int face_axis; // Axis of the face the ray entered the current voxel through
+};
+
+static bool traversal_begin(OctreeTraversal *traversal, const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned char depth,
+                            unsigned char lod_depth, const unsigned int *field, unsigned char field_depth)
+{
+    if (!nodes || format == OCTREE_FORMAT_NONE)
+        return false;
+
+    if (field_depth > depth)
+        field = NULL;
+
+    if (!has_attributes(format) || lod_depth > depth)
+        lod_depth = depth;
+
+    traversal->nodes = nodes;
+    traversal->size = size;
+    traversal->format = format;
+    traversal->depth = depth;
+    traversal->lod_depth = lod_depth;
+    traversal->bricks = array_brick_level(format, depth);
+    traversal->field = field;
+    traversal->field_depth = field_depth;
+
+    return true;
+}
+
+// Clips the ray to the octree bounds and puts it in its first voxel, returns false if it misses the octree
+static bool ray_begin(OctreeRay *ray, unsigned char depth, const float origin[3], const float direction[3], float t_min, float t_max)
+{
+    int octree_size = 1 << depth;
+    int entry_axis = -1;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (direction[axis] == 0.0f)
+        {
+            if (origin[axis] < 0.0f || origin[axis] >= octree_size)
+                return false;
+
+            continue;
+        }
+
+        float inverse = 1.0f / direction[axis];
+        float t_near = (0.0f - origin[axis]) * inverse;
+        float t_far = (octree_size - origin[axis]) * inverse;
+        if (t_near > t_far)
+        {
+            float temp = t_near;
+            t_near = t_far;
+            t_far = temp;
+        }
+
+        if (t_near >= t_min)
+        {
+            t_min = t_near;
+            entry_axis = axis;
+        }
+
+        if (t_far < t_max)
+            t_max = t_far;
+    }
+
+    if (t_min > t_max)
+        return false;
+
+    // Voxel the ray starts in, the entry axis is set exactly so float errors can't put it outside
+    ray->walk = dda_begin(origin, direction, t_min, 1.0f);
+    const int octree_min[3] = {0, 0, 0};
+    const int octree_max[3] = {octree_size - 1, octree_size - 1, octree_size - 1};
+    dda_enter_box(&ray->walk, origin, 1.0f, octree_min, octree_max, entry_axis);
+    ray->t_max = t_max;
+
+    ray->face_axis = entry_axis;
+    if (entry_axis < 0)
+    {
+        // The ray starts inside the octree, use the axis it moves along the most
+        ray->face_axis = 0;
+        for (int axis = 1; axis < 3; axis++)
+        {
+            if (fabsf(direction[axis]) > fabsf(direction[ray->face_axis]))
+                ray->face_axis = axis;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Descends from the node at index on level to the deepest node containing the voxel. Returns a leaf word if the
+ * voxel is filled, otherwise sets cell_size to the side of the empty cell around it
+ */
+static unsigned int descend(const OctreeTraversal *traversal, const int voxel[3], unsigned int index, unsigned char level, int *cell_size)
+{
+    const unsigned int *nodes = traversal->nodes;
+    unsigned char depth = traversal->depth;
+
+    unsigned int node = nodes[index];
+    *cell_size = 1;
+    while (level < depth && !(node & LEAF_BIT_MASK))
+    {
+        if (level >= traversal->lod_depth)
+        {
+            // Too far for more detail, the node is either a solid cube or empty space
+            unsigned int attributes = NodeAttributes(nodes, traversal->size, index);
+            if (attributes >> OCTREE_LOD_COVERAGE_SHIFT >= OCTREE_LOD_SOLID)
+                node = LEAF_BIT_MASK | (attributes & OCTREE_LOD_COLOR_MASK) << COLOR_BIT_SHIFT;
+            else
+                *cell_size = 1 << (depth - level);
+
+            break;
+        }
+
+        if (level == traversal->bricks)
+        {
+            // The last levels are one read of the brick instead of a node each
+            node = brick_lookup(node_brick(nodes, traversal->size, index), voxel[0], voxel[1], voxel[2], traversal->lod_depth < depth, cell_size);
+            break;
+        }
+
+        unsigned int bit = depth - 1 - level;
+        unsigned int child_index = ((voxel[0] >> bit) & 1) | (((voxel[1] >> bit) & 1) << 1) | (((voxel[2] >> bit) & 1) << 2);
+        if (!(node & (1 << child_index)))
+        {
+            *cell_size = 1 << bit;
+            break;
+        }
+
+        index = ChildIndex(nodes, traversal->size, traversal->format, index, child_index);
+        node = nodes[index];
+        level++;
+    }
+
+    return node;
+}
+
+static void ray_hit(const OctreeRay *ray, const float direction[3], unsigned int node, OctreeHit *hit)
+{
+    if (!hit)
+        return;
+
+    hit->node = node;
+    memcpy(hit->voxel, ray->walk.cell, sizeof(hit->voxel));
+    hit->distance = ray->walk.t;
+    hit->face = (VoxelFace)(ray->face_axis * 2 + (direction[ray->face_axis] > 0.0f ? 0 : 1));
+}
+
+// Steps over the empty cell of cell_size the ray is in, returns false if that leaves the octree or passes t_max
+static bool ray_leave_cell(const OctreeTraversal *traversal, OctreeRay *ray, const float origin[3], const float direction[3], int cell_size)
+{
+    const int *voxel = ray->walk.cell;
+    unsigned char depth = traversal->depth;
+
+    int box_min[3];
+    int box_max[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        box_min[axis] = voxel[axis] & ~(cell_size - 1);
+        box_max[axis] = box_min[axis] + cell_size - 1;
+    }
+
+    if (traversal->field)
+    {
+        // Every cell closer than the distance is empty, step over all of them if that's further than the octree cell
+        unsigned char field_depth = traversal->field_depth;
+        int field_shift = depth - field_depth;
+        int cell[3] = {voxel[0] >> field_shift, voxel[1] >> field_shift, voxel[2] >> field_shift};
+        int radius = (int)field_distance(traversal->field, field_depth, cell[0], cell[1], cell[2]) - 1;
+        if (radius >= 0 && (2 * radius + 1) << field_shift > cell_size)
+        {
+            int field_size = 1 << field_depth;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                int first = cell[axis] - radius < 0 ? 0 : cell[axis] - radius;
+                int last = cell[axis] + radius >= field_size ? field_size - 1 : cell[axis] + radius;
+                box_min[axis] = first << field_shift;
+                box_max[axis] = ((last + 1) << field_shift) - 1;
+            }
+        }
+    }
+
+    dda_leave_box(&ray->walk, origin, direction, box_min, box_max);
+    if (ray->walk.t > ray->t_max)
+        return false;
+
+    if (voxel[ray->walk.axis] < 0 || voxel[ray->walk.axis] >= 1 << depth)
+        return false;
+
+    ray->face_axis = ray->walk.axis;
+    return true;
+}
+
+static bool RaycastField(const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned char depth, unsigned char lod_depth,
+                         const unsigned int *field, unsigned char field_depth,
+                         const float origin[3], const float direction[3], float t_min, float t_max, OctreeHit *hit, unsigned int *steps)
+{
+    if (steps)
+        *steps = 0;
+
+    OctreeTraversal traversal;
+    if (!traversal_begin(&traversal, nodes, size, format, depth, lod_depth, field, field_depth))
+        return false;
+
+    OctreeRay ray;
+    if (!ray_begin(&ray, depth, origin, direction, t_min, t_max))
+        return false;
+
+    unsigned int root = root_index(size, format);
+    while (true)
+    {
+        if (steps)
+            (*steps)++;
+
+        int cell_size;
+        unsigned int node = descend(&traversal, ray.walk.cell, root, 0, &cell_size);
+        if (node & LEAF_BIT_MASK)
+        {
+            ray_hit(&ray, direction, node, hit);
+            return true;
+        }
+
+        if (!ray_leave_cell(&traversal, &ray, origin, direction, cell_size))
+            return false;
+    }
+}
+
+/**
+ * Descends the nodes of the lanes' voxels, the lanes share the node reads while their voxels are in the same child.
+ * From the level where they split, or where lod or bricks stop the walk down, every lane finishes on its own
+ */
+static void descend_packet(const OctreeTraversal *traversal, const OctreeRay rays[OCTREE_PACKET_SIZE], unsigned int lanes,
+                           unsigned int nodes_found[OCTREE_PACKET_SIZE], int cell_sizes[OCTREE_PACKET_SIZE])
+{
+    const unsigned int *nodes = traversal->nodes;
+    unsigned char depth = traversal->depth;
+    const int *first_voxel = rays[CTZ(lanes)].walk.cell;
+
+    unsigned int index = root_index(traversal->size, traversal->format);
+    unsigned char level = 0;
+    while (level < depth && level < traversal->lod_depth && level != traversal->bricks)
+    {
+        unsigned int node = nodes[index];
+        if (node & LEAF_BIT_MASK)
+            break;
+
+        unsigned int bit = depth - 1 - level;
+        unsigned int child_index = ((first_voxel[0] >> bit) & 1) | (((first_voxel[1] >> bit) & 1) << 1) | (((first_voxel[2] >> bit) & 1) << 2);
+
+        bool together = true;
+        for (unsigned int lane = 0; lane < OCTREE_PACKET_SIZE; lane++)
+        {
+            if (!(lanes & (1U << lane)))
+                continue;
+
+            const int *voxel = rays[lane].walk.cell;
+            if ((((voxel[0] >> bit) & 1) | (((voxel[1] >> bit) & 1) << 1) | (((voxel[2] >> bit) & 1) << 2)) != child_index)
+                together = false;
+        }
+
+        if (!together)
+            break;
+
+        if (!(node & (1 << child_index)))
+        {
+            // The child all lanes are in is empty
+            for (unsigned int lane = 0; lane < OCTREE_PACKET_SIZE; lane++)
+            {
+                nodes_found[lane] = 0;
+                cell_sizes[lane] = 1 << bit;
+            }
+
+            return;
+        }
+
+        index = ChildIndex(nodes, traversal->size, traversal->format, index, child_index);
+        level++;
+    }
+
+    for (unsigned int lane = 0; lane < OCTREE_PACKET_SIZE; lane++)
+    {
+        if (lanes & (1U << lane))
+            nodes_found[lane] = descend(traversal, rays[lane].walk.cell, index, level, &cell_sizes[lane]);
+    }
+}
+
+static unsigned int RaycastPacket(const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned char depth, unsigned char lod_depth,
+                                  const unsigned int *field, unsigned char field_depth, const float origin[3],
+                                  const float directions[OCTREE_PACKET_SIZE][3], const float t_min[OCTREE_PACKET_SIZE], const float t_max[OCTREE_PACKET_SIZE],
+                                  unsigned int lanes, OctreeHit hits[OCTREE_PACKET_SIZE], unsigned int steps[OCTREE_PACKET_SIZE])
+{
+    for (unsigned int lane = 0; steps && lane < OCTREE_PACKET_SIZE; lane++)
+    {
+        if (lanes & (1U << lane))
+            steps[lane] = 0;
+    }
+
+    OctreeTraversal traversal;
+    if (!traversal_begin(&traversal, nodes, size, format, depth, lod_depth, field, field_depth))
+        return 0;
+
+    OctreeRay rays[OCTREE_PACKET_SIZE];
+    unsigned int active = 0;
+    for (unsigned int lane = 0; lane < OCTREE_PACKET_SIZE; lane++)
+    {
+        if ((lanes & (1U << lane)) && ray_begin(&rays[lane], depth, origin, directions[lane], t_min[lane], t_max[lane]))
+            active |= 1U << lane;
+    }
+
+    // Every lane takes one step per iteration, lanes leave the packet when they hit or leave the octree
+    unsigned int hit_lanes = 0;
+    while (active)
+    {
+        unsigned int nodes_found[OCTREE_PACKET_SIZE];
+        int cell_sizes[OCTREE_PACKET_SIZE];
+        descend_packet(&traversal, rays, active, nodes_found, cell_sizes);
+
+        for (unsigned int lane = 0; lane < OCTREE_PACKET_SIZE; lane++)
+        {
+            if (!(active & (1U << lane)))
+                continue;
+
+            if (steps)
+                steps[lane]++;
+
+            if (nodes_found[lane] & LEAF_BIT_MASK)
+            {
+                ray_hit(&rays[lane], directions[lane], nodes_found[lane], hits ? &hits[lane] : NULL);
+                hit_lanes |= 1U << lane;
+                active &= ~(1U << lane);
+            }
+            else if (!ray_leave_cell(&traversal, &rays[lane], origin, directions[lane], cell_sizes[lane]))
+            {
+                active &= ~(1U << lane);
+            }
+        }
+    }
+
+    return hit_lanes;
+}
+
+static bool RaycastLOD(const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned char depth, unsigned char lod_depth,
+                       const float origin[3], const float direction[3], float t_min, float t_max, OctreeHit *hit)
+{
+    return RaycastField(nodes, size, format, depth, lod_depth, NULL, 0, origin, direction, t_min, t_max, hit, NULL);
+}
+
+static bool Raycast(const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned char depth,
+                    const float origin[3], const float direction[3], float t_min, float t_max, OctreeHit *hit)
+{
+    return RaycastField(nodes, size, format, depth, depth, NULL, 0, origin, direction, t_min, t_max, hit, NULL);
+}
+
+typedef struct FieldContext FieldContext;
+struct FieldContext
+{
+    unsigned char *cells; // Distance of every cell, 0 where the cell has voxels
+    unsigned char field_depth;
+    unsigned char cell_shift; // Voxels on each side of a cell as a power of two
+};
+
+// Marks every cell the leaf touches as filled
+static void field_add_leaf(void *user_data, unsigned int x, unsigned int y, unsigned int z, unsigned int side, unsigned int data)
+{
+    FieldContext *context = user_data;
+    unsigned int first[3] = {x >> context->cell_shift, y >> context->cell_shift, z >> context->cell_shift};
+    unsigned int last[3] = {(x + side - 1) >> context->cell_shift, (y + side - 1) >> context->cell_shift, (z + side - 1) >> context->cell_shift};
+
+    for (unsigned int cell_z = first[2]; cell_z <= last[2]; cell_z++)
+    {
+        for (unsigned int cell_y = first[1]; cell_y <= last[1]; cell_y++)
+        {
+            unsigned int row = (cell_z << context->field_depth | cell_y) << context->field_depth;
+            memset(&context->cells[row + first[0]], 0, last[0] - first[0] + 1);
+        }
+    }
+}
+
+/**
+ * One pass of the distance transform along the lines of count cells stride apart, every cell gets the
+ * smallest max of the distance along the line and the distance another cell of the line already has
+ */
+static void field_pass(unsigned char *cells, unsigned char *line, unsigned int count, unsigned int stride)
+{
+    for (unsigned int i = 0; i < count; i++)
+        line[i] = cells[i * stride];
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        // Look at cells further away until they can't be closer than the best one
+        unsigned int best = line[i];
+        for (unsigned int offset = 1; offset < best; offset++)
+        {
+            if (i >= offset && line[i - offset] < best)
+                best = line[i - offset] > offset ? line[i - offset] : offset;
+            if (i + offset < count && line[i + offset] < best)
+                best = line[i + offset] > offset ? line[i + offset] : offset;
+        }
+
+        cells[i * stride] = (unsigned char)best;
+    }
+}
+
+static void BuildDistanceField(Octree *octree, unsigned char field_depth, unsigned int *field)
+{
+    if (!octree || !field || field_depth == 0 || field_depth > octree->depth || field_depth > OCTREE_FIELD_MAX_DEPTH)
+    {
+        fprintf(stderr, "[ERROR] Distance field with %u levels doesn't fit the octree.\n", field_depth);
+        return;
+    }
+
+    unsigned int field_size = 1U << field_depth;
+    unsigned int cells_count = field_size * field_size * field_size;
+    unsigned char *cells = malloc(cells_count + field_size);
+    if (!cells)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for octree distance field.\n");
+
+    // Cells without voxels start further away than any cell can be
+    memset(cells, field_size, cells_count);
+    FieldContext context = {cells, field_depth, octree->depth - field_depth};
+    ForEachLeaf(octree, field_add_leaf, &context);
+
+    // Chebyshev distance is separable, one pass along each axis
+    unsigned char *line = cells + cells_count;
+    for (unsigned int i = 0; i < field_size * field_size; i++)
+        field_pass(&cells[i * field_size], line, field_size, 1);
+
+    for (unsigned int z = 0; z < field_size; z++)
+    {
+        for (unsigned int x = 0; x < field_size; x++)
+            field_pass(&cells[z * field_size * field_size + x], line, field_size, field_size);
+    }
+
+    for (unsigned int i = 0; i < field_size * field_size; i++)
+        field_pass(&cells[i], line, field_size, field_size * field_size);
+
+    for (unsigned int i = 0; i < cells_count / 4; i++)
+        field[i] = cells[4 * i] | cells[4 * i + 1] << 8 | cells[4 * i + 2] << 16 | (unsigned int)cells[4 * i + 3] << 24;
+
+    free(cells);
+}
+
+#define VALIDATE_NO_NODE UINT32_MAX // The pointer node is inside a brick, it has no packed node
+
+/**
+ * Counts the voxels of the pointer subtree and checks them against the attributes of the packed node at index,
+ * bricks are checked for the voxel count of their node. Level is the level of the node and bricks of the brick nodes
+ */
+static bool validate_lod_node(OctreeNode *node, PackedOctree *packed, unsigned int index, int level, int bricks,
+                              unsigned long long volume, unsigned long long *voxels, unsigned int *color)
+{
+    bool is_leaf = node->data & LEAF_BIT_MASK;
+
+    if (is_leaf)
+    {
+        *voxels = volume;
+        *color = (node->data & COLOR_BIT_MASK) >> COLOR_BIT_SHIFT;
+    }
+    else
+    {
+        unsigned long long most_voxels = 0;
+        *voxels = 0;
+        *color = 0;
+
+        for (unsigned int i = 0; i < 8; i++)
+        {
+            if (!(node->data & (1 << i)))
+                continue;
+
+            unsigned long long child_voxels;
+            unsigned int child_color;
+            unsigned int child = VALIDATE_NO_NODE;
+            if (index != VALIDATE_NO_NODE && level != bricks)
+                child = ChildIndex(packed->nodes, packed->size, packed->format, index, i);
+
+            if (!validate_lod_node(&node->children[i], packed, child, level + 1, bricks, volume / 8, &child_voxels, &child_color))
+                return false;
+
+            if (child_voxels > most_voxels)
+            {
+                most_voxels = child_voxels;
+                *color = child_color;
+            }
+
+            *voxels += child_voxels;
+        }
+    }
+
+    if (index == VALIDATE_NO_NODE)
+        return true;
+
+    if (level == bricks && !is_leaf)
+    {
+        const unsigned int *brick = node_brick(packed->nodes, packed->size, index);
+        unsigned int brick_voxels = POPCOUNT64(brick[0] | (uint64_t)brick[1] << 32);
+        if (brick_voxels != *voxels)
+            ERROR_RETURN(false, "[ERROR] Packed octree brick of node %u has %u voxels, expected %llu.\n", index, brick_voxels, *voxels);
+    }
+
+    unsigned int attributes = NodeAttributes(packed->nodes, packed->size, index);
+    unsigned int coverage = (unsigned int)((*voxels * 255 + volume / 2) / volume);
+    if (attributes >> OCTREE_LOD_COVERAGE_SHIFT != coverage || (attributes & OCTREE_LOD_COLOR_MASK) != *color)
+        ERROR_RETURN(false, "[ERROR] Packed octree node %u has coverage %u color %u, expected coverage %u color %u.\n",
+                     index, attributes >> OCTREE_LOD_COVERAGE_SHIFT, attributes & OCTREE_LOD_COLOR_MASK, coverage, *color);
+
+    return true;
+}
+
+// Whether the voxel is drawn when the traversal stops at lod_depth
+static bool lod_solid(PackedOctree *packed, unsigned char depth, unsigned char lod_depth, unsigned int x, unsigned int y, unsigned int z)
+{
+    unsigned int index = 0;
+    for (unsigned char level = 0; level < depth; level++)
+    {
+        unsigned int node = packed->nodes[index];
+        if (node & LEAF_BIT_MASK)
+            return true;
+
+        if (level >= lod_depth)
+            return NodeAttributes(packed->nodes, packed->size, index) >> OCTREE_LOD_COVERAGE_SHIFT >= OCTREE_LOD_SOLID;
+
+        if (level == array_brick_level(packed->format, depth))
+        {
+            int cell_size;
+            return brick_lookup(node_brick(packed->nodes, packed->size, index), x, y, z, lod_depth < depth, &cell_size) != 0;
+        }
+
+        unsigned int bit = depth - 1 - level;
+        unsigned int child_index = ((x >> bit) & 1) | (((y >> bit) & 1) << 1) | (((z >> bit) & 1) << 2);
+        if (!(node & (1 << child_index)))
+            return false;
+
+        index = ChildIndex(packed->nodes, packed->size, packed->format, index, child_index);
+    }
+
+    return packed->nodes[index] & LEAF_BIT_MASK;
+}
+
+static bool ValidateLOD(Octree *octree, PackedOctree *packed)
+{
+    if (!octree || !packed || !packed->is_valid)
+        ERROR_RETURN(false, "[ERROR] Octree has to be packed before validating its lod.\n");
+
+    // Bricks replace the nodes of the last levels, so they have fewer attributes than the pointer tree has nodes
+    unsigned int attributes_size = (octree->root->size + 1) / 2;
+    bool is_bricks = packed->format == OCTREE_FORMAT_BRICKS;
+    if ((is_bricks ? packed->attributes_size > attributes_size : packed->attributes_size != attributes_size) ||
+        packed->size + packed->attributes_size > packed->capacity)
+        ERROR_RETURN(false, "[ERROR] Packed octree has %u attribute elements for %u nodes.\n", packed->attributes_size, octree->root->size);
+
+    unsigned int octree_size = 1U << octree->depth;
+    unsigned long long voxels;
+    unsigned int color;
+    if (!validate_lod_node(octree->root, packed, 0, 0, array_brick_level(packed->format, octree->depth),
+                           (unsigned long long)octree_size * octree_size * octree_size, &voxels, &color))
+        return false;
+
+    // Every voxel of the packed octree has to be the leaf of the pointer tree
+    unsigned int row_step = octree_size > 64 ? octree_size / 64 : 1;
+    for (unsigned int z = 0; z < octree_size; z += row_step)
+    {
+        for (unsigned int y = 0; y < octree_size; y += row_step)
+        {
+            for (unsigned int x = 0; x < octree_size; x++)
+            {
+                unsigned int expected = Get(octree, x, y, z) & (LEAF_BIT_MASK | COLOR_BIT_MASK);
+                unsigned int packed_voxel = Lookup(packed->nodes, packed->size, packed->format, octree->depth, x, y, z);
+                if (packed_voxel != expected)
+                    ERROR_RETURN(false, "[ERROR] Packed voxel %u %u %u is %08X, expected %08X.\n", x, y, z, packed_voxel, expected);
+            }
+        }
+    }
+
+    // Rays along x at every lod level have to stop at the first voxel the lookup says is solid
+    float direction[3] = {1.0f, 0.0f, 0.0f};
+    for (unsigned char lod_depth = 0; lod_depth <= octree->depth; lod_depth++)
+    {
+        for (unsigned int z = 0; z < octree_size; z += row_step)
+        {
+            for (unsigned int y = 0; y < octree_size; y += row_step)
+            {
+                int expected = -1;
+                for (unsigned int x = 0; x < octree_size && expected < 0; x++)
+                {
+                    if (lod_solid(packed, octree->depth, lod_depth, x, y, z))
+                        expected = x;
+                }
+
+                float origin[3] = {-1.0f, y + 0.5f, z + 0.5f};
+                OctreeHit hit;
+                bool is_hit = RaycastLOD(packed->nodes, packed->size, packed->format, octree->depth, lod_depth, origin, direction, 0.0f, INFINITY, &hit);
+                if (is_hit != (expected >= 0) || (is_hit && hit.voxel[0] != expected))
+                    ERROR_RETURN(false, "[ERROR] Lod %u ray at y %u z %u hit x %d, expected %d.\n", lod_depth, y, z, is_hit ? hit.voxel[0] : -1, expected);
+            }
+        }
+    }
+
+    return true;
 }
 
 extern struct AOctree AOctree;
 struct AOctree AOctree =
     {
         .Init = Init,
+        .InitDepth = InitDepth,
+        .Delete = Delete,
         .print_binary = print_binary,
         .Add = Add,
+        .AddBatch = AddBatch,
+        .Remove = Remove,
+        .FillRegion = FillRegion,
+        .ClearRegion = ClearRegion,
+        .RegionOverlap = RegionOverlap,
+        .Compact = Compact,
         .VisualizeOctree = VisualizeOctree,
-        .LinearizeOctree = LinearizeOctree};
\ No newline at end of file
+        .LinearizeOctree = LinearizeOctree,
+        .Pack = Pack,
+        .PackParallel = PackParallel,
+        .AddToDAG = AddToDAG,
+        .DeleteDAG = DeleteDAG,
+        .Lookup = Lookup,
+        .ChildIndex = ChildIndex,
+        .Raycast = Raycast,
+        .RaycastLOD = RaycastLOD,
+        .RaycastField = RaycastField,
+        .RaycastPacket = RaycastPacket,
+        .BuildDistanceField = BuildDistanceField,
+        .NodeAttributes = NodeAttributes,
+        .ValidateLOD = ValidateLOD,
+        .Get = Get,
+        .ForEachLeaf = ForEachLeaf,
+        .GetPoolStats = GetPoolStats};
\ No newline at end of file
@@ -12,11 +12,218 @@
 #ifndef OCTREE_H
 #define OCTREE_H
 
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "../../../threading/threads_manager.h"
+
+#define OCTREE_MAX_DEPTH 8 // 256 voxels on each side, voxel coordinates are stored in a byte
+
+// Node attributes of the packed octree, see PackedOctree
+#define OCTREE_LOD_COLOR_MASK 0xFF
+#define OCTREE_LOD_COVERAGE_SHIFT 8
+#define OCTREE_LOD_SOLID 128 // Nodes at least half full are drawn as a solid cube when the lod stops at them
+
+#define OCTREE_BRICK_DEPTH 2 // Levels stored in a brick, 4 voxels on each side, see OCTREE_FORMAT_BRICKS
+
+#define OCTREE_PACKET_SIZE 4 // Rays of a packet ray cast, see RaycastPacket
+
+/**
+ * Empty space distance field, the octree is split into 2^field_depth cells on each side and every cell stores the
+ * Chebyshev distance in cells to the closest cell with voxels, 0 if it has voxels itself and 2^field_depth if the octree
+ * is empty. Distances are bytes, cell (x, y, z) is byte index % 4 of element index / 4 with index ((z << field_depth | y) << field_depth | x)
+ */
+#define OCTREE_FIELD_MAX_DEPTH 7
+#define OCTREE_FIELD_SIZE(field_depth) ((1U << (3 * (field_depth))) / 4) // Elements of a distance field
+
 typedef struct OctreeNode OctreeNode;
+// A leaf above the last level is a cube of voxels with the same color
 struct OctreeNode
 {
     unsigned int data; // Holds in the first bit if its leaf or not, then the rest is for voxel data
-    struct OctreeNode **children;
+    unsigned int size; // Amount of nodes in the subtree including this one, uses the padding before children
+    struct OctreeNode *children; // Group of 8 siblings from the octree pool, only the ones with their bit set in data exist
+};
+
+/**
+ * Versions of the linearized octree, the version is stored with every chunk so older data can still be read.
+ * Values are shared with the shader.
+ */
+typedef enum OctreeFormat OctreeFormat;
+enum OctreeFormat
+{
+    OCTREE_FORMAT_NONE,          // No data
+    OCTREE_FORMAT_CHILDREN_SIZE, // Depth first, nodes store the size of their subtree, children are found by adding up sibling sizes
+    OCTREE_FORMAT_CHILD_OFFSET,  // Packed octree layout, nodes store the offset to their first child, see PackedOctree
+    OCTREE_FORMAT_DAG,           // Identical subtrees are stored once, nodes store the index of their first child, see OctreeDAG
+    OCTREE_FORMAT_BRICKS,        // Child offset layout with the last OCTREE_BRICK_DEPTH levels in occupancy bricks, see PackedOctree
+};
+
+// Face of a voxel, the face a ray enters through is the opposite of the direction it's moving in
+typedef enum VoxelFace VoxelFace;
+enum VoxelFace
+{
+    FACE_NEG_X,
+    FACE_POS_X,
+    FACE_NEG_Y,
+    FACE_POS_Y,
+    FACE_NEG_Z,
+    FACE_POS_Z,
+};
+
+typedef struct OctreeHit OctreeHit;
+struct OctreeHit
+{
+    unsigned int node; // Leaf node that was hit
+    int voxel[3];
+    float distance; // Ray parameter of the hit, in units of the ray direction
+    VoxelFace face;
+};
+
+typedef struct OctreeVoxel OctreeVoxel;
+struct OctreeVoxel
+{
+    unsigned char x;
+    unsigned char y;
+    unsigned char z;
+    unsigned char color;
+};
+
+// Shape of a region edit, a voxel is inside if its center is
+typedef enum OctreeRegionShape OctreeRegionShape;
+enum OctreeRegionShape
+{
+    OCTREE_REGION_BOX,
+    OCTREE_REGION_SPHERE,
+};
+
+typedef struct OctreeRegion OctreeRegion;
+struct OctreeRegion
+{
+    OctreeRegionShape shape;
+
+    // Box, first and last voxel on each axis. Can reach outside of the octree
+    int min[3];
+    int max[3];
+
+    // Sphere, in voxels
+    float center[3];
+    float radius;
+};
+
+typedef enum OctreeRegionOverlap OctreeRegionOverlap;
+enum OctreeRegionOverlap
+{
+    OCTREE_REGION_OUTSIDE, // No voxel of the cube is in the region
+    OCTREE_REGION_PARTIAL, // Some voxels might be
+    OCTREE_REGION_INSIDE,  // Every voxel of the cube is in the region
+};
+
+typedef struct OctreePoolSlab OctreePoolSlab;
+struct OctreePoolSlab
+{
+    OctreePoolSlab *next;
+    unsigned int groups_count;
+    OctreeNode *nodes; // groups_count * 8 nodes, allocated together with the slab
+};
+
+/**
+ * Slab allocator for the children of an octree, every allocation is a group of 8 siblings
+ * stored next to each other. Freed groups are reused through the free list and the whole
+ * pool is released in one call when the octree is deleted.
+ */
+typedef struct OctreePool OctreePool;
+struct OctreePool
+{
+    OctreePoolSlab *slabs;
+    OctreeNode *free_groups; // Linked through the children pointer of the first node in the group
+
+    size_t groups_reserved;
+    size_t groups_free;
+    size_t groups_used; // Groups handed out from the slabs so far, free ones included
+
+    size_t nodes_live;
+};
+
+typedef struct OctreePoolStats OctreePoolStats;
+struct OctreePoolStats
+{
+    size_t nodes_live;
+    size_t nodes_reserved;
+    size_t bytes_reserved;
+
+    // Fraction of reserved node slots not holding a live node, 0 means no waste
+    float fragmentation;
+};
+
+/**
+ * Pointerless octree, the same array is walked on the cpu and uploaded to the gpu.
+ * Children of a node are stored next to each other (only the existing ones, in child index order),
+ * followed by the descendants of the first child, then of the second child and so on.
+ *
+ * Leaf node:     bit 31 set, color in bits 22 to 29
+ * Internal node: bit 31 clear, child mask in bits 0 to 7, offset from the node to its first child in bits 8 to 29
+ *
+ * Offsets that don't fit into 22 bits set bit 30, bits 8 to 29 are then a slot in the far table at the end
+ * of the array, slot n is the element at size - 1 - n and holds the full 32 bit offset.
+ * Sparse chunks never need the far table, dense chunks and deeper trees only need it for a few upper nodes.
+ *
+ * After the far table come the 16 bit attributes of every node, two in each element, node i is in the low half
+ * of element size + i / 2 if i is even and in the high half if it's odd. Attributes hold the color of the
+ * child with the most voxels in bits 0 to 7 and the filled part of the node's cube from 0 to 255 in bits 8 to 15,
+ * so traversal can stop at any level and still draw the node.
+ *
+ * The bricks format replaces the tiny nodes of the last two levels. Internal nodes OCTREE_BRICK_DEPTH levels above
+ * the bottom store the offset to their brick instead of their children, with the child mask clear. Bricks come after
+ * the nodes and before the far table: two elements with the 64 bit occupancy of the 4x4x4 voxels, low bits first,
+ * then one color byte for every set bit, four in each element. Bit and color order is the child order of both
+ * levels, voxel bit (octant << 3 | child) where octant is the child index of the brick node. A voxel's color is
+ * the one at the popcount of the occupancy bits below its bit. Attributes only cover the nodes, not the bricks.
+ */
+typedef struct PackedOctree PackedOctree;
+struct PackedOctree
+{
+    unsigned int *nodes;
+    unsigned int size;            // Nodes, bricks and far table
+    unsigned int attributes_size; // Elements of attributes after size
+    unsigned int capacity;
+    OctreeFormat format;          // OCTREE_FORMAT_BRICKS or child offsets, which Pack uses for any other value
+
+    bool is_valid; // False when the pointer octree changed since the last pack
+};
+
+/**
+ * Octree layout where identical subtrees are stored only once, several octrees can be added to the same dag
+ * and share their subtrees. Children are written before their parent, so every octree is in the nodes
+ * before its root and the root is read as the last element.
+ *
+ * Leaf node:     bit 31 set, color in bits 22 to 29
+ * Internal node: bit 31 clear, child mask in bits 0 to 7, index of the first child in the whole array in bits 8 to 30
+ *
+ * Like in PackedOctree only the existing children are stored next to each other, every node with
+ * the same children points to the same group of children.
+ */
+typedef struct OctreeDAGSlot OctreeDAGSlot;
+struct OctreeDAGSlot
+{
+    unsigned int hash;
+    unsigned int index; // First node of the group in the dag
+    unsigned int count; // 0 if the slot is empty
+};
+
+typedef struct OctreeDAG OctreeDAG;
+struct OctreeDAG
+{
+    unsigned int *nodes;
+    unsigned int size;
+    unsigned int capacity;
+
+    // Hash table of every group of nodes written to the dag
+    OctreeDAGSlot *slots;
+    unsigned int slots_count;
+    unsigned int slots_capacity;
+
+    size_t tree_nodes; // Nodes of all added octrees before sharing
 };
 
 typedef struct Octree Octree;
@@ -24,15 +231,154 @@ struct Octree
 {
     unsigned char depth; // Max value of 255
     OctreeNode *root;
+
+    OctreePool pool;
 };
 
+typedef void (*OctreeLeafCallback)(void *user_data, unsigned int x, unsigned int y, unsigned int z, unsigned int side, unsigned int data);
+
 struct AOctree
 {
     Octree *(*Init)();
+
+    // Initialize an octree with 2^depth voxels on each side, up to OCTREE_MAX_DEPTH
+    Octree *(*InitDepth)(unsigned char depth);
+    void (*Delete)(Octree *octree);
     void (*print_binary)(unsigned int num);
     void (*Add)(Octree *octree, unsigned int x, unsigned int y, unsigned int z, unsigned char color, unsigned int uvs);
+
+    /**
+     * Adds many voxels at once, the voxels are sorted by their morton code and the
+     * tree is built bottom up in a single pass. If a position repeats the last voxel wins.
+     */
+    void (*AddBatch)(Octree *octree, const OctreeVoxel *voxels, unsigned int count);
+
+    /**
+     * Removes a voxel, parents left without children are freed back to the pool and only
+     * the sizes along the path are updated. Returns false if the voxel was empty
+     */
+    bool (*Remove)(Octree *octree, unsigned int x, unsigned int y, unsigned int z);
+
+    /**
+     * Sets every voxel in the region to color. Nodes fully inside become one leaf and nodes fully outside aren't
+     * visited, only nodes on the border of the region are split, so the cost grows with its surface and not its volume.
+     * Returns false if no voxel changed
+     */
+    bool (*FillRegion)(Octree *octree, const OctreeRegion *region, unsigned char color);
+
+    // Empties every voxel in the region the same way, subtrees fully inside are freed back to the pool at once
+    bool (*ClearRegion)(Octree *octree, const OctreeRegion *region);
+
+    // How the cube of side voxels starting at x, y, z overlaps the region, exact for single voxels
+    OctreeRegionOverlap (*RegionOverlap)(const OctreeRegion *region, int x, int y, int z, int side);
+
+    /**
+     * Collapses every node whose 8 children are leaves with the same color into one leaf, bottom up.
+     * Add and AddBatch already do this on the path they change. Returns the amount of nodes freed
+     */
+    unsigned int (*Compact)(Octree *octree);
     void (*VisualizeOctree)(Octree *octree);
-    void (*LinearizeOctree)(OctreeNode *root, unsigned int **array, unsigned int *size);
+    /**
+     * Writes the octree into a newly allocated array in the requested format, child offset and brick arrays
+     * are followed by the node attributes which aren't counted in size. Bricks are placed for the depth of Init
+     */
+    void (*LinearizeOctree)(OctreeNode *root, OctreeFormat format, unsigned int **array, unsigned int *size);
+
+    /**
+     * Writes the octree into its pointerless representation in the packed format, reusing the packed array if it
+     * is big enough
+     */
+    void (*Pack)(Octree *octree, PackedOctree *packed);
+
+    /**
+     * Same as Pack with the subtrees two levels below the root packed on the workers of manager, the array is identical.
+     * Blocks until they are done, so it can't be called from inside a job. Small trees are packed on the calling thread
+     */
+    void (*PackParallel)(Octree *octree, PackedOctree *packed, ThreadsManager *manager);
+
+    /**
+     * Adds the octree to the dag, root is set to the index of its root node, nodes up to and including
+     * the root are everything the octree needs. Returns false if the dag has no space left
+     */
+    bool (*AddToDAG)(OctreeDAG *dag, Octree *octree, unsigned int *root);
+
+    // Frees the dag, set nodes to NULL before to keep them
+    void (*DeleteDAG)(OctreeDAG *dag);
+
+    /**
+     * Cpu reference traversal of a linearized octree, matches the shader.
+     * Returns the leaf node containing the voxel, or 0 if the voxel is empty
+     */
+    unsigned int (*Lookup)(const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned char depth, unsigned int x, unsigned int y, unsigned int z);
+
+    /**
+     * Index of the child_index child of the internal node at index, the child has to exist.
+     * Size is the size of the whole array, the far table is read from its end
+     */
+    unsigned int (*ChildIndex)(const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned int index, unsigned int child_index);
+
+    /**
+     * Cpu reference ray cast through a linearized octree with 2^depth voxels on each side.
+     * Origin is relative to the octree corner, only hits between t_min and t_max are returned
+     */
+    bool (*Raycast)(const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned char depth,
+                    const float origin[3], const float direction[3], float t_min, float t_max, OctreeHit *hit);
+
+    /**
+     * Same as Raycast but stops descending at lod_depth, nodes there are hit if their attributes say they are
+     * at least half full and their color is returned in a leaf word. Only child offset and brick arrays have
+     * attributes, other formats are always traversed to the full depth. Cells inside bricks use the majority of
+     * their voxels and the color of the first one
+     */
+    bool (*RaycastLOD)(const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned char depth, unsigned char lod_depth,
+                       const float origin[3], const float direction[3], float t_min, float t_max, OctreeHit *hit);
+
+    /**
+     * Same as RaycastLOD, with an optional distance field of the octree. Empty octree cells are then stepped over
+     * together with every cell the field says is empty around them. Steps is set to the amount of cells the ray
+     * visited, both can be NULL
+     */
+    bool (*RaycastField)(const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned char depth, unsigned char lod_depth,
+                         const unsigned int *field, unsigned char field_depth,
+                         const float origin[3], const float direction[3], float t_min, float t_max, OctreeHit *hit, unsigned int *steps);
+
+    /**
+     * RaycastField for up to OCTREE_PACKET_SIZE rays from the same origin, lanes is a mask of the rays to cast.
+     * The rays step through the voxels together and share the walk down the top levels while their voxels are
+     * in the same child, so neighbouring primary rays read those nodes once. Every lane gets the same hit and
+     * steps as its own RaycastField. Returns the mask of the lanes that hit, hits and steps can be NULL
+     */
+    unsigned int (*RaycastPacket)(const unsigned int *nodes, unsigned int size, OctreeFormat format, unsigned char depth, unsigned char lod_depth,
+                                  const unsigned int *field, unsigned char field_depth, const float origin[3],
+                                  const float directions[OCTREE_PACKET_SIZE][3], const float t_min[OCTREE_PACKET_SIZE], const float t_max[OCTREE_PACKET_SIZE],
+                                  unsigned int lanes, OctreeHit hits[OCTREE_PACKET_SIZE], unsigned int steps[OCTREE_PACKET_SIZE]);
+
+    // Writes the distance field of the octree into field, which holds OCTREE_FIELD_SIZE(field_depth) elements
+    void (*BuildDistanceField)(Octree *octree, unsigned char field_depth, unsigned int *field);
+
+    // Attributes of the node at index in a child offset or brick array of size nodes, see PackedOctree
+    unsigned int (*NodeAttributes)(const unsigned int *nodes, unsigned int size, unsigned int index);
+
+    /**
+     * Checks the attributes of a packed octree against the voxels of the pointer tree and that lod ray casts
+     * at every level hit the first node the attributes say is solid. Prints the first mismatch
+     */
+    bool (*ValidateLOD)(Octree *octree, PackedOctree *packed);
+
+    /**
+     * Returns the leaf data of the voxel by walking the pointer tree, 0 if the voxel is empty
+     */
+    unsigned int (*Get)(Octree *octree, unsigned int x, unsigned int y, unsigned int z);
+
+    /**
+     * Calls callback for every leaf with its lowest corner and the length of its side in voxels
+     */
+    void (*ForEachLeaf)(Octree *octree, OctreeLeafCallback callback, void *user_data);
+
+    /**
+     * Returns memory usage of the octree node pool
+     */
+    OctreePoolStats (*GetPoolStats)(Octree *octree);
 };
 
 extern struct AOctree AOctree;
@@ -0,0 +1,141 @@
+/**
+ * @file chunk_map.c
+ * @author https://github.com/shaderko
+ * @brief Finds chunks by their coordinates, the world isn't limited to a fixed grid
+ * @version 0.1
+ * @date 2024-06-12
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "chunk_map.h"
+#include "../../util/util.h"
+
+#define FIRST_CAPACITY 64
+
+static size_t hash_key(ChunkKey key)
+{
+    // Neighbouring chunks only differ in a few bits, mix them into the whole word
+    uint64_t hash = (uint64_t)key;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+
+    return (size_t)hash;
+}
+
+// Index of the entry with the key, or of the free entry where it would go
+static size_t find_entry(ChunkMapEntry *entries, size_t capacity, ChunkKey key)
+{
+    size_t mask = capacity - 1;
+    size_t index = hash_key(key) & mask;
+    while (entries[index].used && entries[index].key != key)
+    {
+        index = (index + 1) & mask;
+    }
+
+    return index;
+}
+
+static void resize(ChunkMap *map, size_t capacity)
+{
+    ChunkMapEntry *entries = calloc(capacity, sizeof(ChunkMapEntry));
+    if (!entries)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for chunk map.\n");
+
+    for (size_t i = 0; i < map->capacity; i++)
+    {
+        if (map->entries[i].used)
+            entries[find_entry(entries, capacity, map->entries[i].key)] = map->entries[i];
+    }
+
+    free(map->entries);
+    map->entries = entries;
+    map->capacity = capacity;
+}
+
+static ChunkMap *Init()
+{
+    ChunkMap *map = malloc(sizeof(ChunkMap));
+    if (!map)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for chunk map.\n");
+
+    *map = (ChunkMap){0};
+    resize(map, FIRST_CAPACITY);
+
+    return map;
+}
+
+static void Delete(ChunkMap *map)
+{
+    if (!map)
+        return;
+
+    free(map->entries);
+    free(map);
+}
+
+static void Set(ChunkMap *map, ChunkKey key, size_t value)
+{
+    // Keep at least half of the entries free so probing stays short
+    if ((map->count + 1) * 2 > map->capacity)
+        resize(map, map->capacity * 2);
+
+    ChunkMapEntry *entry = &map->entries[find_entry(map->entries, map->capacity, key)];
+    if (!entry->used)
+        map->count++;
+
+    *entry = (ChunkMapEntry){key, value, true};
+}
+
+static size_t Get(ChunkMap *map, ChunkKey key)
+{
+    ChunkMapEntry *entry = &map->entries[find_entry(map->entries, map->capacity, key)];
+
+    return entry->used ? entry->value : CHUNK_MAP_NONE;
+}
+
+static bool Remove(ChunkMap *map, ChunkKey key)
+{
+    size_t mask = map->capacity - 1;
+    size_t index = find_entry(map->entries, map->capacity, key);
+    if (!map->entries[index].used)
+        return false;
+
+    // Move later entries of the same probe run back into the hole, so lookups never stop early
+    size_t next = index;
+    while (true)
+    {
+        next = (next + 1) & mask;
+        if (!map->entries[next].used)
+            break;
+
+        // Entries that would be found before reaching the hole stay where they are
+        size_t home = hash_key(map->entries[next].key) & mask;
+        if (((next - home) & mask) < ((next - index) & mask))
+            continue;
+
+        map->entries[index] = map->entries[next];
+        index = next;
+    }
+
+    map->entries[index].used = false;
+    map->count--;
+
+    return true;
+}
+
+struct AChunkMap AChunkMap =
+    {
+        .Init = Init,
+        .Delete = Delete,
+        .Set = Set,
+        .Get = Get,
+        .Remove = Remove,
+};
@@ -0,0 +1,60 @@
+/**
+ * @file chunk_map.h
+ * @author https://github.com/shaderko
+ * @brief Finds chunks by their coordinates, the world isn't limited to a fixed grid
+ * @version 0.1
+ * @date 2024-06-12
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef CHUNK_MAP_H
+#define CHUNK_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../chunk/chunk.h"
+
+#define CHUNK_MAP_NONE ((size_t)-1) // Value returned when there is no chunk with the key
+
+typedef struct ChunkMapEntry ChunkMapEntry;
+struct ChunkMapEntry
+{
+    ChunkKey key;
+    size_t value;
+    bool used;
+};
+
+/**
+ * Open addressing hash map from chunk keys to values, collisions go to the next free entry.
+ * Capacity is a power of two and the map grows when it's more than half full, so lookups only look at a
+ * few entries next to each other
+ */
+typedef struct ChunkMap ChunkMap;
+struct ChunkMap
+{
+    ChunkMapEntry *entries;
+    size_t capacity;
+    size_t count;
+};
+
+struct AChunkMap
+{
+    ChunkMap *(*Init)();
+    void (*Delete)(ChunkMap *map);
+
+    // Sets the value of the key, adds the key if it isn't in the map
+    void (*Set)(ChunkMap *map, ChunkKey key, size_t value);
+
+    // Returns the value of the key or CHUNK_MAP_NONE
+    size_t (*Get)(ChunkMap *map, ChunkKey key);
+
+    // Returns false if the key wasn't in the map
+    bool (*Remove)(ChunkMap *map, ChunkKey key);
+};
+
+extern struct AChunkMap AChunkMap;
+
+#endif
@@ -0,0 +1,398 @@
+/**
+ * @file chunk_streamer.c
+ * @author https://github.com/shaderko
+ * @brief Loads the chunks around the camera and unloads the ones that weren't needed for the longest time
+ * @version 0.1
+ * @date 2024-06-15
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "chunk_streamer.h"
+#include "../../util/util.h"
+
+#define STREAMED_NONE 0xFFFFFFFFU
+#define LOADING_PER_WORKER 2 // Enough loads queued that no worker waits for the next update
+
+typedef struct ChunkLoadJob ChunkLoadJob;
+struct ChunkLoadJob
+{
+    ChunkStreamer *streamer;
+    unsigned int entry;
+    int position[3];
+    Chunk *chunk; // Result, NULL if there is nothing at the position
+};
+
+static void *load_job(void *data)
+{
+    ChunkLoadJob *job = data;
+    ChunkStreamer *streamer = job->streamer;
+
+    job->chunk = AChunk.Init((vec3){(float)job->position[0], (float)job->position[1], (float)job->position[2]});
+    if (!streamer->loader(job->chunk, job->position[0], job->position[1], job->position[2], streamer->loader_data))
+    {
+        AChunk.Delete(job->chunk);
+        job->chunk = NULL;
+    }
+
+    SDL_LockMutex(streamer->mutex);
+
+    if (streamer->finished_count == streamer->finished_capacity)
+    {
+        streamer->finished_capacity = streamer->finished_capacity ? streamer->finished_capacity * 2 : 64;
+        streamer->finished = realloc(streamer->finished, streamer->finished_capacity * sizeof(ChunkLoadJob *));
+        if (!streamer->finished)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for finished chunk loads.\n");
+    }
+    streamer->finished[streamer->finished_count++] = job;
+
+    SDL_UnlockMutex(streamer->mutex);
+
+    return NULL;
+}
+
+static void lru_remove(ChunkStreamer *streamer, unsigned int index)
+{
+    StreamedChunk *entry = &streamer->entries[index];
+
+    if (entry->previous != STREAMED_NONE)
+        streamer->entries[entry->previous].next = entry->next;
+    else
+        streamer->lru_head = entry->next;
+
+    if (entry->next != STREAMED_NONE)
+        streamer->entries[entry->next].previous = entry->previous;
+    else
+        streamer->lru_tail = entry->previous;
+
+    entry->previous = STREAMED_NONE;
+    entry->next = STREAMED_NONE;
+}
+
+static void lru_push_front(ChunkStreamer *streamer, unsigned int index)
+{
+    StreamedChunk *entry = &streamer->entries[index];
+    entry->previous = STREAMED_NONE;
+    entry->next = streamer->lru_head;
+
+    if (streamer->lru_head != STREAMED_NONE)
+        streamer->entries[streamer->lru_head].previous = index;
+    else
+        streamer->lru_tail = index;
+
+    streamer->lru_head = index;
+}
+
+static unsigned int create_entry(ChunkStreamer *streamer, ChunkKey key)
+{
+    unsigned int index;
+    if (streamer->free_entries_count)
+    {
+        index = streamer->free_entries[--streamer->free_entries_count];
+    }
+    else
+    {
+        index = streamer->entries_size++;
+        streamer->entries = realloc(streamer->entries, streamer->entries_size * sizeof(StreamedChunk));
+        streamer->free_entries = realloc(streamer->free_entries, streamer->entries_size * sizeof(unsigned int));
+        if (!streamer->entries || !streamer->free_entries)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for streamed chunks.\n");
+    }
+
+    streamer->entries[index] = (StreamedChunk){
+        .key = key,
+        .state = STREAMED_CHUNK_LOADING,
+        .previous = STREAMED_NONE,
+        .next = STREAMED_NONE,
+        .last_used = streamer->update,
+    };
+
+    AChunkMap.Set(streamer->entry_map, key, index);
+    lru_push_front(streamer, index);
+
+    return index;
+}
+
+static void evict_entry(ChunkStreamer *streamer, unsigned int index)
+{
+    StreamedChunk *entry = &streamer->entries[index];
+
+    if (entry->chunk)
+    {
+        AScene.RemoveChunk(streamer->scene, CHUNK_KEY_X(entry->key), CHUNK_KEY_Y(entry->key), CHUNK_KEY_Z(entry->key));
+        AChunk.Delete(entry->chunk);
+        streamer->stats.resident_chunks--;
+        streamer->stats.evicted++;
+    }
+
+    streamer->stats.resident_bytes -= entry->size;
+
+    lru_remove(streamer, index);
+    AChunkMap.Remove(streamer->entry_map, entry->key);
+    *entry = (StreamedChunk){.state = STREAMED_CHUNK_FREE};
+    streamer->free_entries[streamer->free_entries_count++] = index;
+}
+
+// Bytes counted for the entry, empty positions cost only their entry
+static size_t entry_size(StreamedChunk *entry)
+{
+    return sizeof(StreamedChunk) + AChunk.GetMemorySize(entry->chunk);
+}
+
+// Adds the chunks loaded since the last update to the scene
+static void add_finished(ChunkStreamer *streamer)
+{
+    SDL_LockMutex(streamer->mutex);
+
+    for (unsigned int i = 0; i < streamer->finished_count; i++)
+    {
+        ChunkLoadJob *job = streamer->finished[i];
+        StreamedChunk *entry = &streamer->entries[job->entry];
+
+        // Something else put a chunk at the position while it was loading, keep that one
+        if (job->chunk && AScene.GetChunk(streamer->scene, job->position[0], job->position[1], job->position[2]))
+        {
+            fprintf(stderr, "[WARNING] Scene already has a chunk at %d, %d, %d, the streamed one is dropped.\n", job->position[0], job->position[1], job->position[2]);
+            AChunk.Delete(job->chunk);
+            job->chunk = NULL;
+        }
+
+        entry->chunk = job->chunk;
+        entry->state = STREAMED_CHUNK_READY;
+        entry->size = entry_size(entry);
+        streamer->stats.resident_bytes += entry->size;
+        streamer->stats.loading--;
+
+        if (entry->chunk)
+        {
+            AScene.AddChunk(streamer->scene, entry->chunk);
+            streamer->stats.resident_chunks++;
+            streamer->stats.loaded++;
+        }
+
+        free(job);
+    }
+    streamer->finished_count = 0;
+
+    SDL_UnlockMutex(streamer->mutex);
+}
+
+// Distance between the chunk the camera is in and the chunk at the offset, the camera can be anywhere inside its chunk
+static float offset_distance(const int offset[3])
+{
+    float distance = 0.0f;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int gap = abs(offset[axis]) - 1;
+        if (gap > 0)
+            distance += (float)(gap * CHUNK_SIZE) * (float)(gap * CHUNK_SIZE);
+    }
+
+    return sqrtf(distance);
+}
+
+static int compare_offsets(const void *a, const void *b)
+{
+    const int *offset_a = a;
+    const int *offset_b = b;
+
+    float distance_a = offset_distance(offset_a);
+    float distance_b = offset_distance(offset_b);
+    if (distance_a != distance_b)
+        return distance_a < distance_b ? -1 : 1;
+
+    // Same gap to the camera chunk, the closer chunk centers go first
+    int length_a = offset_a[0] * offset_a[0] + offset_a[1] * offset_a[1] + offset_a[2] * offset_a[2];
+    int length_b = offset_b[0] * offset_b[0] + offset_b[1] * offset_b[1] + offset_b[2] * offset_b[2];
+    return (length_a > length_b) - (length_a < length_b);
+}
+
+static void build_offsets(ChunkStreamer *streamer)
+{
+    int radius = (int)ceilf(streamer->view_radius / CHUNK_SIZE) + 1;
+    int side = radius * 2 + 1;
+
+    free(streamer->offsets);
+    streamer->offsets = malloc((size_t)side * side * side * sizeof(*streamer->offsets));
+    if (!streamer->offsets)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for chunk streamer offsets.\n");
+
+    streamer->offsets_count = 0;
+    for (int z = -radius; z <= radius; z++)
+    {
+        for (int y = -radius; y <= radius; y++)
+        {
+            for (int x = -radius; x <= radius; x++)
+            {
+                int offset[3] = {x, y, z};
+                if (offset_distance(offset) > streamer->view_radius)
+                    continue;
+
+                memcpy(streamer->offsets[streamer->offsets_count++], offset, sizeof(offset));
+            }
+        }
+    }
+
+    qsort(streamer->offsets, streamer->offsets_count, sizeof(*streamer->offsets), compare_offsets);
+    streamer->offsets_radius = streamer->view_radius;
+}
+
+static ChunkStreamer *Init(Scene *scene, ChunkLoader loader, void *loader_data, float view_radius, size_t memory_budget)
+{
+    if (!scene || !loader)
+        ERROR_EXIT("[ERROR] Chunk streamer needs a scene and a loader.\n");
+
+    ChunkStreamer *streamer = malloc(sizeof(ChunkStreamer));
+    if (!streamer)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for chunk streamer.\n");
+
+    memset(streamer, 0, sizeof(ChunkStreamer));
+    streamer->scene = scene;
+    streamer->loader = loader;
+    streamer->loader_data = loader_data;
+    streamer->view_radius = view_radius;
+    streamer->memory_budget = memory_budget;
+    streamer->entry_map = AChunkMap.Init();
+    streamer->lru_head = STREAMED_NONE;
+    streamer->lru_tail = STREAMED_NONE;
+
+    streamer->workers = AThreadsManager.Init(0);
+    streamer->max_loading = streamer->workers->workers_count * LOADING_PER_WORKER;
+    streamer->mutex = SDL_CreateMutex();
+    if (!streamer->mutex)
+        ERROR_EXIT("[ERROR] Couldn't create chunk streamer mutex: %s\n", SDL_GetError());
+
+    return streamer;
+}
+
+static void Delete(ChunkStreamer *streamer)
+{
+    if (!streamer)
+        return;
+
+    // Finishes the loads that are still queued
+    AThreadsManager.Delete(streamer->workers);
+    add_finished(streamer);
+
+    for (unsigned int i = 0; i < streamer->entries_size; i++)
+    {
+        StreamedChunk *entry = &streamer->entries[i];
+        if (entry->state != STREAMED_CHUNK_READY || !entry->chunk)
+            continue;
+
+        AScene.RemoveChunk(streamer->scene, CHUNK_KEY_X(entry->key), CHUNK_KEY_Y(entry->key), CHUNK_KEY_Z(entry->key));
+        AChunk.Delete(entry->chunk);
+    }
+
+    SDL_DestroyMutex(streamer->mutex);
+    AChunkMap.Delete(streamer->entry_map);
+    free(streamer->entries);
+    free(streamer->free_entries);
+    free(streamer->offsets);
+    free(streamer->finished);
+    free(streamer);
+}
+
+static void Update(ChunkStreamer *streamer, Camera *camera)
+{
+    if (!streamer || !camera)
+        return;
+
+    streamer->update++;
+    add_finished(streamer);
+
+    if (!streamer->offsets || streamer->offsets_radius != streamer->view_radius)
+        build_offsets(streamer);
+
+    // Rays don't need to go further than the chunks that can be loaded
+    streamer->scene->view_distance = streamer->view_radius;
+
+    int camera_chunk[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        camera_chunk[axis] = (int)floorf(camera->position[axis] / CHUNK_SIZE);
+    }
+
+    // Mark everything inside the view radius as used and load what's missing, closest chunks first
+    for (unsigned int i = 0; i < streamer->offsets_count; i++)
+    {
+        int position[3];
+        bool outside = false;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            position[axis] = camera_chunk[axis] + streamer->offsets[i][axis];
+            outside |= position[axis] < CHUNK_COORDINATE_MIN || position[axis] > CHUNK_COORDINATE_MAX;
+        }
+
+        if (outside)
+            continue;
+
+        ChunkKey key = CHUNK_KEY(position[0], position[1], position[2]);
+        size_t index = AChunkMap.Get(streamer->entry_map, key);
+        if (index != CHUNK_MAP_NONE)
+        {
+            StreamedChunk *entry = &streamer->entries[index];
+            entry->last_used = streamer->update;
+            lru_remove(streamer, index);
+            lru_push_front(streamer, index);
+
+            // Edits and packing change how much memory the chunk holds
+            if (entry->chunk)
+            {
+                size_t size = entry_size(entry);
+                streamer->stats.resident_bytes += size - entry->size;
+                entry->size = size;
+            }
+
+            continue;
+        }
+
+        if (streamer->stats.loading >= streamer->max_loading)
+            continue;
+
+        ChunkLoadJob *job = malloc(sizeof(ChunkLoadJob));
+        if (!job)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for chunk load.\n");
+
+        *job = (ChunkLoadJob){streamer, create_entry(streamer, key), {position[0], position[1], position[2]}, NULL};
+        streamer->stats.loading++;
+        AThreadsManager.Add(streamer->workers, load_job, job);
+    }
+
+    // Unload from the least recently used end until the chunks fit, chunks used in this update are all in front
+    unsigned int index = streamer->lru_tail;
+    while (index != STREAMED_NONE && streamer->stats.resident_bytes > streamer->memory_budget)
+    {
+        StreamedChunk *entry = &streamer->entries[index];
+        if (entry->last_used == streamer->update)
+            break;
+
+        unsigned int previous = entry->previous;
+        if (entry->state == STREAMED_CHUNK_READY)
+            evict_entry(streamer, index);
+
+        index = previous;
+    }
+}
+
+static ChunkStreamerStats GetStats(ChunkStreamer *streamer)
+{
+    ChunkStreamerStats stats = {0};
+    if (!streamer)
+        return stats;
+
+    return streamer->stats;
+}
+
+struct AChunkStreamer AChunkStreamer =
+    {
+        .Init = Init,
+        .Delete = Delete,
+        .Update = Update,
+        .GetStats = GetStats,
+};
@@ -0,0 +1,124 @@
+/**
+ * @file chunk_streamer.h
+ * @author https://github.com/shaderko
+ * @brief Loads the chunks around the camera and unloads the ones that weren't needed for the longest time
+ * @version 0.1
+ * @date 2024-06-15
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef CHUNK_STREAMER_H
+#define CHUNK_STREAMER_H
+
+#include <SDL.h>
+#include <stdbool.h>
+
+#include "scene.h"
+#include "chunk_map.h"
+#include "../../camera/camera.h"
+#include "../../threading/threads_manager.h"
+
+/**
+ * Fills an empty chunk at x, y, z in chunk coordinates, from a world file or a generator. Called on a
+ * worker thread, so it can only touch the chunk it got. Returns false if there is nothing at the position
+ */
+typedef bool (*ChunkLoader)(Chunk *chunk, int x, int y, int z, void *data);
+
+typedef enum StreamedChunkState StreamedChunkState;
+enum StreamedChunkState
+{
+    STREAMED_CHUNK_FREE,    // Entry isn't used
+    STREAMED_CHUNK_LOADING, // Loader is running on a worker
+    STREAMED_CHUNK_READY,   // Loaded, the chunk is in the scene or the position is empty
+};
+
+// Position the streamer knows about, empty positions are kept too so they aren't loaded again every frame
+typedef struct StreamedChunk StreamedChunk;
+struct StreamedChunk
+{
+    ChunkKey key;
+    Chunk *chunk; // NULL for empty positions and while loading
+    size_t size;  // Bytes the chunk holds
+    StreamedChunkState state;
+
+    // Least recently used list, the front was used in the last update
+    unsigned int previous;
+    unsigned int next;
+    unsigned int last_used; // Update the position was last inside the view radius
+};
+
+typedef struct ChunkStreamerStats ChunkStreamerStats;
+struct ChunkStreamerStats
+{
+    size_t resident_chunks;
+    size_t resident_bytes;
+    size_t loading;
+
+    // Since the streamer was created
+    size_t loaded;
+    size_t evicted;
+};
+
+typedef struct ChunkStreamer ChunkStreamer;
+struct ChunkStreamer
+{
+    Scene *scene;
+
+    ChunkLoader loader;
+    void *loader_data;
+
+    float view_radius;   // In voxels, chunks that touch the sphere around the camera are loaded
+    size_t memory_budget; // Bytes of loaded chunks kept before the least recently used ones outside the view radius are unloaded
+    unsigned int max_loading; // Loads running at once, more wait for the next updates
+
+    StreamedChunk *entries;
+    unsigned int entries_size;
+    unsigned int *free_entries;
+    unsigned int free_entries_count;
+    ChunkMap *entry_map; // Chunk key to index in entries
+
+    unsigned int lru_head;
+    unsigned int lru_tail;
+
+    // Chunk offsets inside the view radius, closest first so the chunks near the camera load first
+    int (*offsets)[3];
+    unsigned int offsets_count;
+    float offsets_radius;
+
+    // Loads finished by the workers, added to the scene by the next update
+    ThreadsManager *workers;
+    SDL_mutex *mutex;
+    struct ChunkLoadJob **finished;
+    unsigned int finished_count;
+    unsigned int finished_capacity;
+
+    unsigned int update;
+    ChunkStreamerStats stats;
+};
+
+struct AChunkStreamer
+{
+    /**
+     * Creates a streamer for the scene, it owns every chunk it loads into the scene. The loads run on their
+     * own workers so they never hold up the scene serialization
+     */
+    ChunkStreamer *(*Init)(Scene *scene, ChunkLoader loader, void *loader_data, float view_radius, size_t memory_budget);
+
+    // Waits for running loads and takes every loaded chunk out of the scene
+    void (*Delete)(ChunkStreamer *streamer);
+
+    /**
+     * Call once a frame. Adds finished chunks to the scene, starts loading the missing chunks around the camera
+     * and unloads the least recently used chunks outside the view radius while over the memory budget.
+     * Changes reach the gpu through the next AScene.SerializeDirtyChunks
+     */
+    void (*Update)(ChunkStreamer *streamer, Camera *camera);
+
+    ChunkStreamerStats (*GetStats)(ChunkStreamer *streamer);
+};
+
+extern struct AChunkStreamer AChunkStreamer;
+
+#endif
@@ -10,17 +10,22 @@
  */
 
 #include <stdio.h>
+#include <math.h>
 
 #include "../../util/util.h"
 #include "scene.h"
 #include "../object.h"
 #include "../chunk/chunk.h"
+#include "../../threading/threads_manager.h"
+#include "dda.h"
 #include <SDL.h>
 
-#define MAX_WORLD_X_SIZE 12
-#define MAX_WORLD_Y_SIZE 12
-#define MAX_WORLD_Z_SIZE 12
-#define MAX_WORLD_SIZE MAX_WORLD_X_SIZE *MAX_WORLD_Y_SIZE *MAX_WORLD_Z_SIZE
+#define GPU_CHUNKS_FIRST_CAPACITY 64
+
+#define SERIALIZED_CHUNK_SLACK 4                // Chunks get a quarter more space than they need, so small edits stay in place
+#define SERIALIZED_INITIAL_CAPACITY (1 << 20)   // Elements, the chunk buffer starts at 4 MB so it rarely has to be created again
+#define SERIALIZED_MIN_HOLES 65536              // Elements of free space between chunks before they are moved together
+#define SERIALIZED_COMPACTION_BUDGET (1 << 16)  // Elements moved by one compaction pass
 
 static Scene *Init()
 {
@@ -31,6 +36,7 @@ static Scene *Init()
     }
 
     memset(scene, 0, sizeof(Scene));
+    scene->chunk_map = AChunkMap.Init();
 
     return scene;
 }
@@ -51,11 +57,139 @@ static void AddObject(Scene *scene, Object *object)
     return;
 }
 
-static void AddChunk(Scene *scene, Chunk *chunk)
+static bool AddChunk(Scene *scene, Chunk *chunk)
 {
+    if (!scene || !chunk)
+        return false;
+
+    if (AChunkMap.Get(scene->chunk_map, chunk->position) != CHUNK_MAP_NONE)
+    {
+        fprintf(stderr, "[WARNING] Scene already has a chunk at %d, %d, %d, skipping.\n", CHUNK_KEY_X(chunk->position), CHUNK_KEY_Y(chunk->position), CHUNK_KEY_Z(chunk->position));
+        return false;
+    }
+
     scene->chunks = realloc(scene->chunks, sizeof(Chunk *) * (scene->chunks_size + 1));
+    if (!scene->chunks)
+        ERROR_EXIT("[ERROR] Couldn't allocate memory for scene chunks!\n");
+
     scene->chunks[scene->chunks_size] = chunk;
+    AChunkMap.Set(scene->chunk_map, chunk->position, scene->chunks_size);
     scene->chunks_size++;
+
+    return true;
+}
+
+static Chunk *GetChunk(Scene *scene, int x, int y, int z)
+{
+    if (!scene)
+        return NULL;
+
+    size_t index = AChunkMap.Get(scene->chunk_map, CHUNK_KEY(x, y, z));
+    return index == CHUNK_MAP_NONE ? NULL : scene->chunks[index];
+}
+
+static Chunk *RemoveChunk(Scene *scene, int x, int y, int z);
+
+/**
+ * Edits the region given in world voxels in every chunk it overlaps, moved into the voxels of each chunk.
+ * Filling adds the chunks that don't exist yet, they are taken out again if the region missed all their voxels
+ */
+static bool edit_region(Scene *scene, const OctreeRegion *region, unsigned char color, bool fill)
+{
+    if (!scene || !region)
+        return false;
+
+    int first[3];
+    int last[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int min = region->min[axis];
+        int max = region->max[axis];
+        if (region->shape == OCTREE_REGION_SPHERE)
+        {
+            min = (int)floorf(region->center[axis] - region->radius);
+            max = (int)ceilf(region->center[axis] + region->radius);
+        }
+
+        // Arithmetic shift, so negative voxels round down to their chunk too
+        first[axis] = min >> CHUNK_DEPTH;
+        last[axis] = max >> CHUNK_DEPTH;
+        first[axis] = first[axis] < CHUNK_COORDINATE_MIN ? CHUNK_COORDINATE_MIN : first[axis];
+        last[axis] = last[axis] > CHUNK_COORDINATE_MAX ? CHUNK_COORDINATE_MAX : last[axis];
+    }
+
+    bool changed = false;
+    for (int z = first[2]; z <= last[2]; z++)
+    {
+        for (int y = first[1]; y <= last[1]; y++)
+        {
+            for (int x = first[0]; x <= last[0]; x++)
+            {
+                int offset[3] = {x * CHUNK_SIZE, y * CHUNK_SIZE, z * CHUNK_SIZE};
+                if (AOctree.RegionOverlap(region, offset[0], offset[1], offset[2], CHUNK_SIZE) == OCTREE_REGION_OUTSIDE)
+                    continue;
+
+                Chunk *chunk = GetChunk(scene, x, y, z);
+                bool added = !chunk;
+                if (added)
+                {
+                    if (!fill)
+                        continue;
+
+                    chunk = AChunk.Init((vec3){x, y, z});
+                    AddChunk(scene, chunk);
+                }
+
+                OctreeRegion local = *region;
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    local.min[axis] -= offset[axis];
+                    local.max[axis] -= offset[axis];
+                    local.center[axis] -= offset[axis];
+                }
+
+                bool chunk_changed;
+                if (region->shape == OCTREE_REGION_BOX)
+                    chunk_changed = fill ? AChunk.FillBox(chunk, local.min, local.max, color) : AChunk.ClearBox(chunk, local.min, local.max);
+                else
+                    chunk_changed = fill ? AChunk.FillSphere(chunk, local.center, local.radius, color) : AChunk.ClearSphere(chunk, local.center, local.radius);
+
+                if (added && !chunk_changed)
+                {
+                    RemoveChunk(scene, x, y, z);
+                    AChunk.Delete(chunk);
+                }
+
+                changed |= chunk_changed;
+            }
+        }
+    }
+
+    return changed;
+}
+
+static bool FillBox(Scene *scene, const int min[3], const int max[3], unsigned char color)
+{
+    OctreeRegion region = {.shape = OCTREE_REGION_BOX, .min = {min[0], min[1], min[2]}, .max = {max[0], max[1], max[2]}};
+    return edit_region(scene, &region, color, true);
+}
+
+static bool ClearBox(Scene *scene, const int min[3], const int max[3])
+{
+    OctreeRegion region = {.shape = OCTREE_REGION_BOX, .min = {min[0], min[1], min[2]}, .max = {max[0], max[1], max[2]}};
+    return edit_region(scene, &region, 0, false);
+}
+
+static bool FillSphere(Scene *scene, vec3 center, float radius, unsigned char color)
+{
+    OctreeRegion region = {.shape = OCTREE_REGION_SPHERE, .center = {center[0], center[1], center[2]}, .radius = radius};
+    return edit_region(scene, &region, color, true);
+}
+
+static bool ClearSphere(Scene *scene, vec3 center, float radius)
+{
+    OctreeRegion region = {.shape = OCTREE_REGION_SPHERE, .center = {center[0], center[1], center[2]}, .radius = radius};
+    return edit_region(scene, &region, 0, false);
 }
 
 // Voxel is the smallest object in the engine, the whole world is made out of voxels
@@ -83,10 +217,253 @@ static void Render(Scene *scene, Camera *camera, int width, int height)
     AWindowRender->RenderSceneChunks(scene, camera, width, height);
 }
 
-static int SerializeThreadFunc(void *data)
+static void *serialize_job(void *data)
 {
     AChunk.Serialize(data);
-    return 0;
+    return NULL;
+}
+
+/**
+ * Serializes the chunks on the worker threads, results[i] belongs to chunks[i].
+ * Distance fields are built on the workers too, one chunk each
+ */
+static void serialize_chunks(Chunk **chunks, size_t count, SerializedChunk *results, bool distance_fields)
+{
+    ChunkSerializeData *jobs = malloc(count * sizeof(ChunkSerializeData));
+    if (!jobs)
+        ERROR_EXIT("Failed to allocate memory for scene serialization!\n");
+
+    ThreadsManager *manager = AThreadsManager.Default();
+
+    // With fewer chunks than workers one job per chunk leaves workers idle, split the packing of each chunk instead
+    if (count < (size_t)manager->workers_count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            AChunk.Pack(chunks[i], manager);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        jobs[i] = (ChunkSerializeData){chunks[i], &results[i], distance_fields};
+        AThreadsManager.Add(manager, serialize_job, &jobs[i]);
+    }
+
+    AThreadsManager.Wait(manager);
+    free(jobs);
+}
+
+// Entry of the chunk at x, y, z in the gpu chunk table, or the empty entry where it would go. Same as get_chunk in voxel.comp
+static unsigned int find_gpu_chunk(GPUChunk *gpu_chunks, unsigned int capacity, int x, int y, int z)
+{
+    unsigned int mask = capacity - 1;
+    unsigned int index = chunk_hash(x, y, z) & mask;
+    while (gpu_chunks[index].format != OCTREE_FORMAT_NONE && (gpu_chunks[index].x != x || gpu_chunks[index].y != y || gpu_chunks[index].z != z))
+    {
+        index = (index + 1) & mask;
+    }
+
+    return index;
+}
+
+static GPUChunk *create_gpu_chunks(unsigned int capacity)
+{
+    // Zeroed entries have OCTREE_FORMAT_NONE, so they are empty
+    GPUChunk *gpu_chunks = calloc(capacity, sizeof(GPUChunk));
+    if (!gpu_chunks)
+        ERROR_EXIT("Failed to allocate memory for scene serialization!\n");
+
+    return gpu_chunks;
+}
+
+static void init_gpu_chunks(SerializedScene *serialized)
+{
+    serialized->gpu_chunks = create_gpu_chunks(GPU_CHUNKS_FIRST_CAPACITY);
+    serialized->gpu_chunks_capacity = GPU_CHUNKS_FIRST_CAPACITY;
+    serialized->gpu_chunks_count = 0;
+    serialized->gpu_chunks_changed = true;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        serialized->chunks_min[axis] = CHUNK_COORDINATE_MAX;
+        serialized->chunks_max[axis] = CHUNK_COORDINATE_MIN;
+    }
+}
+
+// Writes the gpu chunk into the table, the table grows once it's half full
+static void set_gpu_chunk(SerializedScene *serialized, GPUChunk gpu_chunk)
+{
+    if (!serialized->gpu_chunks)
+        init_gpu_chunks(serialized);
+
+    if ((serialized->gpu_chunks_count + 1) * 2 > serialized->gpu_chunks_capacity)
+    {
+        unsigned int capacity = serialized->gpu_chunks_capacity * 2;
+        GPUChunk *gpu_chunks = create_gpu_chunks(capacity);
+        for (unsigned int i = 0; i < serialized->gpu_chunks_capacity; i++)
+        {
+            GPUChunk *current = &serialized->gpu_chunks[i];
+            if (current->format != OCTREE_FORMAT_NONE)
+                gpu_chunks[find_gpu_chunk(gpu_chunks, capacity, current->x, current->y, current->z)] = *current;
+        }
+
+        free(serialized->gpu_chunks);
+        serialized->gpu_chunks = gpu_chunks;
+        serialized->gpu_chunks_capacity = capacity;
+        serialized->gpu_chunks_changed = true;
+    }
+
+    GPUChunk *entry = &serialized->gpu_chunks[find_gpu_chunk(serialized->gpu_chunks, serialized->gpu_chunks_capacity, gpu_chunk.x, gpu_chunk.y, gpu_chunk.z)];
+    if (entry->format == OCTREE_FORMAT_NONE)
+    {
+        serialized->gpu_chunks_count++;
+
+        int coordinates[3] = {gpu_chunk.x, gpu_chunk.y, gpu_chunk.z};
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (coordinates[axis] < serialized->chunks_min[axis])
+                serialized->chunks_min[axis] = coordinates[axis];
+            if (coordinates[axis] > serialized->chunks_max[axis])
+                serialized->chunks_max[axis] = coordinates[axis];
+        }
+    }
+
+    if (memcmp(entry, &gpu_chunk, sizeof(GPUChunk)))
+    {
+        *entry = gpu_chunk;
+        serialized->gpu_chunks_changed = true;
+    }
+}
+
+// Returns the gpu chunk at x, y, z or NULL
+static GPUChunk *get_gpu_chunk(SerializedScene *serialized, int x, int y, int z)
+{
+    if (!serialized->gpu_chunks)
+        return NULL;
+
+    GPUChunk *entry = &serialized->gpu_chunks[find_gpu_chunk(serialized->gpu_chunks, serialized->gpu_chunks_capacity, x, y, z)];
+    return entry->format == OCTREE_FORMAT_NONE ? NULL : entry;
+}
+
+// Removes the gpu chunk at x, y, z from the table, the chunks after it move back so none of them is cut off from its hash
+static void remove_gpu_chunk(SerializedScene *serialized, int x, int y, int z)
+{
+    if (!serialized->gpu_chunks)
+        return;
+
+    unsigned int mask = serialized->gpu_chunks_capacity - 1;
+    unsigned int index = find_gpu_chunk(serialized->gpu_chunks, serialized->gpu_chunks_capacity, x, y, z);
+    if (serialized->gpu_chunks[index].format == OCTREE_FORMAT_NONE)
+        return;
+
+    unsigned int next = index;
+    while (true)
+    {
+        next = (next + 1) & mask;
+        GPUChunk *current = &serialized->gpu_chunks[next];
+        if (current->format == OCTREE_FORMAT_NONE)
+            break;
+
+        // Chunks whose hash is between the hole and them are still found
+        unsigned int home = chunk_hash(current->x, current->y, current->z) & mask;
+        if (((next - home) & mask) < ((next - index) & mask))
+            continue;
+
+        serialized->gpu_chunks[index] = *current;
+        index = next;
+    }
+
+    serialized->gpu_chunks[index] = (GPUChunk){0};
+    serialized->gpu_chunks_count--;
+    serialized->gpu_chunks_changed = true;
+
+    // The bounds only shrink if the chunk was on them
+    int coordinates[3] = {x, y, z};
+    bool on_bounds = false;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        on_bounds |= coordinates[axis] == serialized->chunks_min[axis] || coordinates[axis] == serialized->chunks_max[axis];
+    }
+
+    if (!on_bounds)
+        return;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        serialized->chunks_min[axis] = CHUNK_COORDINATE_MAX;
+        serialized->chunks_max[axis] = CHUNK_COORDINATE_MIN;
+    }
+
+    for (unsigned int i = 0; i < serialized->gpu_chunks_capacity; i++)
+    {
+        GPUChunk *current = &serialized->gpu_chunks[i];
+        if (current->format == OCTREE_FORMAT_NONE)
+            continue;
+
+        int current_coordinates[3] = {current->x, current->y, current->z};
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (current_coordinates[axis] < serialized->chunks_min[axis])
+                serialized->chunks_min[axis] = current_coordinates[axis];
+            if (current_coordinates[axis] > serialized->chunks_max[axis])
+                serialized->chunks_max[axis] = current_coordinates[axis];
+        }
+    }
+}
+
+static GPUChunk gpu_chunk_of(Chunk *chunk, unsigned int offset, SerializedChunk *serialized_chunk)
+{
+    return (GPUChunk){
+        .x = CHUNK_KEY_X(chunk->position),
+        .y = CHUNK_KEY_Y(chunk->position),
+        .z = CHUNK_KEY_Z(chunk->position),
+        .offset = offset,
+        .size = serialized_chunk->size,
+        .format = serialized_chunk->format,
+        .max_depth = CHUNK_DEPTH,
+        .distance_field = serialized_chunk->distance_field_size ? serialized_chunk->size + serialized_chunk->attributes_size : 0,
+    };
+}
+
+/**
+ * Serializes every chunk into one dag, chunks start at the beginning of the data and their root is the
+ * last node of their size. Returns false if the world doesn't fit into the dag
+ */
+static bool serialize_dag(Scene *scene, SerializedScene *result)
+{
+    OctreeDAG dag = {0};
+    init_gpu_chunks(result);
+
+    for (size_t i = 0; i < scene->chunks_size; i++)
+    {
+        Chunk *chunk = scene->chunks[i];
+        if (!chunk || !chunk->voxel_tree)
+            continue;
+
+        unsigned int root;
+        if (!AOctree.AddToDAG(&dag, chunk->voxel_tree, &root))
+        {
+            AOctree.DeleteDAG(&dag);
+            free(result->gpu_chunks);
+            result->gpu_chunks = NULL;
+            return false;
+        }
+
+        set_gpu_chunk(result, gpu_chunk_of(chunk, 0, &(SerializedChunk){.size = root + 1, .format = OCTREE_FORMAT_DAG}));
+    }
+
+    result->chunks_data = dag.nodes;
+    result->chunks_data_size = dag.size;
+    result->dedup_ratio = dag.size ? (float)dag.tree_nodes / dag.size : 1.0f;
+
+    printf("[INFO] Serialized %zu octree nodes into a dag of %u nodes, dedup ratio %.2f\n", dag.tree_nodes, dag.size, result->dedup_ratio);
+
+    // The nodes now belong to the serialized scene
+    dag.nodes = NULL;
+    AOctree.DeleteDAG(&dag);
+
+    return true;
 }
 
 static SerializedScene SerializeChunks(Scene *scene)
@@ -95,83 +472,646 @@ static SerializedScene SerializeChunks(Scene *scene)
     if (!scene || scene->chunks_size == 0)
         return (SerializedScene){0};
 
-    // Create all needed buffers for storage and threads
-    SDL_Thread **threads = malloc(scene->chunks_size * sizeof(SDL_Thread *));
-    GPUChunk *gpu_chunks = malloc(MAX_WORLD_SIZE * sizeof(GPUChunk));
-    GPUChunk default_chunk = {0, 0, 0, (unsigned int)false};
-    for (int i = 0; i < MAX_WORLD_SIZE; ++i)
+    if (scene->serialize_dag)
     {
-        gpu_chunks[i] = default_chunk;
+        SerializedScene result = {0};
+        if (serialize_dag(scene, &result))
+            return result;
+
+        fprintf(stderr, "[WARNING] Scene is too big for the octree dag, serializing chunks separately.\n");
     }
+
+    SerializedScene result = {0};
+    init_gpu_chunks(&result);
+
     SerializedChunk *serialized_chunks = malloc(scene->chunks_size * sizeof(SerializedChunk));
+    if (!serialized_chunks)
+        ERROR_EXIT("Failed to allocate memory for scene serialization!\n");
+
+    serialize_chunks(scene->chunks, scene->chunks_size, serialized_chunks, scene->distance_fields);
 
-    if (!threads || !serialized_chunks || !gpu_chunks)
+    // Calculate the total size and where every chunk starts
+    unsigned int totalSize = 0;
+    for (int i = 0; i < scene->chunks_size; i++)
+    {
+        // Create the gpu chunk
+        set_gpu_chunk(&result, gpu_chunk_of(scene->chunks[i], totalSize, &serialized_chunks[i]));
+
+        // Add the size to the overall size, the node attributes and the distance field come after the nodes
+        totalSize += serialized_chunks[i].size + serialized_chunks[i].attributes_size + serialized_chunks[i].distance_field_size;
+    }
+
+    // Combine all results into a single buffer
+    unsigned int *combined_data = malloc(totalSize * sizeof(unsigned int));
+    if (totalSize && !combined_data)
         ERROR_EXIT("Failed to allocate memory for scene serialization!\n");
 
-    // Create threads to process each chunk
+    unsigned int *current_position = combined_data;
     for (int i = 0; i < scene->chunks_size; i++)
     {
-        struct ThreadData
+        unsigned int size = serialized_chunks[i].size + serialized_chunks[i].attributes_size + serialized_chunks[i].distance_field_size;
+        memcpy(current_position, serialized_chunks[i].data, size * sizeof(unsigned int));
+        current_position += size;
+    }
+
+    free(serialized_chunks);
+
+    result.chunks_data = combined_data;
+    result.chunks_data_size = totalSize;
+    result.chunks_data_capacity = totalSize;
+    result.dedup_ratio = 1.0f;
+
+    return result;
+}
+
+static void add_changed_range(SerializedScene *serialized, unsigned int offset, unsigned int size)
+{
+    if (size == 0)
+        return;
+
+    size_t byte_offset = (size_t)offset * sizeof(unsigned int);
+    size_t byte_size = (size_t)size * sizeof(unsigned int);
+
+    // Chunks are mostly written one after another, merge ranges that touch
+    if (serialized->changed_ranges_count)
+    {
+        SerializedRange *last = &serialized->changed_ranges[serialized->changed_ranges_count - 1];
+        if (last->offset + last->size == byte_offset)
+        {
+            last->size += byte_size;
+            return;
+        }
+    }
+
+    if (serialized->changed_ranges_count == serialized->changed_ranges_capacity)
+    {
+        serialized->changed_ranges_capacity = serialized->changed_ranges_capacity ? serialized->changed_ranges_capacity * 2 : 64;
+        serialized->changed_ranges = realloc(serialized->changed_ranges, serialized->changed_ranges_capacity * sizeof(SerializedRange));
+        if (!serialized->changed_ranges)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for serialized scene ranges.\n");
+    }
+
+    serialized->changed_ranges[serialized->changed_ranges_count++] = (SerializedRange){byte_offset, byte_size};
+}
+
+static void reserve_chunks_data(SerializedScene *serialized, unsigned int size)
+{
+    if (size <= serialized->chunks_data_capacity)
+        return;
+
+    unsigned int capacity = serialized->chunks_data_capacity ? serialized->chunks_data_capacity * 2 : 1024;
+    if (capacity < size)
+        capacity = size;
+
+    serialized->chunks_data = realloc(serialized->chunks_data, capacity * sizeof(unsigned int));
+    if (!serialized->chunks_data)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for serialized scene.\n");
+
+    // Unused elements are never read, but keep the uploaded buffer deterministic
+    memset(&serialized->chunks_data[serialized->chunks_data_capacity], 0, (capacity - serialized->chunks_data_capacity) * sizeof(unsigned int));
+
+    serialized->chunks_data_capacity = capacity;
+    serialized->chunks_data_resized = true;
+}
+
+static void reset_serialized(Scene *scene)
+{
+    SerializedScene *serialized = &scene->serialized;
+
+    free(serialized->chunks_data);
+    free(serialized->gpu_chunks);
+    serialized->chunks_data = NULL;
+    serialized->chunks_data_size = 0;
+    serialized->chunks_data_capacity = 0;
+    serialized->gpu_chunks = NULL;
+    serialized->gpu_chunks_capacity = 0;
+    serialized->gpu_chunks_count = 0;
+    serialized->dedup_ratio = 1.0f;
+    serialized->chunks_data_resized = true;
+    serialized->gpu_chunks_changed = true;
+
+    memset(scene->serialized_slots, 0, scene->serialized_slots_size * sizeof(SerializedChunkSlot));
+
+    AOffsetAllocator.Delete(scene->serialized_allocator);
+    scene->serialized_allocator = NULL;
+}
+
+// Space for size elements in chunks_data, the buffer grows if no free range is big enough
+static OffsetAllocation allocate_serialized(Scene *scene, unsigned int size)
+{
+    SerializedScene *serialized = &scene->serialized;
+
+    OffsetAllocation allocation = AOffsetAllocator.Allocate(scene->serialized_allocator, size);
+    while (allocation.node == OFFSET_ALLOCATOR_NONE)
+    {
+        reserve_chunks_data(serialized, serialized->chunks_data_capacity + size);
+        AOffsetAllocator.Grow(scene->serialized_allocator, serialized->chunks_data_capacity);
+
+        allocation = AOffsetAllocator.Allocate(scene->serialized_allocator, size);
+    }
+
+    return allocation;
+}
+
+static int compare_slot_offsets(const void *a, const void *b)
+{
+    unsigned int offset_a = (*(SerializedChunkSlot **)a)->offset;
+    unsigned int offset_b = (*(SerializedChunkSlot **)b)->offset;
+
+    return (offset_a < offset_b) - (offset_a > offset_b);
+}
+
+/**
+ * Moves the chunks at the end of chunks_data into free space closer to the start. It runs a bit on every
+ * call once there is enough free space between chunks, so it never stalls a frame and the holes left
+ * behind by chunks that moved or grew don't keep piling up
+ */
+static void compact_serialized(Scene *scene)
+{
+    SerializedScene *serialized = &scene->serialized;
+    OffsetAllocator *allocator = scene->serialized_allocator;
+
+    OffsetAllocatorStats stats = AOffsetAllocator.GetStats(allocator);
+    unsigned int holes = stats.end - stats.used_size;
+    if (holes < SERIALIZED_MIN_HOLES || holes * 4 < stats.used_size)
+        return;
+
+    SerializedChunkSlot **slots = malloc(scene->serialized_slots_size * sizeof(SerializedChunkSlot *));
+    if (!slots)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for serialized scene compaction.\n");
+
+    size_t slots_count = 0;
+    for (size_t i = 0; i < scene->serialized_slots_size; i++)
+    {
+        if (scene->serialized_slots[i].is_valid)
+            slots[slots_count++] = &scene->serialized_slots[i];
+    }
+
+    // Last chunks first, the end of the used space moves down
+    qsort(slots, slots_count, sizeof(SerializedChunkSlot *), compare_slot_offsets);
+
+    unsigned int moved = 0;
+    for (size_t i = 0; i < slots_count && moved < SERIALIZED_COMPACTION_BUDGET; i++)
+    {
+        SerializedChunkSlot *slot = slots[i];
+
+        OffsetAllocation allocation = AOffsetAllocator.Allocate(allocator, AOffsetAllocator.AllocationSize(allocator, slot->node));
+        if (allocation.node == OFFSET_ALLOCATOR_NONE)
+            continue;
+
+        if (allocation.offset > slot->offset)
         {
-            Chunk *chunk;
-            SerializedChunk *result;
-        } *data = malloc(sizeof(struct ThreadData));
+            AOffsetAllocator.Free(allocator, allocation.node);
+            continue;
+        }
+
+        memcpy(&serialized->chunks_data[allocation.offset], &serialized->chunks_data[slot->offset], slot->size * sizeof(unsigned int));
+        AOffsetAllocator.Free(allocator, slot->node);
 
-        data->chunk = scene->chunks[i];
-        data->result = &serialized_chunks[i];
+        slot->offset = allocation.offset;
+        slot->node = allocation.node;
+        add_changed_range(serialized, slot->offset, slot->size);
 
-        threads[i] = SDL_CreateThread(SerializeThreadFunc, "Chunk Serialize", data);
-        if (!threads[i])
-            ERROR_EXIT("Failed to create chunk serialize thread!\n");
+        Chunk *chunk = scene->chunks[slot - scene->serialized_slots];
+        GPUChunk gpu_chunk = *get_gpu_chunk(serialized, CHUNK_KEY_X(chunk->position), CHUNK_KEY_Y(chunk->position), CHUNK_KEY_Z(chunk->position));
+        gpu_chunk.offset = slot->offset;
+        set_gpu_chunk(serialized, gpu_chunk);
 
-        // puts("[INFO] Created a thread.");
+        moved += slot->size;
     }
 
-    // puts("[INFO] Waiting for all threads to finish");
+    free(slots);
+}
 
-    // Wait for all threads to finish and calculate total size
-    unsigned int totalSize = 0;
-    for (int i = 0; i < scene->chunks_size; i++)
+static void serialize_dirty_dag(Scene *scene, size_t dirty_count)
+{
+    if (dirty_count == 0)
+        return;
+
+    // Shared subtrees can be anywhere, so the whole dag is written again
+    SerializedScene result = {0};
+    if (!serialize_dag(scene, &result))
     {
-        int threadResult = 0;
-        SDL_WaitThread(threads[i], &threadResult);
+        fprintf(stderr, "[WARNING] Scene is too big for the octree dag, serializing chunks separately.\n");
+        scene->serialize_dag = false;
+        return;
+    }
 
-        // Create the gpu chunk
-        unsigned int x = (scene->chunks[i]->position >> 20) & 0x3FF;
-        unsigned int y = (scene->chunks[i]->position >> 10) & 0x3FF;
-        unsigned int z = scene->chunks[i]->position & 0x3FF;
-        unsigned int index = x + y * 12 + z * 12 * 12;
-        gpu_chunks[index] = (GPUChunk){scene->chunks[i]->position, totalSize, serialized_chunks[i].size, (unsigned int)true};
+    SerializedScene *serialized = &scene->serialized;
+    free(serialized->chunks_data);
+    free(serialized->gpu_chunks);
+    serialized->chunks_data = result.chunks_data;
+    serialized->chunks_data_size = result.chunks_data_size;
+    serialized->chunks_data_capacity = result.chunks_data_size;
+    serialized->gpu_chunks = result.gpu_chunks;
+    serialized->gpu_chunks_capacity = result.gpu_chunks_capacity;
+    serialized->gpu_chunks_count = result.gpu_chunks_count;
+    memcpy(serialized->chunks_min, result.chunks_min, sizeof(result.chunks_min));
+    memcpy(serialized->chunks_max, result.chunks_max, sizeof(result.chunks_max));
+    serialized->dedup_ratio = result.dedup_ratio;
+    serialized->chunks_data_resized = true;
+    serialized->gpu_chunks_changed = true;
 
-        // Add the size to the overall size
-        totalSize += serialized_chunks[i].size;
+    for (size_t i = 0; i < scene->chunks_size; i++)
+    {
+        scene->serialized_slots[i] = (SerializedChunkSlot){.generation = scene->chunks[i]->generation, .is_valid = true};
     }
+}
 
-    // printf("[INFO] Combining results, combined size %i, in bytes %i\n", totalSize, totalSize * sizeof(unsigned int));
+static SerializedScene *SerializeDirtyChunks(Scene *scene)
+{
+    if (!scene)
+        return NULL;
 
-    // Combine all results into a single buffer
-    unsigned int *combined_data = malloc(totalSize * sizeof(unsigned int));
-    unsigned int *current_position = combined_data;
+    SerializedScene *serialized = &scene->serialized;
+    serialized->changed_ranges_count = 0;
+    serialized->chunks_data_resized = false;
+    serialized->gpu_chunks_changed = scene->serialized_chunks_removed;
+    scene->serialized_chunks_removed = false;
 
-    for (int i = 0; i < scene->chunks_size; i++)
+    // New chunks get an empty slot
+    if (scene->serialized_slots_size < scene->chunks_size)
     {
-        memcpy(current_position, serialized_chunks[i].data, serialized_chunks[i].size * sizeof(unsigned int));
-        // for (int j = 0; j < serialized_chunks[i].size; j++)
-        // {
-        //     AOctree.print_binary(combined_data[j]);
-        //     printf("\n");
-        // }
-        // printf("\n");
-        current_position += serialized_chunks[i].size;
-        free(serialized_chunks[i].data); // Free each chunk's data after copying
+        scene->serialized_slots = realloc(scene->serialized_slots, scene->chunks_size * sizeof(SerializedChunkSlot));
+        if (!scene->serialized_slots)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for serialized chunk slots.\n");
+
+        memset(&scene->serialized_slots[scene->serialized_slots_size], 0, (scene->chunks_size - scene->serialized_slots_size) * sizeof(SerializedChunkSlot));
+        scene->serialized_slots_size = scene->chunks_size;
     }
 
-    // puts("[DEBUG] Combining successful");
+    // Switching between the dag and separate chunks or turning distance fields on or off writes everything again
+    if (scene->serialize_dag != scene->serialized_dag || scene->distance_fields != scene->serialized_distance_fields)
+    {
+        reset_serialized(scene);
+        scene->serialized_dag = scene->serialize_dag;
+        scene->serialized_distance_fields = scene->distance_fields;
+    }
 
-    free(threads);
-    free(serialized_chunks);
+    if (!serialized->gpu_chunks)
+        init_gpu_chunks(serialized);
+
+    // Find the chunks edited since the last call
+    Chunk **dirty_chunks = malloc(scene->chunks_size * sizeof(Chunk *));
+    size_t *dirty_indices = malloc(scene->chunks_size * sizeof(size_t));
+    if (scene->chunks_size && (!dirty_chunks || !dirty_indices))
+        ERROR_EXIT("[ERROR] Failed to allocate memory for dirty chunks.\n");
+
+    size_t dirty_count = 0;
+    for (size_t i = 0; i < scene->chunks_size; i++)
+    {
+        SerializedChunkSlot *slot = &scene->serialized_slots[i];
+        if (slot->is_valid && slot->generation == scene->chunks[i]->generation)
+            continue;
+
+        dirty_chunks[dirty_count] = scene->chunks[i];
+        dirty_indices[dirty_count++] = i;
+    }
+
+    if (scene->serialize_dag)
+    {
+        serialize_dirty_dag(scene, dirty_count);
+        if (scene->serialize_dag)
+        {
+            free(dirty_chunks);
+            free(dirty_indices);
+            return serialized;
+        }
+
+        // The dag didn't fit, write all chunks separately
+        reset_serialized(scene);
+        scene->serialized_dag = false;
+        init_gpu_chunks(serialized);
+
+        dirty_count = scene->chunks_size;
+        for (size_t i = 0; i < scene->chunks_size; i++)
+        {
+            dirty_chunks[i] = scene->chunks[i];
+            dirty_indices[i] = i;
+        }
+    }
+
+    serialized->dedup_ratio = 1.0f;
+
+    if (!scene->serialized_allocator)
+    {
+        reserve_chunks_data(serialized, SERIALIZED_INITIAL_CAPACITY);
+        scene->serialized_allocator = AOffsetAllocator.Init(serialized->chunks_data_capacity);
+    }
+
+    SerializedChunk *results = malloc(dirty_count * sizeof(SerializedChunk));
+    if (dirty_count && !results)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for dirty chunks.\n");
+
+    serialize_chunks(dirty_chunks, dirty_count, results, scene->distance_fields);
+
+    for (size_t i = 0; i < dirty_count; i++)
+    {
+        Chunk *chunk = dirty_chunks[i];
+        SerializedChunkSlot *slot = &scene->serialized_slots[dirty_indices[i]];
+        SerializedChunk *result = &results[i];
+        unsigned int size = result->size + result->attributes_size + result->distance_field_size;
+
+        // Chunks that outgrew their space get a new range, with some room to grow in place
+        if (!slot->is_valid || size > AOffsetAllocator.AllocationSize(scene->serialized_allocator, slot->node))
+        {
+            if (slot->is_valid)
+                AOffsetAllocator.Free(scene->serialized_allocator, slot->node);
+
+            OffsetAllocation allocation = allocate_serialized(scene, size + size / SERIALIZED_CHUNK_SLACK);
+            slot->offset = allocation.offset;
+            slot->node = allocation.node;
+        }
+
+        memcpy(&serialized->chunks_data[slot->offset], result->data, size * sizeof(unsigned int));
+        slot->size = size;
+        slot->generation = chunk->generation;
+        slot->is_valid = true;
+        add_changed_range(serialized, slot->offset, slot->size);
+
+        set_gpu_chunk(serialized, gpu_chunk_of(chunk, slot->offset, result));
+    }
+
+    compact_serialized(scene);
+    serialized->chunks_data_size = AOffsetAllocator.GetStats(scene->serialized_allocator).end;
+
+    if (serialized->chunks_data_resized)
+        serialized->changed_ranges_count = 0;
+
+    free(results);
+    free(dirty_chunks);
+    free(dirty_indices);
+
+    return serialized;
+}
+
+static Chunk *RemoveChunk(Scene *scene, int x, int y, int z)
+{
+    if (!scene)
+        return NULL;
+
+    ChunkKey key = CHUNK_KEY(x, y, z);
+    size_t index = AChunkMap.Get(scene->chunk_map, key);
+    if (index == CHUNK_MAP_NONE)
+        return NULL;
+
+    Chunk *chunk = scene->chunks[index];
+
+    if (scene->serialized_dag)
+    {
+        // Other chunks can share the chunk's subtrees, the dag is written again
+        reset_serialized(scene);
+    }
+    else if (index < scene->serialized_slots_size && scene->serialized_slots[index].is_valid)
+    {
+        AOffsetAllocator.Free(scene->serialized_allocator, scene->serialized_slots[index].node);
+        remove_gpu_chunk(&scene->serialized, x, y, z);
+        scene->serialized_chunks_removed = true;
+    }
+
+    // The last chunk takes its place, together with its slot
+    size_t last = scene->chunks_size - 1;
+    if (index != last)
+    {
+        scene->chunks[index] = scene->chunks[last];
+        AChunkMap.Set(scene->chunk_map, scene->chunks[index]->position, index);
+
+        if (index < scene->serialized_slots_size)
+            scene->serialized_slots[index] = last < scene->serialized_slots_size ? scene->serialized_slots[last] : (SerializedChunkSlot){0};
+    }
+
+    AChunkMap.Remove(scene->chunk_map, key);
+    scene->chunks_size = last;
+    if (scene->serialized_slots_size > scene->chunks_size)
+        scene->serialized_slots_size = scene->chunks_size;
+
+    return chunk;
+}
+
+static void UpdateLOD(SerializedScene *serialized_scene, vec3 camera_position, float lod_distance)
+{
+    if (!serialized_scene || lod_distance <= 0.0f)
+        return;
+
+    for (unsigned int i = 0; i < serialized_scene->gpu_chunks_capacity; i++)
+    {
+        GPUChunk *chunk = &serialized_scene->gpu_chunks[i];
+        if (chunk->format == OCTREE_FORMAT_NONE)
+            continue;
+
+        // Only packed octrees store the node attributes
+        unsigned int max_depth = CHUNK_DEPTH;
+        if (chunk->format == OCTREE_FORMAT_CHILD_OFFSET || chunk->format == OCTREE_FORMAT_BRICKS)
+        {
+            // Distance from the camera to the closest point of the chunk
+            int chunk_position[3] = {chunk->x, chunk->y, chunk->z};
+            float distance_squared = 0.0f;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float chunk_min = (float)chunk_position[axis] * CHUNK_SIZE;
+                float outside = fmaxf(chunk_min - camera_position[axis], camera_position[axis] - (chunk_min + CHUNK_SIZE));
+                if (outside > 0.0f)
+                    distance_squared += outside * outside;
+            }
+
+            // One level less every time the distance doubles
+            float distance = sqrtf(distance_squared);
+            if (distance > lod_distance)
+            {
+                int levels = (int)log2f(distance / lod_distance) + 1;
+                max_depth = levels >= CHUNK_DEPTH ? 0 : CHUNK_DEPTH - levels;
+            }
+        }
+
+        if (chunk->max_depth != max_depth)
+        {
+            chunk->max_depth = max_depth;
+            serialized_scene->gpu_chunks_changed = true;
+        }
+    }
+}
+
+// Clips the ray to the bounds of the chunks and starts its walk through the chunk grid, returns false if it misses them
+static bool begin_chunk_walk(SerializedScene *serialized_scene, const float origin[3], const float direction[3], float max_distance, DDAWalk *walk, float *t_end)
+{
+    const int *chunks_min = serialized_scene->chunks_min;
+    const int *chunks_max = serialized_scene->chunks_max;
+
+    float t = 0.0f;
+    *t_end = max_distance;
+    int entry_axis = -1;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float grid_start = (float)chunks_min[axis] * CHUNK_SIZE;
+        float grid_end = (float)(chunks_max[axis] + 1) * CHUNK_SIZE;
+        if (direction[axis] == 0.0f)
+        {
+            if (origin[axis] < grid_start || origin[axis] >= grid_end)
+                return false;
+
+            continue;
+        }
+
+        float inverse = 1.0f / direction[axis];
+        float t_near = (grid_start - origin[axis]) * inverse;
+        float t_far = (grid_end - origin[axis]) * inverse;
+        if (fminf(t_near, t_far) > t)
+        {
+            t = fminf(t_near, t_far);
+            entry_axis = axis;
+        }
+
+        *t_end = fminf(*t_end, fmaxf(t_near, t_far));
+    }
+
+    if (t > *t_end)
+        return false;
+
+    // Walk the chunk grid from the chunk the ray starts in, the same stepping as the shader
+    *walk = dda_begin(origin, direction, t, CHUNK_SIZE);
+    dda_enter_box(walk, origin, CHUNK_SIZE, chunks_min, chunks_max, entry_axis);
+
+    return true;
+}
+
+// Moves the walk to the next chunk, returns false if that's outside the bounds of the chunks or past t_end
+static bool step_chunk_walk(SerializedScene *serialized_scene, DDAWalk *walk, float t_end)
+{
+    dda_step(walk);
+    if (walk->cell[walk->axis] < serialized_scene->chunks_min[walk->axis] || walk->cell[walk->axis] > serialized_scene->chunks_max[walk->axis])
+        return false;
+
+    return walk->t <= t_end;
+}
+
+static bool Raycast(SerializedScene *serialized_scene, vec3 origin, vec3 direction, float max_distance, OctreeHit *hit, unsigned int *steps)
+{
+    if (steps)
+        *steps = 0;
+
+    if (!serialized_scene || !serialized_scene->gpu_chunks_count)
+        return false;
+
+    DDAWalk walk;
+    float t_end;
+    if (!begin_chunk_walk(serialized_scene, origin, direction, max_distance, &walk, &t_end))
+        return false;
+
+    const int *cell = walk.cell;
+    do
+    {
+        GPUChunk *chunk = get_gpu_chunk(serialized_scene, cell[0], cell[1], cell[2]);
+        float t_exit = fminf(walk.t_max[0], fminf(walk.t_max[1], walk.t_max[2]));
+
+        if (chunk)
+        {
+            float local_origin[3] = {origin[0] - (float)cell[0] * CHUNK_SIZE, origin[1] - (float)cell[1] * CHUNK_SIZE, origin[2] - (float)cell[2] * CHUNK_SIZE};
+            const unsigned int *chunk_data = &serialized_scene->chunks_data[chunk->offset];
+            const unsigned int *field = chunk->distance_field ? &chunk_data[chunk->distance_field] : NULL;
+
+            unsigned int chunk_steps;
+            bool is_hit = AOctree.RaycastField(chunk_data, chunk->size, chunk->format, CHUNK_DEPTH, chunk->max_depth, field, CHUNK_FIELD_DEPTH,
+                                               local_origin, direction, walk.t, fminf(t_exit, t_end), hit, &chunk_steps);
+            if (steps)
+                *steps += chunk_steps;
+
+            if (is_hit)
+            {
+                if (hit)
+                {
+                    for (int axis = 0; axis < 3; axis++)
+                        hit->voxel[axis] += cell[axis] * CHUNK_SIZE;
+                }
+
+                return true;
+            }
+        }
+    } while (step_chunk_walk(serialized_scene, &walk, t_end));
+
+    return false;
+}
+
+static unsigned int RaycastPacket(SerializedScene *serialized_scene, vec3 origin, const float directions[OCTREE_PACKET_SIZE][3], unsigned int lanes,
+                                  float max_distance, OctreeHit hits[OCTREE_PACKET_SIZE], unsigned int steps[OCTREE_PACKET_SIZE])
+{
+    for (unsigned int lane = 0; steps && lane < OCTREE_PACKET_SIZE; lane++)
+    {
+        if (lanes & (1U << lane))
+            steps[lane] = 0;
+    }
+
+    if (!serialized_scene || !serialized_scene->gpu_chunks_count)
+        return 0;
+
+    DDAWalk walks[OCTREE_PACKET_SIZE];
+    float t_ends[OCTREE_PACKET_SIZE];
+    unsigned int active = 0;
+    for (unsigned int lane = 0; lane < OCTREE_PACKET_SIZE; lane++)
+    {
+        if ((lanes & (1U << lane)) && begin_chunk_walk(serialized_scene, origin, directions[lane], max_distance, &walks[lane], &t_ends[lane]))
+            active |= 1U << lane;
+    }
+
+    unsigned int hit_lanes = 0;
+    while (active)
+    {
+        // Lanes in the same chunk as the first one are cast through it together, the others get their turn after
+        int cell[3];
+        memcpy(cell, walks[CTZ(active)].cell, sizeof(cell));
+
+        unsigned int group = 0;
+        float t_min[OCTREE_PACKET_SIZE];
+        float t_max[OCTREE_PACKET_SIZE];
+        for (unsigned int lane = 0; lane < OCTREE_PACKET_SIZE; lane++)
+        {
+            const DDAWalk *walk = &walks[lane];
+            if (!(active & (1U << lane)) || memcmp(walk->cell, cell, sizeof(cell)))
+                continue;
+
+            group |= 1U << lane;
+            t_min[lane] = walk->t;
+            t_max[lane] = fminf(fminf(walk->t_max[0], fminf(walk->t_max[1], walk->t_max[2])), t_ends[lane]);
+        }
+
+        GPUChunk *chunk = get_gpu_chunk(serialized_scene, cell[0], cell[1], cell[2]);
+        if (chunk)
+        {
+            float local_origin[3] = {origin[0] - (float)cell[0] * CHUNK_SIZE, origin[1] - (float)cell[1] * CHUNK_SIZE, origin[2] - (float)cell[2] * CHUNK_SIZE};
+            const unsigned int *chunk_data = &serialized_scene->chunks_data[chunk->offset];
+            const unsigned int *field = chunk->distance_field ? &chunk_data[chunk->distance_field] : NULL;
+
+            unsigned int chunk_steps[OCTREE_PACKET_SIZE];
+            unsigned int group_hits = AOctree.RaycastPacket(chunk_data, chunk->size, chunk->format, CHUNK_DEPTH, chunk->max_depth, field, CHUNK_FIELD_DEPTH,
+                                                            local_origin, directions, t_min, t_max, group, hits, chunk_steps);
+
+            for (unsigned int lane = 0; lane < OCTREE_PACKET_SIZE; lane++)
+            {
+                if (!(group & (1U << lane)))
+                    continue;
+
+                if (steps)
+                    steps[lane] += chunk_steps[lane];
+
+                if (group_hits & (1U << lane) && hits)
+                {
+                    for (int axis = 0; axis < 3; axis++)
+                        hits[lane].voxel[axis] += cell[axis] * CHUNK_SIZE;
+                }
+            }
+
+            hit_lanes |= group_hits;
+            active &= ~group_hits;
+            group &= ~group_hits;
+        }
+
+        for (unsigned int lane = 0; lane < OCTREE_PACKET_SIZE; lane++)
+        {
+            if ((group & (1U << lane)) && !step_chunk_walk(serialized_scene, &walks[lane], t_ends[lane]))
+                active &= ~(1U << lane);
+        }
+    }
 
-    return (SerializedScene){combined_data, totalSize, gpu_chunks};
+    return hit_lanes;
 }
 
 // Call write to file function on all chunks
@@ -242,8 +1182,18 @@ struct AScene AScene =
         .Update = Update,
         .AddCamera = AddCamera,
         .AddChunk = AddChunk,
+        .GetChunk = GetChunk,
+        .RemoveChunk = RemoveChunk,
+        .FillBox = FillBox,
+        .ClearBox = ClearBox,
+        .FillSphere = FillSphere,
+        .ClearSphere = ClearSphere,
         .Render = Render,
         .SerializeChunks = SerializeChunks,
+        .SerializeDirtyChunks = SerializeDirtyChunks,
+        .UpdateLOD = UpdateLOD,
+        .Raycast = Raycast,
+        .RaycastPacket = RaycastPacket,
         .WriteToFile = WriteToFile,
         .ReadFile = ReadFile,
 };
\ No newline at end of file
@@ -16,6 +16,61 @@
 
 #include "../../camera/camera.h"
 #include "../chunk/chunk.h"
+#include "chunk_map.h"
+#include "../../common/allocator/offset_allocator.h"
+
+typedef struct SerializedRange SerializedRange;
+struct SerializedRange
+{
+    size_t offset; // In bytes from the start of chunks_data
+    size_t size;   // In bytes
+};
+
+typedef struct SerializedScene SerializedScene;
+struct SerializedScene
+{
+    unsigned int *chunks_data;
+    unsigned int chunks_data_size;
+
+    /**
+     * Open addressing table of the chunks for the gpu, entries are found by chunk_hash of their coordinates
+     * and then the next ones are checked until the chunk or an empty entry is found. Capacity is a power of two
+     */
+    GPUChunk *gpu_chunks;
+    unsigned int gpu_chunks_capacity;
+    unsigned int gpu_chunks_count;
+
+    // Bounds of all chunks in chunk coordinates, min is bigger than max if there are none
+    int chunks_min[3];
+    int chunks_max[3];
+
+    // Octree nodes of all chunks divided by the nodes written, 1 without the dag
+    float dedup_ratio;
+
+    /**
+     * Set by AScene.SerializeDirtyChunks, what changed since the last call.
+     * If chunks_data_resized is set the whole chunks_data changed and its capacity grew, otherwise only
+     * the changed ranges have to be uploaded again
+     */
+    unsigned int chunks_data_capacity;
+    bool chunks_data_resized;
+    bool gpu_chunks_changed;
+
+    SerializedRange *changed_ranges;
+    unsigned int changed_ranges_count;
+    unsigned int changed_ranges_capacity;
+};
+
+// Where a chunk is in the persistent serialized scene
+typedef struct SerializedChunkSlot SerializedChunkSlot;
+struct SerializedChunkSlot
+{
+    unsigned int generation; // Chunk generation the slot was written from
+    unsigned int offset;
+    unsigned int size;
+    unsigned int node; // Allocation in the scene's allocator, the chunk gets a new one when it outgrows it
+    bool is_valid;
+};
 
 typedef struct Scene Scene;
 struct Scene
@@ -30,15 +85,28 @@ struct Scene
     size_t chunks_size;
 
     size_t chunks_count;
-};
 
-typedef struct SerializedScene SerializedScene;
-struct SerializedScene
-{
-    unsigned int *chunks_data;
-    unsigned int chunks_data_size;
+    // Index in chunks of every chunk key
+    ChunkMap *chunk_map;
 
-    GPUChunk *gpu_chunks;
+    // Serialize all chunks into one octree dag, identical subtrees in and across chunks are stored once
+    bool serialize_dag;
+
+    // Serialize an empty space distance field with every chunk so rays skip empty space in big steps, not used for the dag
+    bool distance_fields;
+
+    // Voxels from the camera the renderer walks rays through the chunks, 0 for the whole scene. The chunk streamer
+    // sets it to its view radius, nothing past it is loaded
+    float view_distance;
+
+    // Kept up to date by SerializeDirtyChunks, slot i belongs to chunks[i]
+    SerializedScene serialized;
+    SerializedChunkSlot *serialized_slots;
+    size_t serialized_slots_size;
+    bool serialized_dag; // If serialized is a dag
+    bool serialized_distance_fields;
+    OffsetAllocator *serialized_allocator; // Hands out the space in chunks_data, not used for the dag
+    bool serialized_chunks_removed;        // RemoveChunk changed the gpu chunks since the last SerializeDirtyChunks
 };
 
 struct AScene
@@ -61,12 +129,65 @@ struct AScene
 
     void (*AddCamera)(Scene *scene, Camera *camera);
 
-    void (*AddChunk)(Scene *scene, Chunk *chunk);
+    /**
+     * Adds the chunk to the scene, which owns it from then on. Returns false and skips the chunk if the scene already
+     * has one at its position, the caller still owns it then and has to delete it
+     */
+    bool (*AddChunk)(Scene *scene, Chunk *chunk);
+
+    // Returns the chunk at x, y, z in chunk coordinates or NULL
+    Chunk *(*GetChunk)(Scene *scene, int x, int y, int z);
+
+    /**
+     * Takes the chunk at x, y, z out of the scene and its serialized data, the next SerializeDirtyChunks
+     * publishes the change. Returns the chunk so the caller can delete it, NULL if there is none
+     */
+    Chunk *(*RemoveChunk)(Scene *scene, int x, int y, int z);
+
+    /**
+     * Region edits in world voxels across chunk borders, every chunk the region overlaps is edited with the same
+     * AChunk function. Filling adds the missing chunks. Return false if no voxel changed
+     */
+    bool (*FillBox)(Scene *scene, const int min[3], const int max[3], unsigned char color);
+    bool (*ClearBox)(Scene *scene, const int min[3], const int max[3]);
+    bool (*FillSphere)(Scene *scene, vec3 center, float radius, unsigned char color);
+    bool (*ClearSphere)(Scene *scene, vec3 center, float radius);
 
     void (*Render)(Scene *scene, Camera *camera, int width, int height);
 
+    // Serializes every chunk into a new serialized scene, the caller owns the result
     SerializedScene (*SerializeChunks)(Scene *scene);
 
+    /**
+     * Updates the scene's own serialized scene, only chunks that were edited since the last call are
+     * serialized again and written over their old data. The result is owned by the scene
+     */
+    SerializedScene *(*SerializeDirtyChunks)(Scene *scene);
+
+    /**
+     * Sets how deep the traversal goes into every chunk, chunks further than lod_distance voxels from the camera
+     * lose a level each time the distance doubles and draw the nodes at their last level from the node attributes.
+     * Keeps the cost of a ray bounded for far chunks, the gpu chunks have to be uploaded again if it changed any
+     */
+    void (*UpdateLOD)(SerializedScene *serialized_scene, vec3 camera_position, float lod_distance);
+
+    /**
+     * Cpu ray cast through serialized chunks, walks the chunk grid and the chunk octrees the same way the shader does,
+     * down to the max depth of every chunk.
+     * Hit voxel is in world voxel coordinates, distance is in units of direction. Steps is set to the amount of
+     * octree cells the ray visited, hit and steps can be NULL
+     */
+    bool (*Raycast)(SerializedScene *serialized_scene, vec3 origin, vec3 direction, float max_distance, OctreeHit *hit, unsigned int *steps);
+
+    /**
+     * Raycast for a packet of up to OCTREE_PACKET_SIZE rays from the same origin, lanes is a mask of the rays to cast.
+     * Every lane walks the chunk grid on its own, lanes in the same chunk are cast through its octree together with
+     * AOctree.RaycastPacket and the chunk is looked up once for them. Every lane gets the same hit and steps as its own
+     * Raycast. Returns the mask of the lanes that hit, hits and steps can be NULL
+     */
+    unsigned int (*RaycastPacket)(SerializedScene *serialized_scene, vec3 origin, const float directions[OCTREE_PACKET_SIZE][3], unsigned int lanes,
+                                  float max_distance, OctreeHit hits[OCTREE_PACKET_SIZE], unsigned int steps[OCTREE_PACKET_SIZE]);
+
     /**
      * Writes scene objects to a file
      */
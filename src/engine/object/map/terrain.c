@@ -0,0 +1,568 @@
+/**
+ * @file terrain.c
+ * @author https://github.com/shaderko
+ * @brief Procedural terrain, heightmaps and caves from gradient noise evaluated several samples at a time
+ * @version 0.1
+ * @date 2024-06-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+#include <limits.h>
+#include <SDL.h>
+
+#include "terrain.h"
+#include "../../util/util.h"
+#include "../../threading/threads_manager.h"
+
+/**
+ * Noise lanes, 8 with avx2 and 4 with sse2, which every x64 cpu has. The lane code is the scalar code below with
+ * the same operations in the same order, so both give the same noise
+ */
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+#define TERRAIN_LANES 8
+
+typedef __m256 LaneFloat;
+typedef __m256i LaneInt;
+
+#define lane_set(value) _mm256_set1_ps(value)
+#define lane_set_int(value) _mm256_set1_epi32((int)(value))
+#define lane_load(values) _mm256_loadu_ps(values)
+#define lane_store(values, lane) _mm256_storeu_ps(values, lane)
+#define lane_add(a, b) _mm256_add_ps(a, b)
+#define lane_sub(a, b) _mm256_sub_ps(a, b)
+#define lane_mul(a, b) _mm256_mul_ps(a, b)
+#define lane_floor(a) _mm256_floor_ps(a)
+#define lane_to_int(a) _mm256_cvttps_epi32(a)
+#define lane_as_int(a) _mm256_castps_si256(a)
+#define lane_as_float(a) _mm256_castsi256_ps(a)
+#define lane_add_int(a, b) _mm256_add_epi32(a, b)
+#define lane_mul_int(a, b) _mm256_mullo_epi32(a, b)
+#define lane_xor_int(a, b) _mm256_xor_si256(a, b)
+#define lane_and_int(a, b) _mm256_and_si256(a, b)
+#define lane_equal_int(a, b) _mm256_cmpeq_epi32(a, b)
+#define lane_shift_left(a, bits) _mm256_slli_epi32(a, bits)
+#define lane_shift_right(a, bits) _mm256_srli_epi32(a, bits)
+#define lane_select(mask, a, b) _mm256_blendv_ps(b, a, lane_as_float(mask))
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+#include <emmintrin.h>
+#define TERRAIN_LANES 4
+
+typedef __m128 LaneFloat;
+typedef __m128i LaneInt;
+
+#define lane_set(value) _mm_set1_ps(value)
+#define lane_set_int(value) _mm_set1_epi32((int)(value))
+#define lane_load(values) _mm_loadu_ps(values)
+#define lane_store(values, lane) _mm_storeu_ps(values, lane)
+#define lane_add(a, b) _mm_add_ps(a, b)
+#define lane_sub(a, b) _mm_sub_ps(a, b)
+#define lane_mul(a, b) _mm_mul_ps(a, b)
+#define lane_to_int(a) _mm_cvttps_epi32(a)
+#define lane_as_int(a) _mm_castps_si128(a)
+#define lane_as_float(a) _mm_castsi128_ps(a)
+#define lane_add_int(a, b) _mm_add_epi32(a, b)
+#define lane_xor_int(a, b) _mm_xor_si128(a, b)
+#define lane_and_int(a, b) _mm_and_si128(a, b)
+#define lane_equal_int(a, b) _mm_cmpeq_epi32(a, b)
+#define lane_shift_left(a, bits) _mm_slli_epi32(a, bits)
+#define lane_shift_right(a, bits) _mm_srli_epi32(a, bits)
+#define lane_select(mask, a, b) _mm_or_ps(_mm_and_ps(lane_as_float(mask), a), _mm_andnot_ps(lane_as_float(mask), b))
+
+// Truncation rounds negative values up, those lanes go one lower
+static inline LaneFloat lane_floor(LaneFloat a)
+{
+    LaneFloat truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+    return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, a), _mm_set1_ps(1.0f)));
+}
+
+// Sse2 only multiplies the even 32 bit lanes, the odd ones are shifted down and multiplied separately
+static inline LaneInt lane_mul_int(LaneInt a, LaneInt b)
+{
+    LaneInt even = _mm_mul_epu32(a, b);
+    LaneInt odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+#endif
+
+#ifdef TERRAIN_LANES
+#define TERRAIN_SIMD
+#else
+#define TERRAIN_LANES 1
+#endif
+
+#define TERRAIN_CAVE_SEED 0x9E3779B9U // Caves use other lattice gradients than the surface
+#define TERRAIN_NOISE_TOLERANCE 1e-5f
+
+static const TerrainSettings default_settings = {
+    .seed = 1337,
+    .height = 32.0f,
+    .amplitude = 24.0f,
+    .frequency = 1.0f / 96.0f,
+    .octaves = 4,
+    .cave_frequency = 1.0f / 24.0f,
+    .cave_threshold = 0.35f,
+    .surface_color = 2,
+    .soil_color = 3,
+    .rock_color = 4,
+    .soil_depth = 3,
+};
+
+// Hash of a lattice point, only the top 4 bits are used for the gradient
+static inline unsigned int lattice_hash(unsigned int seed, int x, int y, int z)
+{
+    unsigned int hash = seed ^ (unsigned int)x * 0x8DA6B343U ^ (unsigned int)y * 0xD8163841U ^ (unsigned int)z * 0xCB1AB31FU;
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6DU;
+    hash ^= hash >> 12;
+
+    return hash;
+}
+
+// Dot product with one of the 12 cube edge gradients, picked like in improved perlin noise
+static inline float gradient(unsigned int hash, float x, float y, float z)
+{
+    unsigned int h = hash >> 28;
+    float u = h & 8 ? y : x;
+    float v = !(h & 12) ? y : ((h & 13) == 12 ? x : z);
+
+    return (h & 1 ? -u : u) + (h & 2 ? -v : v);
+}
+
+static inline float fade(float t)
+{
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+static inline float lerp(float a, float b, float t)
+{
+    return a + t * (b - a);
+}
+
+// Gradient noise at x, y, z, about -1 to 1
+static float noise(unsigned int seed, float x, float y, float z)
+{
+    float floor_x = floorf(x);
+    float floor_y = floorf(y);
+    float floor_z = floorf(z);
+    int cell_x = (int)floor_x;
+    int cell_y = (int)floor_y;
+    int cell_z = (int)floor_z;
+    x -= floor_x;
+    y -= floor_y;
+    z -= floor_z;
+
+    float corners[8];
+    for (int i = 0; i < 8; i++)
+    {
+        int corner_x = i & 1;
+        int corner_y = (i >> 1) & 1;
+        int corner_z = (i >> 2) & 1;
+        unsigned int hash = lattice_hash(seed, cell_x + corner_x, cell_y + corner_y, cell_z + corner_z);
+        corners[i] = gradient(hash, x - corner_x, y - corner_y, z - corner_z);
+    }
+
+    float u = fade(x);
+    float v = fade(y);
+    float w = fade(z);
+
+    float near = lerp(lerp(corners[0], corners[1], u), lerp(corners[2], corners[3], u), v);
+    float far = lerp(lerp(corners[4], corners[5], u), lerp(corners[6], corners[7], u), v);
+    return lerp(near, far, w);
+}
+
+/**
+ * Fractal noise of CHUNK_SIZE samples along x starting at x, y, z in voxels, one scalar sample at a time.
+ * Used where there are no lanes and to check them
+ */
+static void noise_row_scalar(unsigned int seed, float frequency, unsigned int octaves, float x, float y, float z, float *values)
+{
+    for (int i = 0; i < CHUNK_SIZE; i++)
+    {
+        float value = 0.0f;
+        float amplitude = 1.0f;
+        float octave_frequency = frequency;
+
+        for (unsigned int octave = 0; octave < octaves; octave++)
+        {
+            value = value + amplitude * noise(seed + octave, (x + i) * octave_frequency, y * octave_frequency, z * octave_frequency);
+            amplitude *= 0.5f;
+            octave_frequency *= 2.0f;
+        }
+
+        values[i] = value;
+    }
+}
+
+#ifdef TERRAIN_SIMD
+
+static inline LaneInt lane_lattice_hash(LaneInt seed, LaneInt x, LaneInt y, LaneInt z)
+{
+    LaneInt hash = lane_xor_int(seed, lane_mul_int(x, lane_set_int(0x8DA6B343U)));
+    hash = lane_xor_int(hash, lane_mul_int(y, lane_set_int(0xD8163841U)));
+    hash = lane_xor_int(hash, lane_mul_int(z, lane_set_int(0xCB1AB31FU)));
+    hash = lane_xor_int(hash, lane_shift_right(hash, 15));
+    hash = lane_mul_int(hash, lane_set_int(0x2C1B3C6DU));
+    hash = lane_xor_int(hash, lane_shift_right(hash, 12));
+
+    return hash;
+}
+
+// Same as gradient, the branches are masks and the signs are flipped with the low bits of h
+static inline LaneFloat lane_gradient(LaneInt hash, LaneFloat x, LaneFloat y, LaneFloat z)
+{
+    LaneInt h = lane_shift_right(hash, 28);
+    LaneInt zero = lane_set_int(0);
+
+    LaneFloat u = lane_select(lane_equal_int(lane_and_int(h, lane_set_int(8)), zero), x, y);
+    LaneFloat v = lane_select(lane_equal_int(lane_and_int(h, lane_set_int(13)), lane_set_int(12)), x, z);
+    v = lane_select(lane_equal_int(lane_and_int(h, lane_set_int(12)), zero), y, v);
+
+    u = lane_as_float(lane_xor_int(lane_as_int(u), lane_shift_left(lane_and_int(h, lane_set_int(1)), 31)));
+    v = lane_as_float(lane_xor_int(lane_as_int(v), lane_shift_left(lane_and_int(h, lane_set_int(2)), 30)));
+    return lane_add(u, v);
+}
+
+static inline LaneFloat lane_fade(LaneFloat t)
+{
+    LaneFloat inner = lane_add(lane_mul(t, lane_sub(lane_mul(t, lane_set(6.0f)), lane_set(15.0f))), lane_set(10.0f));
+    return lane_mul(lane_mul(lane_mul(t, t), t), inner);
+}
+
+static inline LaneFloat lane_lerp(LaneFloat a, LaneFloat b, LaneFloat t)
+{
+    return lane_add(a, lane_mul(t, lane_sub(b, a)));
+}
+
+static LaneFloat lane_noise(LaneInt seed, LaneFloat x, LaneFloat y, LaneFloat z)
+{
+    LaneFloat floor_x = lane_floor(x);
+    LaneFloat floor_y = lane_floor(y);
+    LaneFloat floor_z = lane_floor(z);
+    LaneInt cell[3] = {lane_to_int(floor_x), lane_to_int(floor_y), lane_to_int(floor_z)};
+    x = lane_sub(x, floor_x);
+    y = lane_sub(y, floor_y);
+    z = lane_sub(z, floor_z);
+
+    LaneInt one_int = lane_set_int(1);
+    LaneFloat one = lane_set(1.0f);
+
+    LaneFloat corners[8];
+    for (int i = 0; i < 8; i++)
+    {
+        LaneInt corner_x = i & 1 ? lane_add_int(cell[0], one_int) : cell[0];
+        LaneInt corner_y = (i >> 1) & 1 ? lane_add_int(cell[1], one_int) : cell[1];
+        LaneInt corner_z = (i >> 2) & 1 ? lane_add_int(cell[2], one_int) : cell[2];
+        LaneInt hash = lane_lattice_hash(seed, corner_x, corner_y, corner_z);
+        corners[i] = lane_gradient(hash, i & 1 ? lane_sub(x, one) : x, (i >> 1) & 1 ? lane_sub(y, one) : y, (i >> 2) & 1 ? lane_sub(z, one) : z);
+    }
+
+    LaneFloat u = lane_fade(x);
+    LaneFloat v = lane_fade(y);
+    LaneFloat w = lane_fade(z);
+
+    LaneFloat near = lane_lerp(lane_lerp(corners[0], corners[1], u), lane_lerp(corners[2], corners[3], u), v);
+    LaneFloat far = lane_lerp(lane_lerp(corners[4], corners[5], u), lane_lerp(corners[6], corners[7], u), v);
+    return lane_lerp(near, far, w);
+}
+
+// Same samples as noise_row_scalar, TERRAIN_LANES of them at a time
+static void noise_row(unsigned int seed, float frequency, unsigned int octaves, float x, float y, float z, float *values)
+{
+    float offsets[TERRAIN_LANES];
+    for (int lane = 0; lane < TERRAIN_LANES; lane++)
+    {
+        offsets[lane] = (float)lane;
+    }
+    LaneFloat lane_offsets = lane_load(offsets);
+
+    for (int i = 0; i < CHUNK_SIZE; i += TERRAIN_LANES)
+    {
+        LaneFloat sample_x = lane_add(lane_set(x + i), lane_offsets);
+        LaneFloat value = lane_set(0.0f);
+        float amplitude = 1.0f;
+        float octave_frequency = frequency;
+
+        for (unsigned int octave = 0; octave < octaves; octave++)
+        {
+            LaneFloat octave_noise = lane_noise(lane_set_int(seed + octave), lane_mul(sample_x, lane_set(octave_frequency)),
+                                                lane_set(y * octave_frequency), lane_set(z * octave_frequency));
+            value = lane_add(value, lane_mul(lane_set(amplitude), octave_noise));
+            amplitude *= 0.5f;
+            octave_frequency *= 2.0f;
+        }
+
+        lane_store(&values[i], value);
+    }
+}
+
+#else
+
+#define noise_row noise_row_scalar
+
+#endif
+
+static Terrain *Init(const TerrainSettings *settings)
+{
+    Terrain *terrain = malloc(sizeof(Terrain));
+    if (!terrain)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for terrain.\n");
+
+    terrain->settings = settings ? *settings : default_settings;
+    if (terrain->settings.octaves == 0)
+        terrain->settings.octaves = 1;
+
+    // Heightmap noise is scaled to about -1 to 1 times the amplitude, twice that leaves room for the peaks
+    terrain->highest = (int)ceilf(terrain->settings.height + terrain->settings.amplitude * 2.0f);
+
+    return terrain;
+}
+
+static void Delete(Terrain *terrain)
+{
+    free(terrain);
+}
+
+/**
+ * Surface height of every column of the chunk at x, z in world voxels, column z * CHUNK_SIZE + x.
+ * Range is set to the lowest and highest of them
+ */
+static void heightmap(Terrain *terrain, int x, int z, int *heights, int range[2])
+{
+    TerrainSettings *settings = &terrain->settings;
+
+    // The fractal sum is scaled back to about -1 to 1, so amplitude is the reach of the surface
+    float scale = settings->amplitude / (2.0f - ldexpf(1.0f, 1 - (int)settings->octaves));
+
+    float values[CHUNK_SIZE];
+    range[0] = INT_MAX;
+    range[1] = INT_MIN;
+    for (int column_z = 0; column_z < CHUNK_SIZE; column_z++)
+    {
+        noise_row(settings->seed, settings->frequency, settings->octaves, (float)x, 0.0f, (float)(z + column_z), values);
+
+        for (int column_x = 0; column_x < CHUNK_SIZE; column_x++)
+        {
+            int height = (int)floorf(settings->height + values[column_x] * scale);
+            heights[column_z * CHUNK_SIZE + column_x] = height;
+            range[0] = height < range[0] ? height : range[0];
+            range[1] = height > range[1] ? height : range[1];
+        }
+    }
+}
+
+// Generates the chunk at x, y, z in chunk coordinates, returns the amount of voxels it got
+static unsigned int generate_chunk(Terrain *terrain, Chunk *chunk, int x, int y, int z)
+{
+    TerrainSettings *settings = &terrain->settings;
+
+    int base[3] = {x * CHUNK_SIZE, y * CHUNK_SIZE, z * CHUNK_SIZE};
+    if (base[1] > terrain->highest)
+        return 0;
+
+    int heights[CHUNK_SIZE * CHUNK_SIZE];
+    int range[2];
+    heightmap(terrain, base[0], base[2], heights, range);
+    if (range[1] < base[1])
+        return 0;
+
+    bool caves = settings->cave_threshold < 1.0f;
+
+    // Chunks under the soil of every column are solid rock, without caves they are one leaf
+    if (!caves && base[1] + CHUNK_SIZE - 1 <= range[0] - (int)settings->soil_depth)
+    {
+        int min[3] = {0, 0, 0};
+        int max[3] = {CHUNK_SIZE - 1, CHUNK_SIZE - 1, CHUNK_SIZE - 1};
+        AChunk.FillBox(chunk, min, max, settings->rock_color);
+        return CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
+    }
+
+    OctreeVoxel *voxels = malloc(CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE * sizeof(OctreeVoxel));
+    if (!voxels)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for terrain voxels.\n");
+
+    float density[CHUNK_SIZE];
+    unsigned int count = 0;
+
+    for (int voxel_z = 0; voxel_z < CHUNK_SIZE; voxel_z++)
+    {
+        int *row_heights = &heights[voxel_z * CHUNK_SIZE];
+        int row_highest = INT_MIN;
+        for (int voxel_x = 0; voxel_x < CHUNK_SIZE; voxel_x++)
+        {
+            row_highest = row_heights[voxel_x] > row_highest ? row_heights[voxel_x] : row_highest;
+        }
+
+        for (int voxel_y = 0; voxel_y < CHUNK_SIZE && base[1] + voxel_y <= row_highest; voxel_y++)
+        {
+            int world_y = base[1] + voxel_y;
+            if (caves)
+                noise_row(settings->seed ^ TERRAIN_CAVE_SEED, settings->cave_frequency, 1, (float)base[0], (float)world_y, (float)(base[2] + voxel_z), density);
+
+            for (int voxel_x = 0; voxel_x < CHUNK_SIZE; voxel_x++)
+            {
+                int height = row_heights[voxel_x];
+                if (world_y > height || (caves && density[voxel_x] > settings->cave_threshold))
+                    continue;
+
+                unsigned char color = world_y == height ? settings->surface_color : (world_y > height - (int)settings->soil_depth ? settings->soil_color : settings->rock_color);
+                voxels[count++] = (OctreeVoxel){voxel_x, voxel_y, voxel_z, color};
+            }
+        }
+    }
+
+    // The whole chunk goes into the octree in one sorted pass
+    if (count)
+        AChunk.AddBatch(chunk, voxels, count);
+
+    free(voxels);
+    return count;
+}
+
+static bool Load(Chunk *chunk, int x, int y, int z, void *data)
+{
+    return generate_chunk(data, chunk, x, y, z) > 0;
+}
+
+typedef struct TerrainJob TerrainJob;
+struct TerrainJob
+{
+    Terrain *terrain;
+    int position[3];
+    Chunk *chunk; // NULL if the chunk is empty
+    unsigned int voxels;
+};
+
+static void *generate_job(void *data)
+{
+    TerrainJob *job = data;
+
+    job->chunk = AChunk.Init((vec3){(float)job->position[0], (float)job->position[1], (float)job->position[2]});
+    job->voxels = generate_chunk(job->terrain, job->chunk, job->position[0], job->position[1], job->position[2]);
+    if (!job->voxels)
+    {
+        AChunk.Delete(job->chunk);
+        job->chunk = NULL;
+    }
+
+    return NULL;
+}
+
+static void Generate(Terrain *terrain, Scene *scene, const int min[3], const int max[3], TerrainStats *stats)
+{
+    if (!terrain || !scene || min[0] > max[0] || min[1] > max[1] || min[2] > max[2])
+        return;
+
+    size_t count = (size_t)(max[0] - min[0] + 1) * (max[1] - min[1] + 1) * (max[2] - min[2] + 1);
+    TerrainJob *jobs = malloc(count * sizeof(TerrainJob));
+    if (!jobs)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for terrain jobs.\n");
+
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    // Chunks the scene already has are kept, nothing is generated for them
+    ThreadsManager *manager = AThreadsManager.Default();
+    size_t index = 0;
+    for (int z = min[2]; z <= max[2]; z++)
+    {
+        for (int y = min[1]; y <= max[1]; y++)
+        {
+            for (int x = min[0]; x <= max[0]; x++)
+            {
+                if (AScene.GetChunk(scene, x, y, z))
+                    continue;
+
+                jobs[index] = (TerrainJob){.terrain = terrain, .position = {x, y, z}};
+                AThreadsManager.Add(manager, generate_job, &jobs[index]);
+                index++;
+            }
+        }
+    }
+    AThreadsManager.Wait(manager);
+    count = index;
+
+    Uint64 end = SDL_GetPerformanceCounter();
+
+    // Only this thread touches the scene
+    unsigned int solid_chunks = 0;
+    unsigned long long solid_voxels = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!jobs[i].chunk)
+            continue;
+
+        if (!AScene.AddChunk(scene, jobs[i].chunk))
+        {
+            AChunk.Delete(jobs[i].chunk);
+            continue;
+        }
+
+        solid_voxels += jobs[i].voxels;
+        solid_chunks++;
+    }
+
+    if (stats)
+    {
+        stats->chunks = (unsigned int)count;
+        stats->solid_chunks = solid_chunks;
+        stats->voxels = (unsigned long long)count * CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
+        stats->solid_voxels = solid_voxels;
+        stats->threads = manager->workers_count;
+        stats->seconds = (double)(end - start) / (double)SDL_GetPerformanceFrequency();
+        stats->voxels_per_second_per_core = stats->seconds > 0.0 ? stats->voxels / stats->seconds / stats->threads : 0.0;
+
+        printf("[INFO] Terrain of %u chunks took %f ms, %.0f voxels/s per core on %d threads with %d noise lanes, %u chunks with %llu voxels\n",
+               stats->chunks, stats->seconds * 1000.0, stats->voxels_per_second_per_core, stats->threads, TERRAIN_LANES, stats->solid_chunks, stats->solid_voxels);
+    }
+
+    free(jobs);
+}
+
+static bool ValidateNoise(Terrain *terrain, unsigned int count)
+{
+    if (!terrain)
+        return false;
+
+    TerrainSettings *settings = &terrain->settings;
+    float lanes[CHUNK_SIZE];
+    float scalar[CHUNK_SIZE];
+    float largest = 0.0f;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        // Negative positions too, lane_floor has to round those down
+        float x = (float)(rand() % 4096 - 2048);
+        float y = (float)(rand() % 4096 - 2048);
+        float z = (float)(rand() % 4096 - 2048);
+
+        noise_row(settings->seed, settings->frequency, settings->octaves, x, y, z, lanes);
+        noise_row_scalar(settings->seed, settings->frequency, settings->octaves, x, y, z, scalar);
+
+        for (int sample = 0; sample < CHUNK_SIZE; sample++)
+        {
+            float difference = fabsf(lanes[sample] - scalar[sample]);
+            largest = difference > largest ? difference : largest;
+        }
+    }
+
+    printf("[INFO] Terrain noise with %d lanes differs from the scalar noise by at most %g\n", TERRAIN_LANES, largest);
+    return largest <= TERRAIN_NOISE_TOLERANCE;
+}
+
+extern struct ATerrain ATerrain;
+struct ATerrain ATerrain =
+    {
+        .Init = Init,
+        .Delete = Delete,
+        .Load = Load,
+        .Generate = Generate,
+        .ValidateNoise = ValidateNoise,
+};
@@ -0,0 +1,90 @@
+/**
+ * @file terrain.h
+ * @author https://github.com/shaderko
+ * @brief Procedural terrain, heightmaps and caves from gradient noise evaluated several samples at a time
+ * @version 0.1
+ * @date 2024-06-24
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <stdbool.h>
+
+#include "scene.h"
+#include "chunk_streamer.h"
+
+typedef struct TerrainSettings TerrainSettings;
+struct TerrainSettings
+{
+    unsigned int seed;
+
+    // Surface, heights are in world voxels
+    float height;          // Average height of the surface
+    float amplitude;       // Furthest the surface gets from height
+    float frequency;       // Of the first octave, in 1 / voxels
+    unsigned int octaves; // Each one has twice the frequency and half the amplitude of the one before
+
+    // Caves, voxels where the 3D noise is above the threshold are carved out. A threshold of 1 or more disables them
+    float cave_frequency;
+    float cave_threshold;
+
+    unsigned char surface_color;
+    unsigned char soil_color;
+    unsigned char rock_color;
+    unsigned int soil_depth; // Voxels of soil under the surface voxel
+};
+
+typedef struct Terrain Terrain;
+struct Terrain
+{
+    TerrainSettings settings;
+    int highest; // Highest surface the settings can make, chunks above it aren't generated
+};
+
+typedef struct TerrainStats TerrainStats;
+struct TerrainStats
+{
+    unsigned int chunks;       // Chunks generated, empty ones included
+    unsigned int solid_chunks; // Chunks that got voxels and were added to the scene
+    unsigned long long voxels; // Voxels generated, every voxel of every chunk
+    unsigned long long solid_voxels;
+
+    int threads;
+    double seconds;
+    double voxels_per_second_per_core;
+};
+
+struct ATerrain
+{
+    // Settings can be NULL for rolling hills with caves
+    Terrain *(*Init)(const TerrainSettings *settings);
+    void (*Delete)(Terrain *terrain);
+
+    /**
+     * ChunkLoader for AChunkStreamer with the terrain as loader data, so chunks are generated on the streamer's
+     * workers a few every frame. Returns false if the chunk has no voxels
+     */
+    bool (*Load)(Chunk *chunk, int x, int y, int z, void *data);
+
+    /**
+     * Generates every chunk from min to max in chunk coordinates on the default threads manager, one chunk per job,
+     * and adds the ones with voxels to the scene. Chunks the scene already has are left as they are and not generated.
+     * Blocks until they are done, for startup and tools.
+     * Stats can be NULL, otherwise they are filled and printed
+     */
+    void (*Generate)(Terrain *terrain, Scene *scene, const int min[3], const int max[3], TerrainStats *stats);
+
+    /**
+     * Compares the noise lanes with the scalar noise at count rows of random positions, prints the largest difference.
+     * Returns false if they differ by more than rounding
+     */
+    bool (*ValidateNoise)(Terrain *terrain, unsigned int count);
+};
+
+extern struct ATerrain ATerrain;
+
+#endif
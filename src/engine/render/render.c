@@ -11,6 +11,7 @@
 
 #include <glad/glad.h>
 #include <time.h>
+#include <float.h>
 
 #include "render.h"
 #include "../util/util.h"
@@ -18,6 +19,8 @@
 #include "../camera/camera.h"
 #include "../object/map/scene.h"
 
+#define RENDER_LOD_DISTANCE 256.0f // Voxels from the camera where chunks start to lose detail
+
 static WindowRender *active_render = NULL;
 
 static WindowRender *Init()
@@ -99,35 +102,57 @@ static void RenderSceneChunks(Scene *scene, Camera *camera, int width, int heigh
     glGenQueries(2, queries);
     glBeginQuery(GL_TIME_ELAPSED, queries[0]);
 
-    static SerializedScene serialized_scene = {0};
-    if (serialized_scene.chunks_data_size == 0)
-    {
-        puts("[INFO] Serializing scene.");
-        serialized_scene = AScene.SerializeChunks(scene);
-
-        // Now we pass the data to the gpu
+    // Only chunks edited since the last frame are serialized and uploaded again
+    SerializedScene *serialized_scene = AScene.SerializeDirtyChunks(scene);
 
-        // puts("Dispatching compute shader");
-        // puts("[INFO] Creating the gpu chunk buffer");
-        // printf("%u\n", serialized_scene.chunks_data_size);
+    // Far chunks are traversed to fewer levels, so rays through them stay cheap
+    AScene.UpdateLOD(serialized_scene, camera->position, RENDER_LOD_DISTANCE);
 
-        // Create and initialize buffer object for chunk data
-        GLuint gpu_chunk_buffer;
+    static GLuint gpu_chunk_buffer = 0;
+    static GLuint chunk_buffer = 0;
+    static unsigned int gpu_chunk_buffer_capacity = 0;
+    if (!gpu_chunk_buffer)
+    {
+        // Create the buffer objects for chunk data
         glGenBuffers(1, &gpu_chunk_buffer);
+        glGenBuffers(1, &chunk_buffer);
+    }
+
+    if (serialized_scene->gpu_chunks_capacity != gpu_chunk_buffer_capacity)
+    {
+        // The shader takes the size of the chunk table from the buffer, so it's as big as the table
+        gpu_chunk_buffer_capacity = serialized_scene->gpu_chunks_capacity;
         glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu_chunk_buffer);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, 1728 * sizeof(GPUChunk), serialized_scene.gpu_chunks, GL_DYNAMIC_DRAW);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, gpu_chunk_buffer_capacity * sizeof(GPUChunk), serialized_scene->gpu_chunks, GL_DYNAMIC_DRAW);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, gpu_chunk_buffer);
+    }
+    else if (serialized_scene->gpu_chunks_changed)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu_chunk_buffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpu_chunk_buffer_capacity * sizeof(GPUChunk), serialized_scene->gpu_chunks);
+    }
 
-        // puts("[INFO] Creating the chunk buffer");
-
-        GLuint chunk_buffer;
-        glGenBuffers(1, &chunk_buffer);
+    if (serialized_scene->chunks_data_resized)
+    {
+        // The buffer has the same capacity as the cpu array, so chunks can grow without recreating it
         glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunk_buffer);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, serialized_scene.chunks_data_size * sizeof(unsigned int), serialized_scene.chunks_data, GL_DYNAMIC_DRAW);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, serialized_scene->chunks_data_capacity * sizeof(unsigned int), serialized_scene->chunks_data, GL_DYNAMIC_DRAW);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, chunk_buffer);
     }
+    else if (serialized_scene->changed_ranges_count)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunk_buffer);
+        for (unsigned int i = 0; i < serialized_scene->changed_ranges_count; i++)
+        {
+            SerializedRange *range = &serialized_scene->changed_ranges[i];
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, range->offset, range->size, (unsigned char *)serialized_scene->chunks_data + range->offset);
+        }
+    }
 
     glUniform3fv(glGetUniformLocation(active_render->shader, "cameraPos"), 1, camera->position);
+    glUniform3iv(glGetUniformLocation(active_render->shader, "chunksMin"), 1, serialized_scene->chunks_min);
+    glUniform3iv(glGetUniformLocation(active_render->shader, "chunksMax"), 1, serialized_scene->chunks_max);
+    glUniform1f(glGetUniformLocation(active_render->shader, "viewDistance"), scene->view_distance > 0.0f ? scene->view_distance : FLT_MAX);
     glUniformMatrix4fv(glGetUniformLocation(active_render->shader, "projection"), 1, GL_FALSE, &camera->projection[0][0]);
     glUniformMatrix4fv(glGetUniformLocation(active_render->shader, "view"), 1, GL_FALSE, &camera->view[0][0]);
 
@@ -153,9 +178,6 @@ static void RenderSceneChunks(Scene *scene, Camera *camera, int width, int heigh
     // glDeleteBuffers(1, &gpu_chunk_buffer);
     // glDeleteBuffers(1, &chunk_buffer);
 
-    // free(serialized_scene.chunks_data);
-    // free(serialized_scene.gpu_chunks);
-
     glEndQuery(GL_TIME_ELAPSED);
     glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &timeElapsed);
     printf("Time taken: %f ms\n", timeElapsed / 1000000.0);
@@ -10,6 +10,8 @@
  */
 
 #include <glad/glad.h>
+#include <stdio.h>
+#include <string.h>
 #include "render_init.h"
 #include "../util/util.h"
 #include "../io/io.h"
@@ -97,6 +99,105 @@ u32 render_shader_create_frag_vert(const char *path)
     return shader;
 }
 
+#define SHADER_MAX_INCLUDE_DEPTH 8
+
+/**
+ * Reads a shader and puts the files it includes with #include "file" in place of the directive, GLSL has no includes
+ * of its own. Files are found next to the including file, headers shared with the c code live in the shaders directory
+ */
+static File shader_file_read(const char *path, int include_depth)
+{
+    File file = io_file_read(path);
+    if (!file.is_valid || !strstr(file.data, "#include"))
+        return file;
+
+    if (include_depth >= SHADER_MAX_INCLUDE_DEPTH)
+    {
+        free(file.data);
+        ERROR_RETURN((File){.is_valid = false}, "shader includes nested too deep: %s\n", path);
+    }
+
+    const char *slash = strrchr(path, '/');
+    size_t directory_length = slash ? (size_t)(slash - path) + 1 : 0;
+
+    char *result = NULL;
+    size_t result_length = 0;
+    int line_number = 1;
+    const char *line = file.data;
+    while (*line)
+    {
+        const char *line_end = strchr(line, '\n');
+        size_t line_length = line_end ? (size_t)(line_end - line) + 1 : strlen(line);
+
+        const char *text = line;
+        size_t text_length = line_length;
+        File included = {.is_valid = false};
+        char line_directive[32];
+
+        const char *directive = line;
+        while (*directive == ' ' || *directive == '\t')
+            directive++;
+
+        if (!strncmp(directive, "#include \"", 10))
+        {
+            const char *name = directive + 10;
+            const char *name_end = strchr(name, '"');
+            if (!name_end || (line_end && name_end > line_end))
+            {
+                free(result);
+                free(file.data);
+                ERROR_RETURN((File){.is_valid = false}, "bad include in shader: %s line %d\n", path, line_number);
+            }
+
+            size_t name_length = (size_t)(name_end - name);
+            char *include_path = malloc(directory_length + name_length + 1);
+            if (!include_path)
+                ERROR_EXIT("[ERROR] Failed to allocate memory for shader include path.\n");
+
+            memcpy(include_path, path, directory_length);
+            memcpy(include_path + directory_length, name, name_length);
+            include_path[directory_length + name_length] = '\0';
+
+            included = shader_file_read(include_path, include_depth + 1);
+            free(include_path);
+            if (!included.is_valid)
+            {
+                free(result);
+                free(file.data);
+                return included;
+            }
+
+            // Keep the line numbers of compile errors in the including file right
+            text = included.data;
+            text_length = strlen(included.data);
+            snprintf(line_directive, sizeof(line_directive), "\n#line %d\n", line_number + 1);
+        }
+
+        size_t directive_length = included.is_valid ? strlen(line_directive) : 0;
+        char *grown = realloc(result, result_length + text_length + directive_length + 1);
+        if (!grown)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for shader source.\n");
+
+        result = grown;
+        memcpy(result + result_length, text, text_length);
+        result_length += text_length;
+        if (included.is_valid)
+        {
+            memcpy(result + result_length, line_directive, directive_length);
+            result_length += directive_length;
+            free(included.data);
+        }
+
+        result[result_length] = '\0';
+        line += line_length;
+        line_number++;
+    }
+
+    free(file.data);
+
+    return (File){.data = result, .len = result_length, .is_valid = true};
+}
+
 u32 render_shader_create_comp(const char *path)
 {
     // Create path
@@ -111,7 +212,7 @@ u32 render_shader_create_comp(const char *path)
     int success;
     char log[512];
 
-    File file_compute = io_file_read(compute_shader_path);
+    File file_compute = shader_file_read(compute_shader_path, 0);
     if (!file_compute.is_valid)
     {
         ERROR_EXIT("error reading shader: %s\n", compute_shader_path);
@@ -0,0 +1,348 @@
+/**
+ * @file software_render.c
+ * @author https://github.com/shaderko
+ * @brief Headless cpu renderer for serialized chunks, used where there is no gpu.
+ * @version 0.1
+ * @date 2024-06-02
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+#include <SDL.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SOFTWARE_RENDER_SSE
+#endif
+
+#include "software_render.h"
+#include "../../util/util.h"
+#include "../../threading/threads_manager.h"
+
+#define TILE_SIZE 32
+#define PACKET_SIZE OCTREE_PACKET_SIZE // Rays traced together, one sse register wide
+
+typedef struct RenderContext RenderContext;
+struct RenderContext
+{
+    SerializedScene *serialized_scene;
+    SoftwareImage *image;
+
+    vec3 origin;
+
+    // Unnormalized ray direction is base + x_step * ndc x + y_step * ndc y, same math as the shader
+    float direction_base[3];
+    float direction_x[3];
+    float direction_y[3];
+
+    int tiles_x;
+    int tiles_count;
+    SDL_atomic_t next_tile;
+
+    SDL_atomic_t rays;
+    SDL_atomic_t hits;
+
+    // Octree cells visited by all rays, too many for an atomic int
+    SDL_SpinLock steps_lock;
+    unsigned long long steps;
+};
+
+static void setup_directions(RenderContext *context, Camera *camera)
+{
+    mat4x4 inverse_projection;
+    mat4x4 inverse_view;
+    mat4x4_invert(inverse_projection, camera->projection);
+    mat4x4_invert(inverse_view, camera->view);
+
+    // Eye ray is inverse(projection) * (x, y, -1, 1), then z = -1 and w = 0
+    float eye_base[2];
+    float eye_x[2];
+    float eye_y[2];
+    for (int i = 0; i < 2; i++)
+    {
+        eye_base[i] = -inverse_projection[2][i] + inverse_projection[3][i];
+        eye_x[i] = inverse_projection[0][i];
+        eye_y[i] = inverse_projection[1][i];
+    }
+
+    // World ray is inverse(view) * (eye x, eye y, -1, 0)
+    for (int i = 0; i < 3; i++)
+    {
+        context->direction_base[i] = inverse_view[0][i] * eye_base[0] + inverse_view[1][i] * eye_base[1] - inverse_view[2][i];
+        context->direction_x[i] = inverse_view[0][i] * eye_x[0] + inverse_view[1][i] * eye_x[1];
+        context->direction_y[i] = inverse_view[0][i] * eye_y[0] + inverse_view[1][i] * eye_y[1];
+    }
+}
+
+static void write_pixel(SoftwareImage *image, int x, int y, bool hit)
+{
+    float value = hit ? 1.0f : 0.0f;
+    float *pixel = &image->pixels[(y * image->width + x) * 3];
+    pixel[0] = value;
+    pixel[1] = value;
+    pixel[2] = value;
+}
+
+#ifdef SOFTWARE_RENDER_SSE
+
+// Normalized directions of PACKET_SIZE neighbouring pixels of a row, all lanes at once
+static void packet_directions(RenderContext *context, int x, int y, float directions[PACKET_SIZE][3])
+{
+    SoftwareImage *image = context->image;
+
+    __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    __m128 pixel_x = _mm_add_ps(_mm_set1_ps((float)x + 0.5f), lane);
+    __m128 ndc_x = _mm_sub_ps(_mm_mul_ps(_mm_div_ps(pixel_x, _mm_set1_ps((float)image->width)), _mm_set1_ps(2.0f)), _mm_set1_ps(1.0f));
+    float ndc_y = ((float)y + 0.5f) / (float)image->height * 2.0f - 1.0f;
+
+    __m128 direction[3];
+    for (int i = 0; i < 3; i++)
+    {
+        __m128 row = _mm_set1_ps(context->direction_base[i] + context->direction_y[i] * ndc_y);
+        direction[i] = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(context->direction_x[i]), ndc_x));
+    }
+
+    __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(direction[0], direction[0]), _mm_mul_ps(direction[1], direction[1])), _mm_mul_ps(direction[2], direction[2])));
+
+    float lanes[3][PACKET_SIZE];
+    for (int i = 0; i < 3; i++)
+    {
+        _mm_storeu_ps(lanes[i], _mm_div_ps(direction[i], length));
+    }
+
+    for (int i = 0; i < PACKET_SIZE; i++)
+    {
+        directions[i][0] = lanes[0][i];
+        directions[i][1] = lanes[1][i];
+        directions[i][2] = lanes[2][i];
+    }
+}
+
+#else
+
+static void packet_directions(RenderContext *context, int x, int y, float directions[PACKET_SIZE][3])
+{
+    SoftwareImage *image = context->image;
+    float ndc_y = ((float)y + 0.5f) / (float)image->height * 2.0f - 1.0f;
+
+    for (int i = 0; i < PACKET_SIZE; i++)
+    {
+        float ndc_x = ((float)(x + i) + 0.5f) / (float)image->width * 2.0f - 1.0f;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            directions[i][axis] = context->direction_base[axis] + context->direction_x[axis] * ndc_x + context->direction_y[axis] * ndc_y;
+        }
+        vec3_norm(directions[i], directions[i]);
+    }
+}
+
+#endif
+
+// Traces count neighbouring pixels of a row as one packet, see AScene.RaycastPacket
+static int trace_packet(RenderContext *context, int x, int y, int count, unsigned long long *steps)
+{
+    float directions[PACKET_SIZE][3];
+    packet_directions(context, x, y, directions);
+
+    unsigned int ray_steps[PACKET_SIZE];
+    unsigned int hit_lanes = AScene.RaycastPacket(context->serialized_scene, context->origin, (const float(*)[3])directions, (1U << count) - 1, INFINITY, NULL, ray_steps);
+
+    int hits = 0;
+    for (int i = 0; i < count; i++)
+    {
+        bool hit = hit_lanes & (1U << i);
+        *steps += ray_steps[i];
+        write_pixel(context->image, x + i, y, hit);
+        hits += hit;
+    }
+
+    return hits;
+}
+
+// Worker job, takes tiles until there are none left
+static void *render_tiles(void *data)
+{
+    RenderContext *context = data;
+    SoftwareImage *image = context->image;
+
+    int tile;
+    while ((tile = SDL_AtomicAdd(&context->next_tile, 1)) < context->tiles_count)
+    {
+        int start_x = (tile % context->tiles_x) * TILE_SIZE;
+        int start_y = (tile / context->tiles_x) * TILE_SIZE;
+        int end_x = start_x + TILE_SIZE < image->width ? start_x + TILE_SIZE : image->width;
+        int end_y = start_y + TILE_SIZE < image->height ? start_y + TILE_SIZE : image->height;
+
+        int hits = 0;
+        unsigned long long steps = 0;
+        for (int y = start_y; y < end_y; y++)
+        {
+            for (int x = start_x; x < end_x; x += PACKET_SIZE)
+            {
+                int count = end_x - x < PACKET_SIZE ? end_x - x : PACKET_SIZE;
+                hits += trace_packet(context, x, y, count, &steps);
+            }
+        }
+
+        SDL_AtomicAdd(&context->rays, (end_x - start_x) * (end_y - start_y));
+        SDL_AtomicAdd(&context->hits, hits);
+
+        SDL_AtomicLock(&context->steps_lock);
+        context->steps += steps;
+        SDL_AtomicUnlock(&context->steps_lock);
+    }
+
+    return NULL;
+}
+
+static SoftwareImage *Render(SerializedScene *serialized_scene, Camera *camera, int width, int height, SoftwareRenderStats *stats)
+{
+    if (!serialized_scene || !camera || width <= 0 || height <= 0)
+        ERROR_RETURN(NULL, "[ERROR] Nothing to render in software render.\n");
+
+    SoftwareImage *image = malloc(sizeof(SoftwareImage));
+    if (!image)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for software image.\n");
+
+    image->width = width;
+    image->height = height;
+    image->pixels = malloc((size_t)width * height * 3 * sizeof(float));
+    if (!image->pixels)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for software image pixels.\n");
+
+    RenderContext context = {.serialized_scene = serialized_scene, .image = image};
+    memcpy(context.origin, camera->position, sizeof(vec3));
+    setup_directions(&context, camera);
+
+    context.tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    context.tiles_count = context.tiles_x * ((height + TILE_SIZE - 1) / TILE_SIZE);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    ThreadsManager *manager = AThreadsManager.Default();
+    for (int i = 0; i < manager->workers_count; i++)
+    {
+        AThreadsManager.Add(manager, render_tiles, &context);
+    }
+    AThreadsManager.Wait(manager);
+
+    Uint64 end = SDL_GetPerformanceCounter();
+
+    if (stats)
+    {
+        stats->rays = (unsigned long long)SDL_AtomicGet(&context.rays);
+        stats->hits = (unsigned long long)SDL_AtomicGet(&context.hits);
+        stats->threads = manager->workers_count;
+        stats->seconds = (double)(end - start) / (double)SDL_GetPerformanceFrequency();
+        stats->rays_per_second_per_core = stats->seconds > 0.0 ? stats->rays / stats->seconds / stats->threads : 0.0;
+        stats->steps = context.steps;
+        stats->steps_per_ray = stats->rays ? (double)stats->steps / stats->rays : 0.0;
+
+        printf("[INFO] Software render %dx%d took %f ms, %.0f rays/s per core on %d threads, %.2f steps per ray\n",
+               width, height, stats->seconds * 1000.0, stats->rays_per_second_per_core, stats->threads, stats->steps_per_ray);
+    }
+
+    return image;
+}
+
+static void DeleteImage(SoftwareImage *image)
+{
+    if (!image)
+        return;
+
+    free(image->pixels);
+    free(image);
+}
+
+static void CompareDistanceFields(Scene *scene, Camera *camera, int width, int height)
+{
+    if (!scene || !camera)
+        return;
+
+    if (scene->serialize_dag)
+        fprintf(stderr, "[WARNING] Scene is serialized as a dag, which has no distance fields.\n");
+
+    bool distance_fields = scene->distance_fields;
+    SoftwareRenderStats stats[2];
+    for (int i = 0; i < 2; i++)
+    {
+        // Same scene and camera, only the distance fields differ
+        scene->distance_fields = i == 1;
+        SerializedScene serialized_scene = AScene.SerializeChunks(scene);
+        DeleteImage(Render(&serialized_scene, camera, width, height, &stats[i]));
+
+        free(serialized_scene.chunks_data);
+        free(serialized_scene.gpu_chunks);
+    }
+    scene->distance_fields = distance_fields;
+
+    printf("[INFO] Steps per ray %.2f without distance fields, %.2f with them, %.2fx fewer. Rays/s per core %.0f and %.0f\n",
+           stats[0].steps_per_ray, stats[1].steps_per_ray, stats[1].steps_per_ray > 0.0 ? stats[0].steps_per_ray / stats[1].steps_per_ray : 0.0,
+           stats[0].rays_per_second_per_core, stats[1].rays_per_second_per_core);
+}
+
+static int WritePPM(SoftwareImage *image, const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        ERROR_RETURN(1, "error opening file: %s. errno: %d\n", path, errno);
+
+    fprintf(fp, "P6\n%d %d\n255\n", image->width, image->height);
+
+    size_t count = (size_t)image->width * image->height * 3;
+    unsigned char *bytes = malloc(count);
+    if (!bytes)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for ppm image.\n");
+
+    for (size_t i = 0; i < count; i++)
+    {
+        float value = image->pixels[i] < 0.0f ? 0.0f : (image->pixels[i] > 1.0f ? 1.0f : image->pixels[i]);
+        bytes[i] = (unsigned char)(value * 255.0f + 0.5f);
+    }
+
+    size_t written = fwrite(bytes, count, 1, fp);
+    free(bytes);
+    fclose(fp);
+
+    if (written != 1)
+        ERROR_RETURN(1, "error writing file: %s. errno: %d\n", path, errno);
+
+    return 0;
+}
+
+static int WritePFM(SoftwareImage *image, const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        ERROR_RETURN(1, "error opening file: %s. errno: %d\n", path, errno);
+
+    // Negative scale means little endian, pfm rows go from the bottom up
+    fprintf(fp, "PF\n%d %d\n-1.0\n", image->width, image->height);
+
+    size_t row_size = (size_t)image->width * 3;
+    for (int y = image->height - 1; y >= 0; y--)
+    {
+        if (fwrite(&image->pixels[y * row_size], row_size * sizeof(float), 1, fp) != 1)
+        {
+            fclose(fp);
+            ERROR_RETURN(1, "error writing file: %s. errno: %d\n", path, errno);
+        }
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+struct ASoftwareRender ASoftwareRender =
+    {
+        .Render = Render,
+        .CompareDistanceFields = CompareDistanceFields,
+        .DeleteImage = DeleteImage,
+        .WritePPM = WritePPM,
+        .WritePFM = WritePFM,
+};
@@ -0,0 +1,70 @@
+/**
+ * @file software_render.h
+ * @author https://github.com/shaderko
+ * @brief Headless cpu renderer for serialized chunks, used where there is no gpu.
+ * @version 0.1
+ * @date 2024-06-02
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef SOFTWARE_RENDER_H
+#define SOFTWARE_RENDER_H
+
+#include "../../camera/camera.h"
+#include "../../object/map/scene.h"
+
+typedef struct SoftwareImage SoftwareImage;
+struct SoftwareImage
+{
+    int width;
+    int height;
+
+    // Rgb, row 0 is pixel row 0 of the compute shader output image
+    float *pixels;
+};
+
+typedef struct SoftwareRenderStats SoftwareRenderStats;
+struct SoftwareRenderStats
+{
+    unsigned long long rays;
+    unsigned long long hits;
+
+    int threads;
+    double seconds;
+    double rays_per_second_per_core;
+
+    // Octree cells the rays visited, the cost of a ray without the fixed setup
+    unsigned long long steps;
+    double steps_per_ray;
+};
+
+struct ASoftwareRender
+{
+    /**
+     * Traces the serialized scene the same way voxel.comp does, image tiles are spread over the
+     * default threads manager. Every 4 neighbouring pixels of a row are cast as one packet with
+     * AScene.RaycastPacket. Only position, view and projection of the camera are used, so the
+     * camera doesn't need a gl context. Stats can be NULL
+     */
+    SoftwareImage *(*Render)(SerializedScene *serialized_scene, Camera *camera, int width, int height, SoftwareRenderStats *stats);
+
+    /**
+     * Serializes and renders the scene once without and once with chunk distance fields and prints the
+     * average steps per ray of both, the scene's own serialization isn't changed
+     */
+    void (*CompareDistanceFields)(Scene *scene, Camera *camera, int width, int height);
+
+    void (*DeleteImage)(SoftwareImage *image);
+
+    // Writes the image as binary 8 bit ppm
+    int (*WritePPM)(SoftwareImage *image, const char *path);
+
+    // Writes the image as 32 bit float pfm
+    int (*WritePFM)(SoftwareImage *image, const char *path);
+};
+
+extern struct ASoftwareRender ASoftwareRender;
+
+#endif
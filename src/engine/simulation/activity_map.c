@@ -0,0 +1,163 @@
+/**
+ * @file activity_map.c
+ * @author https://github.com/shaderko
+ * @brief Tracks which bricks of a grid simulation changed, so a step only visits bricks that can change
+ * @version 0.1
+ * @date 2024-06-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <string.h>
+
+#include "activity_map.h"
+#include "../util/util.h"
+
+static ActivityMap *Init(unsigned int size_x, unsigned int size_y, unsigned int size_z)
+{
+    if (!size_x || !size_y || !size_z)
+        ERROR_EXIT("[ERROR] Activity map of %u x %u x %u bricks can't be created.\n", size_x, size_y, size_z);
+
+    ActivityMap *map = malloc(sizeof(ActivityMap));
+    if (!map)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for activity map.\n");
+
+    map->size[0] = size_x;
+    map->size[1] = size_y;
+    map->size[2] = size_z;
+    map->bricks_count = (size_t)size_x * size_y * size_z;
+
+    map->changed = malloc(map->bricks_count);
+    map->active = calloc(map->bricks_count, 1);
+    map->scratch = malloc(map->bricks_count);
+    if (!map->changed || !map->active || !map->scratch)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for activity map bricks.\n");
+
+    memset(map->changed, 1, map->bricks_count);
+
+    map->active_count = 0;
+    map->changed_count = 0;
+    map->steps = 0;
+    map->active_total = 0;
+
+    return map;
+}
+
+static void Delete(ActivityMap *map)
+{
+    if (!map)
+        return;
+
+    free(map->changed);
+    free(map->active);
+    free(map->scratch);
+    free(map);
+}
+
+static void Mark(ActivityMap *map, unsigned int x, unsigned int y, unsigned int z)
+{
+    if (x >= map->size[0] || y >= map->size[1] || z >= map->size[2])
+        return;
+
+    map->changed[((size_t)z * map->size[1] + y) * map->size[0] + x] = 1;
+}
+
+static void MarkAll(ActivityMap *map)
+{
+    memset(map->changed, 1, map->bricks_count);
+}
+
+/**
+ * Grows the flags of source by one brick along the axis with stride into destination. Lines are the runs of length
+ * bricks along the axis, they start at every index whose coordinate on the axis is 0
+ */
+static void grow_axis(ActivityMap *map, const unsigned char *source, unsigned char *destination, int axis)
+{
+    size_t stride = axis == 0 ? 1 : (axis == 1 ? map->size[0] : (size_t)map->size[0] * map->size[1]);
+    size_t length = map->size[axis];
+
+    for (size_t start = 0; start < map->bricks_count; start++)
+    {
+        if (start / stride % length)
+            continue;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            size_t index = start + i * stride;
+            unsigned char flag = source[index];
+            if (i > 0)
+                flag |= source[index - stride];
+            if (i + 1 < length)
+                flag |= source[index + stride];
+
+            destination[index] = flag;
+        }
+    }
+}
+
+static size_t Schedule(ActivityMap *map)
+{
+    size_t changed_count = 0;
+    for (size_t i = 0; i < map->bricks_count; i++)
+    {
+        changed_count += map->changed[i];
+    }
+
+    // Growing along each axis in turn reaches all 26 bricks around every changed one
+    grow_axis(map, map->changed, map->scratch, 0);
+    grow_axis(map, map->scratch, map->active, 1);
+    grow_axis(map, map->active, map->scratch, 2);
+
+    unsigned char *active = map->active;
+    map->active = map->scratch;
+    map->scratch = active;
+
+    size_t active_count = 0;
+    for (size_t i = 0; i < map->bricks_count; i++)
+    {
+        active_count += map->active[i];
+    }
+
+    memset(map->changed, 0, map->bricks_count);
+
+    map->changed_count = changed_count;
+    map->active_count = active_count;
+    map->steps++;
+    map->active_total += active_count;
+
+    return active_count;
+}
+
+static bool IsActive(ActivityMap *map, unsigned int x, unsigned int y, unsigned int z)
+{
+    if (x >= map->size[0] || y >= map->size[1] || z >= map->size[2])
+        return false;
+
+    return map->active[((size_t)z * map->size[1] + y) * map->size[0] + x];
+}
+
+static void PrintStats(ActivityMap *map, const char *name)
+{
+    if (!map->steps)
+    {
+        printf("[INFO] %s: no steps yet, %zu bricks\n", name, map->bricks_count);
+        return;
+    }
+
+    printf("[INFO] %s: step %llu visited %zu of %zu bricks (%.1f%%) after %zu changed, %.1f%% on average\n", name, map->steps,
+           map->active_count, map->bricks_count, 100.0 * map->active_count / map->bricks_count, map->changed_count,
+           100.0 * map->active_total / ((double)map->bricks_count * map->steps));
+}
+
+extern struct AActivityMap AActivityMap;
+struct AActivityMap AActivityMap =
+    {
+        .Init = Init,
+        .Delete = Delete,
+        .Mark = Mark,
+        .MarkAll = MarkAll,
+        .Schedule = Schedule,
+        .IsActive = IsActive,
+        .PrintStats = PrintStats,
+};
@@ -0,0 +1,68 @@
+/**
+ * @file activity_map.h
+ * @author https://github.com/shaderko
+ * @brief Tracks which bricks of a grid simulation changed, so a step only visits bricks that can change
+ * @version 0.1
+ * @date 2024-06-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef ACTIVITY_MAP_H
+#define ACTIVITY_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * One flag per brick of a simulation grid, the simulation picks the size of a brick. A cell only depends on the cells
+ * next to it, so a brick whose bricks around it didn't change last step will be the same after this one and can be
+ * skipped. Bricks must be at least one cell thick on every side
+ */
+typedef struct ActivityMap ActivityMap;
+struct ActivityMap
+{
+    unsigned int size[3]; // In bricks
+    size_t bricks_count;
+
+    unsigned char *changed; // Bricks marked during the step, cleared by Schedule
+    unsigned char *active;  // Bricks the current step visits, set by Schedule
+    unsigned char *scratch;
+
+    // Counters of the last step, from Schedule
+    size_t active_count;
+    size_t changed_count; // Bricks marked before the last step, everything Schedule grew the active bricks from
+
+    // Counters since Init
+    unsigned long long steps;
+    unsigned long long active_total;
+};
+
+struct AActivityMap
+{
+    // Creates a map of size_x by size_y by size_z bricks, all of them changed so the first step visits the whole grid
+    ActivityMap *(*Init)(unsigned int size_x, unsigned int size_y, unsigned int size_z);
+    void (*Delete)(ActivityMap *map);
+
+    // Marks a brick changed. Bricks outside the map are ignored
+    void (*Mark)(ActivityMap *map, unsigned int x, unsigned int y, unsigned int z);
+
+    // Marks every brick changed, after the whole grid was rewritten
+    void (*MarkAll)(ActivityMap *map);
+
+    /**
+     * Makes the changed bricks and every brick touching them active for the next step and clears the changed ones.
+     * Call once before every step, returns the active bricks
+     */
+    size_t (*Schedule)(ActivityMap *map);
+
+    bool (*IsActive)(ActivityMap *map, unsigned int x, unsigned int y, unsigned int z);
+
+    // Prints the active fraction of the last step and the average since Init
+    void (*PrintStats)(ActivityMap *map, const char *name);
+};
+
+extern struct AActivityMap AActivityMap;
+
+#endif
@@ -0,0 +1,461 @@
+/**
+ * @file cellular_automaton.c
+ * @author https://github.com/shaderko
+ * @brief 3D cellular automaton on a bitset, 64 cells are updated together with bit sliced neighbour counts
+ * @version 0.1
+ * @date 2024-06-26
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <string.h>
+
+#include "cellular_automaton.h"
+#include "../util/util.h"
+
+#define AUTOMATON_SLABS_PER_WORKER 4 // More slabs than workers so a slow worker doesn't hold up the step
+
+// Adds three bits of every cell, sum has weight 1 and carry weight 2. The outputs can be inputs
+#define FULL_ADD(a, b, c, sum, carry)                                   \
+    {                                                                   \
+        uint64_t add_a = (a), add_b = (b), add_c = (c);                 \
+        uint64_t add_partial = add_a ^ add_b;                           \
+        (sum) = add_partial ^ add_c;                                    \
+        (carry) = (add_a & add_b) | (add_partial & add_c);              \
+    }
+
+static CellularAutomaton *Init(unsigned int size_x, unsigned int size_y, unsigned int size_z, uint32_t birth, uint32_t survive)
+{
+    if (!size_x || !size_y || !size_z)
+        ERROR_EXIT("[ERROR] Cellular automaton of %u x %u x %u cells can't be created.\n", size_x, size_y, size_z);
+
+    CellularAutomaton *automaton = malloc(sizeof(CellularAutomaton));
+    if (!automaton)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for cellular automaton.\n");
+
+    automaton->size[0] = size_x;
+    automaton->size[1] = size_y;
+    automaton->size[2] = size_z;
+    automaton->row_words = (size_x + 63) / 64;
+    automaton->last_word_mask = size_x % 64 ? ((uint64_t)1 << (size_x % 64)) - 1 : ~(uint64_t)0;
+
+    size_t words = (size_t)automaton->row_words * size_y * size_z;
+    automaton->cells = calloc(words, sizeof(uint64_t));
+    automaton->next = calloc(words, sizeof(uint64_t));
+    automaton->empty_row = calloc(automaton->row_words, sizeof(uint64_t));
+    if (!automaton->cells || !automaton->next || !automaton->empty_row)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for cellular automaton cells.\n");
+
+    automaton->birth = birth;
+    automaton->survive = survive;
+    automaton->generation = 0;
+
+    // Every brick starts changed, with birth on 0 neighbours even an empty grid doesn't stay the same
+    automaton->activity = AActivityMap.Init(automaton->row_words, (size_y + AUTOMATON_BRICK_ROWS - 1) >> AUTOMATON_BRICK_DEPTH,
+                                            (size_z + AUTOMATON_BRICK_ROWS - 1) >> AUTOMATON_BRICK_DEPTH);
+
+    return automaton;
+}
+
+static void Delete(CellularAutomaton *automaton)
+{
+    if (!automaton)
+        return;
+
+    free(automaton->cells);
+    free(automaton->next);
+    free(automaton->empty_row);
+    AActivityMap.Delete(automaton->activity);
+    free(automaton);
+}
+
+static void Randomize(CellularAutomaton *automaton, float fill, unsigned int seed)
+{
+    uint32_t state = seed ? seed : 1;
+    uint32_t threshold = fill >= 1.0f ? UINT32_MAX : (fill <= 0.0f ? 0 : (uint32_t)(fill * 4294967296.0));
+
+    size_t rows = (size_t)automaton->size[1] * automaton->size[2];
+    for (size_t row = 0; row < rows; row++)
+    {
+        for (unsigned int word = 0; word < automaton->row_words; word++)
+        {
+            uint64_t cells = 0;
+            for (int bit = 0; bit < 64; bit++)
+            {
+                // Xorshift, one number for every cell
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                cells |= (uint64_t)(state < threshold) << bit;
+            }
+
+            if (word == automaton->row_words - 1)
+                cells &= automaton->last_word_mask;
+
+            automaton->cells[row * automaton->row_words + word] = cells;
+        }
+    }
+
+    AActivityMap.MarkAll(automaton->activity);
+}
+
+static bool Get(CellularAutomaton *automaton, unsigned int x, unsigned int y, unsigned int z)
+{
+    if (x >= automaton->size[0] || y >= automaton->size[1] || z >= automaton->size[2])
+        return false;
+
+    size_t row = ((size_t)z * automaton->size[1] + y) * automaton->row_words;
+    return (automaton->cells[row + x / 64] >> (x % 64)) & 1;
+}
+
+static void Set(CellularAutomaton *automaton, unsigned int x, unsigned int y, unsigned int z, bool alive)
+{
+    if (x >= automaton->size[0] || y >= automaton->size[1] || z >= automaton->size[2])
+        return;
+
+    size_t row = ((size_t)z * automaton->size[1] + y) * automaton->row_words;
+    if (alive)
+        automaton->cells[row + x / 64] |= (uint64_t)1 << (x % 64);
+    else
+        automaton->cells[row + x / 64] &= ~((uint64_t)1 << (x % 64));
+
+    AActivityMap.Mark(automaton->activity, x / 64, y >> AUTOMATON_BRICK_DEPTH, z >> AUTOMATON_BRICK_DEPTH);
+}
+
+// Row y, z of the cells, the empty row outside of the grid
+static const uint64_t *cell_row(CellularAutomaton *automaton, int y, int z)
+{
+    if (y < 0 || z < 0 || y >= (int)automaton->size[1] || z >= (int)automaton->size[2])
+        return automaton->empty_row;
+
+    return &automaton->cells[((size_t)z * automaton->size[1] + y) * automaton->row_words];
+}
+
+/**
+ * Live cells in the column of 9 rows around every cell of word w, the cell itself included, as 4 bit slices.
+ * Bit i of count[n] is bit n of the count of cell i
+ */
+static void column_count(const uint64_t *rows[9], unsigned int word, uint64_t count[4])
+{
+    uint64_t ones[3];
+    uint64_t twos[4];
+    for (int i = 0; i < 3; i++)
+    {
+        FULL_ADD(rows[i * 3][word], rows[i * 3 + 1][word], rows[i * 3 + 2][word], ones[i], twos[i]);
+    }
+
+    uint64_t fours[2];
+    FULL_ADD(ones[0], ones[1], ones[2], count[0], twos[3]);
+    FULL_ADD(twos[0], twos[1], twos[2], twos[0], fours[0]);
+
+    count[1] = twos[0] ^ twos[3];
+    fours[1] = twos[0] & twos[3];
+    count[2] = fours[0] ^ fours[1];
+    count[3] = fours[0] & fours[1];
+}
+
+/**
+ * Mask of the cells whose count of 0 to 27 is in the set, counts are 5 bit slices. The low two and the high three
+ * bits are decoded once, every count in the set is then one and
+ */
+static uint64_t count_in_set(const uint64_t count[5], uint32_t set)
+{
+    uint64_t low[4];
+    uint64_t high[8];
+    for (int i = 0; i < 4; i++)
+    {
+        low[i] = (i & 1 ? count[0] : ~count[0]) & (i & 2 ? count[1] : ~count[1]);
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        high[i] = (i & 1 ? count[2] : ~count[2]) & (i & 2 ? count[3] : ~count[3]) & (i & 4 ? count[4] : ~count[4]);
+    }
+
+    uint64_t mask = 0;
+    while (set)
+    {
+        unsigned int n = CTZ(set);
+        set &= set - 1;
+        mask |= low[n & 3] & high[n >> 2];
+    }
+
+    return mask;
+}
+
+/**
+ * Writes the next generation of the active bricks in the brick layers from layer_first to before layer_last and marks
+ * the ones that changed. Skipped bricks already hold the same cells in both buffers
+ */
+static void step_slab(CellularAutomaton *automaton, unsigned int layer_first, unsigned int layer_last)
+{
+    unsigned int row_words = automaton->row_words;
+    ActivityMap *activity = automaton->activity;
+
+    // Counts include the cell itself, so live cells compare against the survive set shifted by one
+    uint32_t birth = automaton->birth & AUTOMATON_RANGE(0, 26);
+    uint32_t survive = (automaton->survive & AUTOMATON_RANGE(0, 26)) << 1;
+
+    unsigned int z_first = layer_first << AUTOMATON_BRICK_DEPTH;
+    unsigned int z_last = layer_last << AUTOMATON_BRICK_DEPTH < automaton->size[2] ? layer_last << AUTOMATON_BRICK_DEPTH : automaton->size[2];
+    for (unsigned int z = z_first; z < z_last; z++)
+    {
+        for (unsigned int y = 0; y < automaton->size[1]; y++)
+        {
+            // Bricks of the row, one for every word
+            size_t brick = ((size_t)(z >> AUTOMATON_BRICK_DEPTH) * activity->size[1] + (y >> AUTOMATON_BRICK_DEPTH)) * row_words;
+            if (!memchr(&activity->active[brick], 1, row_words))
+                continue;
+
+            const uint64_t *rows[9];
+            for (int i = 0; i < 9; i++)
+            {
+                rows[i] = cell_row(automaton, (int)y + i % 3 - 1, (int)z + i / 3 - 1);
+            }
+
+            const uint64_t *self = rows[4];
+            uint64_t *next = &automaton->next[((size_t)z * automaton->size[1] + y) * row_words];
+
+            // Column counts of the words before, at and after the current one. Current is the column of word counted,
+            // a word after a skipped one counts its columns again
+            uint64_t previous[4] = {0, 0, 0, 0};
+            uint64_t current[4];
+            uint64_t following[4] = {0, 0, 0, 0};
+            unsigned int counted = row_words;
+
+            for (unsigned int word = 0; word < row_words; word++)
+            {
+                if (!activity->active[brick + word])
+                    continue;
+
+                if (counted != word)
+                {
+                    if (word > 0)
+                        column_count(rows, word - 1, previous);
+                    column_count(rows, word, current);
+                }
+
+                if (word + 1 < row_words)
+                    column_count(rows, word + 1, following);
+                else
+                    memset(following, 0, sizeof(following));
+
+                // Columns of the x - 1 and x + 1 neighbours, shifted in from the words next to this one
+                uint64_t left[4];
+                uint64_t right[4];
+                for (int bit = 0; bit < 4; bit++)
+                {
+                    left[bit] = current[bit] << 1 | previous[bit] >> 63;
+                    right[bit] = current[bit] >> 1 | following[bit] << 63;
+                }
+
+                // Adds the three 4 bit counts into 5 bits, at most 27
+                uint64_t count[5];
+                uint64_t carry[2];
+                uint64_t partial;
+                uint64_t carry_high;
+                FULL_ADD(left[0], current[0], right[0], count[0], carry[0]);
+                FULL_ADD(left[1], current[1], right[1], partial, carry[1]);
+                count[1] = partial ^ carry[0];
+                carry_high = partial & carry[0];
+                FULL_ADD(left[2], current[2], right[2], partial, carry[0]);
+                FULL_ADD(partial, carry[1], carry_high, count[2], carry[1]);
+                FULL_ADD(left[3], current[3], right[3], partial, carry_high);
+                FULL_ADD(partial, carry[0], carry[1], count[3], carry[0]);
+                count[4] = carry_high | carry[0];
+
+                uint64_t alive = self[word];
+                uint64_t cells = (~alive & count_in_set(count, birth)) | (alive & count_in_set(count, survive));
+                if (word == row_words - 1)
+                    cells &= automaton->last_word_mask;
+
+                next[word] = cells;
+
+                // Slabs are whole brick layers, so no other job writes the flags of these bricks
+                if (cells != alive)
+                    activity->changed[brick + word] = 1;
+
+                memcpy(previous, current, sizeof(current));
+                memcpy(current, following, sizeof(following));
+                counted = word + 1;
+            }
+        }
+    }
+}
+
+typedef struct AutomatonSlab AutomatonSlab;
+struct AutomatonSlab
+{
+    CellularAutomaton *automaton;
+    unsigned int layer_first;
+    unsigned int layer_last;
+};
+
+static void *step_job(void *data)
+{
+    AutomatonSlab *slab = data;
+    step_slab(slab->automaton, slab->layer_first, slab->layer_last);
+    return NULL;
+}
+
+static void Step(CellularAutomaton *automaton, ThreadsManager *manager)
+{
+    if (!automaton)
+        return;
+
+    // Bricks that changed last step and the ones around them are the only ones that can change in this one
+    ActivityMap *activity = automaton->activity;
+    if (!AActivityMap.Schedule(activity))
+    {
+        automaton->generation++;
+        return;
+    }
+
+    unsigned int layers = activity->size[2];
+    unsigned int slabs_count = manager ? (unsigned int)manager->workers_count * AUTOMATON_SLABS_PER_WORKER : 1;
+    if (slabs_count > layers)
+        slabs_count = layers;
+
+    if (slabs_count <= 1)
+    {
+        step_slab(automaton, 0, layers);
+    }
+    else
+    {
+        AutomatonSlab *slabs = malloc(slabs_count * sizeof(AutomatonSlab));
+        if (!slabs)
+            ERROR_EXIT("[ERROR] Failed to allocate memory for cellular automaton slabs.\n");
+
+        for (unsigned int i = 0; i < slabs_count; i++)
+        {
+            slabs[i] = (AutomatonSlab){automaton, layers * i / slabs_count, layers * (i + 1) / slabs_count};
+            AThreadsManager.Add(manager, step_job, &slabs[i]);
+        }
+
+        AThreadsManager.Wait(manager);
+        free(slabs);
+    }
+
+    uint64_t *cells = automaton->cells;
+    automaton->cells = automaton->next;
+    automaton->next = cells;
+    automaton->generation++;
+}
+
+static unsigned long long Count(CellularAutomaton *automaton)
+{
+    unsigned long long count = 0;
+    size_t words = (size_t)automaton->row_words * automaton->size[1] * automaton->size[2];
+    for (size_t i = 0; i < words; i++)
+    {
+        count += POPCOUNT64(automaton->cells[i]);
+    }
+
+    return count;
+}
+
+static void WriteToScene(CellularAutomaton *automaton, Scene *scene, const int offset[3], unsigned char color)
+{
+    if (!automaton || !scene)
+        return;
+
+    int first_chunk[3];
+    int last_chunk[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        // Arithmetic shift rounds negative voxels down to their chunk
+        first_chunk[axis] = offset[axis] >> CHUNK_DEPTH;
+        last_chunk[axis] = (offset[axis] + (int)automaton->size[axis] - 1) >> CHUNK_DEPTH;
+    }
+
+    OctreeVoxel *voxels = malloc(CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE * sizeof(OctreeVoxel));
+    if (!voxels)
+        ERROR_EXIT("[ERROR] Failed to allocate memory for cellular automaton voxels.\n");
+
+    for (int chunk_z = first_chunk[2]; chunk_z <= last_chunk[2]; chunk_z++)
+    {
+        for (int chunk_y = first_chunk[1]; chunk_y <= last_chunk[1]; chunk_y++)
+        {
+            for (int chunk_x = first_chunk[0]; chunk_x <= last_chunk[0]; chunk_x++)
+            {
+                // Part of the grid inside the chunk, in cells
+                int chunk_position[3] = {chunk_x, chunk_y, chunk_z};
+                int first[3];
+                int last[3];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    int chunk_first = chunk_position[axis] * CHUNK_SIZE - offset[axis];
+                    first[axis] = chunk_first > 0 ? chunk_first : 0;
+                    last[axis] = chunk_first + CHUNK_SIZE - 1 < (int)automaton->size[axis] - 1 ? chunk_first + CHUNK_SIZE - 1 : (int)automaton->size[axis] - 1;
+                }
+
+                // Live cells of every row are found a word at a time
+                unsigned int count = 0;
+                for (int z = first[2]; z <= last[2]; z++)
+                {
+                    for (int y = first[1]; y <= last[1]; y++)
+                    {
+                        const uint64_t *row = cell_row(automaton, y, z);
+                        for (int word = first[0] / 64; word <= last[0] / 64; word++)
+                        {
+                            uint64_t cells = row[word];
+                            if (word == first[0] / 64)
+                                cells &= ~(uint64_t)0 << (first[0] % 64);
+                            if (word == last[0] / 64 && last[0] % 64 != 63)
+                                cells &= ((uint64_t)1 << (last[0] % 64 + 1)) - 1;
+
+                            while (cells)
+                            {
+                                int x = word * 64 + (int)CTZ64(cells);
+                                cells &= cells - 1;
+
+                                voxels[count++] = (OctreeVoxel){x + offset[0] - chunk_x * CHUNK_SIZE, y + offset[1] - chunk_y * CHUNK_SIZE, z + offset[2] - chunk_z * CHUNK_SIZE, color};
+                            }
+                        }
+                    }
+                }
+
+                Chunk *chunk = AScene.GetChunk(scene, chunk_x, chunk_y, chunk_z);
+                if (!chunk)
+                {
+                    if (!count)
+                        continue;
+
+                    chunk = AChunk.Init((vec3){(float)chunk_x, (float)chunk_y, (float)chunk_z});
+                    AScene.AddChunk(scene, chunk);
+                }
+                else
+                {
+                    int min[3];
+                    int max[3];
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        min[axis] = first[axis] + offset[axis] - chunk_position[axis] * CHUNK_SIZE;
+                        max[axis] = last[axis] + offset[axis] - chunk_position[axis] * CHUNK_SIZE;
+                    }
+
+                    AChunk.ClearBox(chunk, min, max);
+                }
+
+                if (count)
+                    AChunk.AddBatch(chunk, voxels, count);
+            }
+        }
+    }
+
+    free(voxels);
+}
+
+extern struct ACellularAutomaton ACellularAutomaton;
+struct ACellularAutomaton ACellularAutomaton =
+    {
+        .Init = Init,
+        .Delete = Delete,
+        .Randomize = Randomize,
+        .Get = Get,
+        .Set = Set,
+        .Step = Step,
+        .Count = Count,
+        .WriteToScene = WriteToScene,
+};
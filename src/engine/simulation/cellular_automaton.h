@@ -0,0 +1,87 @@
+/**
+ * @file cellular_automaton.h
+ * @author https://github.com/shaderko
+ * @brief 3D cellular automaton on a bitset, 64 cells are updated together with bit sliced neighbour counts
+ * @version 0.1
+ * @date 2024-06-26
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef CELLULAR_AUTOMATON_ENGINE_H
+#define CELLULAR_AUTOMATON_ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../object/map/scene.h"
+#include "../threading/threads_manager.h"
+#include "activity_map.h"
+
+// Rule sets, bit n is set if n of the 26 neighbours are enough
+#define AUTOMATON_COUNT(n) (1U << (n))
+#define AUTOMATON_RANGE(first, last) ((0xFFFFFFFFU >> (31 - (last))) & (0xFFFFFFFFU << (first)))
+
+// Bricks of the activity map are one word along x by AUTOMATON_BRICK_ROWS rows along y and z
+#define AUTOMATON_BRICK_DEPTH 3
+#define AUTOMATON_BRICK_ROWS (1 << AUTOMATON_BRICK_DEPTH)
+
+/**
+ * Cells are bits, row y, z along x is row_words words starting at word (z * size_y + y) * row_words with bit x % 64
+ * of word x / 64, the same layout as chunk occupancy. Cells outside the grid are dead.
+ * Every step reads cells and writes next, then the two swap, so a step never sees cells it already changed.
+ * A step only visits the bricks that changed last step and the ones around them, the rest of the grid is already the
+ * same in both buffers
+ */
+typedef struct CellularAutomaton CellularAutomaton;
+struct CellularAutomaton
+{
+    unsigned int size[3];
+    unsigned int row_words;
+    uint64_t last_word_mask; // Cells of the last word of every row that are inside the grid
+
+    uint64_t *cells;
+    uint64_t *next;
+    uint64_t *empty_row; // Rows outside the grid
+
+    uint32_t birth;   // A dead cell becomes alive with these neighbour counts
+    uint32_t survive; // A live cell stays alive with these neighbour counts
+
+    unsigned long long generation;
+
+    ActivityMap *activity; // Brick x is word x of the row, the counters show how much of the grid the last step visited
+};
+
+struct ACellularAutomaton
+{
+    // Creates a grid of dead cells, birth and survive are sets of AUTOMATON_COUNT and AUTOMATON_RANGE
+    CellularAutomaton *(*Init)(unsigned int size_x, unsigned int size_y, unsigned int size_z, uint32_t birth, uint32_t survive);
+    void (*Delete)(CellularAutomaton *automaton);
+
+    // Makes every cell alive with the chance of fill, the same seed gives the same cells
+    void (*Randomize)(CellularAutomaton *automaton, float fill, unsigned int seed);
+
+    // Set marks the cell's brick changed, so the next step visits it
+    bool (*Get)(CellularAutomaton *automaton, unsigned int x, unsigned int y, unsigned int z);
+    void (*Set)(CellularAutomaton *automaton, unsigned int x, unsigned int y, unsigned int z, bool alive);
+
+    /**
+     * Advances every cell by one generation. Slabs along z run on the workers of manager, NULL steps on this thread.
+     * Blocks until the step is done, so it can't be called from inside a job of the manager
+     */
+    void (*Step)(CellularAutomaton *automaton, ThreadsManager *manager);
+
+    // Live cells of the grid
+    unsigned long long (*Count)(CellularAutomaton *automaton);
+
+    /**
+     * Writes the grid into the chunks of the scene with cell 0, 0, 0 at the world voxel offset. Voxels of the grid's
+     * box are replaced, live cells get color. Missing chunks are added, chunks that stay empty aren't
+     */
+    void (*WriteToScene)(CellularAutomaton *automaton, Scene *scene, const int offset[3], unsigned char color);
+};
+
+extern struct ACellularAutomaton ACellularAutomaton;
+
+#endif
@@ -19,6 +19,12 @@ static Thread *Init(void *(*func)(void *), void *data)
     Thread *thread = malloc(sizeof(Thread));
     if (!thread)
         ERROR_EXIT("[ERROR] Thread memory couldn't be allocated.");
+
+    thread->func = func;
+    thread->data = data;
+    thread->done = false;
+
+    return thread;
 }
 
 static void Delete(Thread *thread)
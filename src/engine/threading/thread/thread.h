@@ -15,6 +15,7 @@
 #include <stdbool.h>
 #include "../../util/util.h"
 
+// Single job that can be run by the threads manager
 typedef struct Thread Thread;
 struct Thread
 {
@@ -30,6 +31,6 @@ struct AThread
     void (*Delete)(Thread *thread);
 };
 
-extern struct AScene AScene;
+extern struct AThread AThread;
 
 #endif
\ No newline at end of file
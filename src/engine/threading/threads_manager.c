@@ -9,8 +9,160 @@
  *
  */
 
+#include <string.h>
+
 #include "threads_manager.h"
 
 #define MAX_THREADS 254
 
-// Create all threads and dynamically adjust by the amount of work
\ No newline at end of file
+static int worker_func(void *data)
+{
+    ThreadsManager *manager = data;
+
+    SDL_LockMutex(manager->mutex);
+    while (true)
+    {
+        while (manager->queue_size == 0 && !manager->quit)
+        {
+            SDL_CondWait(manager->work_added, manager->mutex);
+        }
+
+        if (manager->queue_size == 0 && manager->quit)
+            break;
+
+        Thread *thread = manager->queue[manager->queue_head];
+        manager->queue_head = (manager->queue_head + 1) % manager->queue_capacity;
+        manager->queue_size--;
+        manager->running++;
+
+        SDL_UnlockMutex(manager->mutex);
+
+        thread->func(thread->data);
+        thread->done = true;
+        AThread.Delete(thread);
+
+        SDL_LockMutex(manager->mutex);
+        manager->running--;
+        if (manager->queue_size == 0 && manager->running == 0)
+            SDL_CondBroadcast(manager->work_done);
+    }
+    SDL_UnlockMutex(manager->mutex);
+
+    return 0;
+}
+
+// Create all threads and dynamically adjust by the amount of work
+static ThreadsManager *Init(int workers_count)
+{
+    ThreadsManager *manager = malloc(sizeof(ThreadsManager));
+    if (!manager)
+        ERROR_EXIT("[ERROR] Threads manager memory couldn't be allocated.\n");
+
+    memset(manager, 0, sizeof(ThreadsManager));
+
+    if (workers_count <= 0)
+        workers_count = SDL_GetCPUCount();
+    if (workers_count > MAX_THREADS)
+        workers_count = MAX_THREADS;
+
+    manager->mutex = SDL_CreateMutex();
+    manager->work_added = SDL_CreateCond();
+    manager->work_done = SDL_CreateCond();
+    manager->workers = malloc(workers_count * sizeof(SDL_Thread *));
+    if (!manager->mutex || !manager->work_added || !manager->work_done || !manager->workers)
+        ERROR_EXIT("[ERROR] Failed to create threads manager.\n");
+
+    manager->workers_count = workers_count;
+    for (int i = 0; i < workers_count; i++)
+    {
+        manager->workers[i] = SDL_CreateThread(worker_func, "Worker", manager);
+        if (!manager->workers[i])
+            ERROR_EXIT("[ERROR] Failed to create worker thread!\n");
+    }
+
+    return manager;
+}
+
+static void Delete(ThreadsManager *manager)
+{
+    if (!manager)
+        return;
+
+    SDL_LockMutex(manager->mutex);
+    manager->quit = true;
+    SDL_CondBroadcast(manager->work_added);
+    SDL_UnlockMutex(manager->mutex);
+
+    for (int i = 0; i < manager->workers_count; i++)
+    {
+        SDL_WaitThread(manager->workers[i], NULL);
+    }
+
+    SDL_DestroyCond(manager->work_added);
+    SDL_DestroyCond(manager->work_done);
+    SDL_DestroyMutex(manager->mutex);
+
+    free(manager->workers);
+    free(manager->queue);
+    free(manager);
+}
+
+static void Add(ThreadsManager *manager, void *(*func)(void *), void *data)
+{
+    Thread *thread = AThread.Init(func, data);
+
+    SDL_LockMutex(manager->mutex);
+
+    if (manager->queue_size == manager->queue_capacity)
+    {
+        // Grow the ring buffer and move the queued jobs to its start
+        size_t capacity = manager->queue_capacity ? manager->queue_capacity * 2 : 64;
+        Thread **queue = malloc(capacity * sizeof(Thread *));
+        if (!queue)
+            ERROR_EXIT("[ERROR] Failed to grow threads manager queue.\n");
+
+        for (size_t i = 0; i < manager->queue_size; i++)
+        {
+            queue[i] = manager->queue[(manager->queue_head + i) % manager->queue_capacity];
+        }
+
+        free(manager->queue);
+        manager->queue = queue;
+        manager->queue_head = 0;
+        manager->queue_capacity = capacity;
+    }
+
+    manager->queue[(manager->queue_head + manager->queue_size) % manager->queue_capacity] = thread;
+    manager->queue_size++;
+
+    SDL_CondSignal(manager->work_added);
+    SDL_UnlockMutex(manager->mutex);
+}
+
+static void Wait(ThreadsManager *manager)
+{
+    SDL_LockMutex(manager->mutex);
+    while (manager->queue_size > 0 || manager->running > 0)
+    {
+        SDL_CondWait(manager->work_done, manager->mutex);
+    }
+    SDL_UnlockMutex(manager->mutex);
+}
+
+static ThreadsManager *Default()
+{
+    static ThreadsManager *manager = NULL;
+    if (!manager)
+        manager = Init(0);
+
+    return manager;
+}
+
+struct AThreadsManager AThreadsManager =
+    {
+        .Init = Init,
+        .Delete = Delete,
+        .Add = Add,
+        .Wait = Wait,
+        .Default = Default,
+};
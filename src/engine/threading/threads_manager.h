@@ -0,0 +1,70 @@
+/**
+ * @file threads_manager.h
+ * @author your name (you@domain.com)
+ * @brief Manages all threads and spreads the work load
+ * @version 0.1
+ * @date 2024-05-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef THREADS_MANAGER_H
+#define THREADS_MANAGER_H
+
+#include <SDL.h>
+#include <stdbool.h>
+
+#include "thread/thread.h"
+
+typedef struct ThreadsManager ThreadsManager;
+struct ThreadsManager
+{
+    SDL_Thread **workers;
+    int workers_count;
+
+    SDL_mutex *mutex;
+    SDL_cond *work_added;
+    SDL_cond *work_done;
+
+    // Ring buffer of jobs waiting for a worker
+    Thread **queue;
+    size_t queue_head;
+    size_t queue_size;
+    size_t queue_capacity;
+
+    size_t running; // Jobs taken by a worker that didn't finish yet
+    bool quit;
+};
+
+struct AThreadsManager
+{
+    /**
+     * Starts workers_count worker threads, 0 starts one for each cpu core
+     */
+    ThreadsManager *(*Init)(int workers_count);
+
+    /**
+     * Finishes all queued jobs and stops the workers
+     */
+    void (*Delete)(ThreadsManager *manager);
+
+    /**
+     * Queues func to be called with data on one of the workers
+     */
+    void (*Add)(ThreadsManager *manager, void *(*func)(void *), void *data);
+
+    /**
+     * Blocks until every queued job is done, don't call it from inside a job
+     */
+    void (*Wait)(ThreadsManager *manager);
+
+    /**
+     * Shared manager with one worker per cpu core, created on first use
+     */
+    ThreadsManager *(*Default)();
+};
+
+extern struct AThreadsManager AThreadsManager;
+
+#endif
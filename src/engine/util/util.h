@@ -29,6 +29,46 @@
         return R;                     \
     }
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define POPCOUNT(x) __popcnt(x)
+#define POPCOUNT64(x) ((unsigned int)__popcnt64(x))
+
+static __inline unsigned int msvc_ctz(unsigned int x)
+{
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return index;
+}
+
+static __inline unsigned int msvc_ctz64(unsigned long long x)
+{
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return index;
+}
+
+static __inline unsigned int msvc_msb(unsigned int x)
+{
+    unsigned long index;
+    _BitScanReverse(&index, x);
+    return index;
+}
+
+// Index of the lowest and highest set bit, x can't be 0
+#define CTZ(x) msvc_ctz(x)
+#define CTZ64(x) msvc_ctz64(x)
+#define MSB(x) msvc_msb(x)
+#else
+#define POPCOUNT(x) __builtin_popcount(x)
+#define POPCOUNT64(x) __builtin_popcountll(x)
+
+// Index of the lowest and highest set bit, x can't be 0
+#define CTZ(x) ((unsigned int)__builtin_ctz(x))
+#define CTZ64(x) ((unsigned int)__builtin_ctzll(x))
+#define MSB(x) (31U - (unsigned int)__builtin_clz(x))
+#endif
+
 ull generate_random_id();
 
 #endif
\ No newline at end of file
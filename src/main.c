@@ -10,6 +10,8 @@
 #include "editor/editor.h"
 #include "engine/object/chunk/chunk.h"
 #include "engine/object/chunk/octree/octree.h"
+#include "engine/object/map/chunk_streamer.h"
+#include "engine/object/map/terrain.h"
 
 #include "../assets/cellular_automaton.h"
 
@@ -32,18 +34,9 @@ int main(int argc, char *argv[])
     // main_window->scene = scene;
     editor->scene = scene;
 
-    Chunk *chunk = AChunk.Init((vec3){0, 1, 0});
-    AScene.AddChunk(scene, chunk);
-    for (int x = 0; x < 5; x++)
-    {
-        for (int y = 0; y < 5; y++)
-        {
-            for (int z = 0; z < 5; z++)
-            {
-                AChunk.Add(chunk, x, y, z, 0, 0);
-            }
-        }
-    }
+    // Terrain around the camera is generated on the streamer's workers a few chunks every frame, so the first frame doesn't wait for it
+    Terrain *terrain = ATerrain.Init(NULL);
+    ChunkStreamer *streamer = AChunkStreamer.Init(scene, ATerrain.Load, terrain, 512.0f, (size_t)512 << 20);
 
     // Chunk *chunk = AChunk.Init((vec3){0, 1, 0});
     // AScene.AddChunk(scene, chunk);
@@ -130,6 +123,7 @@ int main(int argc, char *argv[])
         }
 
         ACamera->UpdateView(editor->editor_camera->camera);
+        AChunkStreamer.Update(streamer, editor->editor_camera->camera);
         // ACamera->UpdateView(main_camera);
         // end = SDL_GetPerformanceCounter();
         // deltaTime = (double)((end - start) * 1000) / SDL_GetPerformanceFrequency();
@@ -151,6 +145,9 @@ int main(int argc, char *argv[])
         // break;
     }
 
+    AChunkStreamer.Delete(streamer);
+    ATerrain.Delete(terrain);
+
     deleteCellularAutomaton();
 
     AWindow->Destroy(editor->window);